@@ -0,0 +1,78 @@
+/*
+
+    Program image file of the p-code tools
+
+    passembler writes it, vm, pdisasm, ptrview and vmdbgui
+    read it (see virtualmachine/imagefile.h). Little-endian:
+
+        vm_imageheader_t    at offset 0
+        vm_section_t        nsections entries after the header
+        sections            each at a multiple of VM_IMAGE_ALIGN
+
+    Sections start on a page, so each one can be mapped on
+    its own and used in place. Readers skip section types
+    they do not know; there is at most one of each type.
+
+    VM_SECTION_CODE     packed instruction_t, the program
+    VM_SECTION_DATA     int16_t initial values of the program's
+                        variables, from frame offset 3 on
+    VM_SECTION_SYMBOLS  label table as text, "<address> <name>"
+                        per line (see virtualmachine/symfile.h)
+    VM_SECTION_LINES    vm_lineentry_t sorted by pc: source line
+                        of the instructions from pc on
+    VM_SECTION_DECODED  vm_dins_t, one per instruction and the
+                        DOP_BAD sentinel, as vm_decode() and
+                        vm_fuse() leave them; info holds
+                        VM_DECODED_ABI of the writer
+
+    A file that does not start with VM_IMAGE_MAGIC is a raw
+    image: the code section alone, which is what the 6309
+    ROM takes (passembler --raw).
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include "opcodes.h"
+
+#define VM_IMAGE_MAGIC      "PCOD"
+#define VM_IMAGE_VERSION    1
+#define VM_IMAGE_ALIGN      4096
+
+/* a decoded section is only used by the decoder that wrote it */
+#define VM_DECODED_ABI      ((DOP_COUNT << 8) | sizeof(vm_dins_t))
+
+typedef enum
+{
+    VM_SECTION_CODE     = 1,
+    VM_SECTION_DATA     = 2,
+    VM_SECTION_SYMBOLS  = 3,
+    VM_SECTION_LINES    = 4,
+    VM_SECTION_DECODED  = 5
+} vm_sectiontype_t;
+
+typedef struct
+{
+    char     magic[4];      /* VM_IMAGE_MAGIC                       */
+    uint16_t version;       /* VM_IMAGE_VERSION                     */
+    uint16_t nsections;
+    uint16_t entry;         /* pc of the first instruction to run   */
+    uint16_t flags;         /* 0                                    */
+    uint32_t stackcells;    /* data stack the program needs, 0: unbounded */
+} vm_imageheader_t;
+
+typedef struct
+{
+    uint32_t type;          /* vm_sectiontype_t                     */
+    uint32_t offset;        /* from the start of the file           */
+    uint32_t size;          /* bytes                                */
+    uint32_t info;          /* depends on the type, 0 if unused     */
+} vm_section_t;
+
+typedef struct
+{
+    uint16_t pc;
+    uint16_t reserved;
+    uint32_t line;
+} vm_lineentry_t;
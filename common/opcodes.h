@@ -11,17 +11,63 @@
 */
 
 #pragma once 
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+/* host-side instruction, produced from the packed
+   instruction_t image by vm_decode() */
+typedef struct
+{
+    uint8_t  op;        /* flat opcode, see dop_t       */
+    uint8_t  level;     /* static level difference      */
+    union
+    {
+        int16_t  n;     /* literal or frame offset      */
+        uint16_t a;     /* jump/call target (pc)        */
+    };
+} vm_dins_t;
+
+/* host interface of OPR_ININT/INCHAR/OUTINT/OUTCHAR,
+   user is passed to every call */
+typedef struct
+{
+    int16_t (*readInt)(void *user);
+    int16_t (*readChar)(void *user);
+    void    (*writeInt)(void *user, int16_t v);
+    void    (*writeChar)(void *user, int16_t v);
+    void    *user;
+    /* can ININT (number) or INCHAR read without waiting?
+       NULL: always. Only vm_run() stops to wait. */
+    bool    (*ready)(void *user, bool number);
+} vm_host_t;
+
+struct vm_probes_s;
 
 typedef struct
 {
     uint8_t  *mem;      /* program memory               */
     int16_t  *dstack;   /* data stack memory            */
+    uint32_t stacksize; /* cells in dstack, see vm_stack_resize() */
+    uint8_t  stackmapped; /* dstack has guard pages */
     uint16_t pc;        /* program counter     (mem)    */
+    uint16_t entry;     /* pc after vm_reset(), 0 unless the image says otherwise */
     uint16_t t;         /* stack pointer/index (dstack) */
     uint16_t b;         /* base pointer/index  (dstack) */
     size_t   inscount;  /* number of instructions executed */
+    size_t   inslimit;  /* VM_POLICY_LIMIT stops when inscount reaches it */
     uint16_t memsize;   /* number of bytes in mem buffer */
+    vm_dins_t *code;    /* decoded program, codelen+1 entries */
+    uint16_t codelen;   /* number of instructions in mem */
+    uint8_t  maxlevel;  /* highest static level used by the program */
+    uint8_t  sharedcode; /* code belongs to another context (vm_share()) or an image */
+    uint8_t  verified;  /* code passed vm_verify(), see vm_needs_checks() */
+    const int16_t *data; /* initial values of the program's variables, or NULL */
+    uint16_t ndata;     /* cells in data */
+    vm_host_t host;     /* console I/O, stdio after vm_init() */
+    uint8_t  stop;      /* why the VM stopped, see vm_stop_t */
+    uint8_t  *breakpoints; /* codelen+1 flags for VM_POLICY_BREAK, or NULL */
+    struct vm_probes_s *probes; /* profilers and tracers of the vm tool, or NULL */
 } vm_context_t;
 
 
@@ -66,6 +112,78 @@ typedef enum
     OPR_ININT   = 20
 } opr_t;
 
+// flat opcodes of the decoded instructions (vm_dins_t).
+// DOP_RET..DOP_ININT follow the order of opr_t.
+typedef enum
+{
+    DOP_LIT = 0,
+    DOP_LOD,
+    DOP_STO,
+    DOP_CAL,
+    DOP_INT,
+    DOP_JMP,
+    DOP_JPC,
+    DOP_LODX,
+    DOP_STOX,
+    DOP_HALT,
+    DOP_RET,
+    DOP_NEG,
+    DOP_ADD,
+    DOP_SUB,
+    DOP_MUL,
+    DOP_DIV,
+    DOP_ODD,
+    DOP_NOP,        // OPR_NULL and unknown OPR functions
+    DOP_EQ,
+    DOP_NEQ,
+    DOP_LESS,
+    DOP_LEQ,
+    DOP_GREATER,
+    DOP_GEQ,
+    DOP_SHR,
+    DOP_SHL,
+    DOP_SAR,
+    DOP_OUTCHAR,
+    DOP_OUTINT,
+    DOP_INCHAR,
+    DOP_ININT,
+    DOP_BAD,        // illegal opcode or end of program
+
+    // superinstructions, see vm_fuse()
+    DOP_FUSED,
+    DOP_LOD_LIT_ADD_STO = DOP_FUSED,
+    DOP_LIT_OUTCHAR_LIT_OUTCHAR,
+    DOP_LIT_STO,
+    DOP_LOD_STO,
+    DOP_LOD_ADD,    // LOD + arithmetic, DOP_ADD..DOP_DIV order
+    DOP_LOD_SUB,
+    DOP_LOD_MUL,
+    DOP_LOD_DIV,
+    DOP_LOD_LOD_ADD,
+    DOP_LOD_LOD_SUB,
+    DOP_LOD_LOD_MUL,
+    DOP_LOD_LOD_DIV,
+    DOP_LOD_EQ_JPC, // compare + JPC, DOP_EQ..DOP_GEQ order
+    DOP_LOD_NEQ_JPC,
+    DOP_LOD_LESS_JPC,
+    DOP_LOD_LEQ_JPC,
+    DOP_LOD_GREATER_JPC,
+    DOP_LOD_GEQ_JPC,
+    DOP_LOD_LOD_EQ_JPC,
+    DOP_LOD_LOD_NEQ_JPC,
+    DOP_LOD_LOD_LESS_JPC,
+    DOP_LOD_LOD_LEQ_JPC,
+    DOP_LOD_LOD_GREATER_JPC,
+    DOP_LOD_LOD_GEQ_JPC,
+    DOP_LOD_LIT_EQ_JPC,
+    DOP_LOD_LIT_NEQ_JPC,
+    DOP_LOD_LIT_LESS_JPC,
+    DOP_LOD_LIT_LEQ_JPC,
+    DOP_LOD_LIT_GREATER_JPC,
+    DOP_LOD_LIT_GEQ_JPC,
+    DOP_COUNT
+} dop_t;
+
 #pragma pack(push,1)
 typedef struct
 {
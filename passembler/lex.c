@@ -70,6 +70,7 @@ char lex_toupper(const char c)
     {
         return c - 'a' + 'A';
     }
+    return c;
 }
 
 // check if the current token string is a keyword
@@ -80,7 +81,7 @@ void lex_checkKeyword(lex_context_t *context)
     {
         const char *kw = keywords[kwindex];
         
-        if (kw[context->toklen] != 0)
+        if (strlen(kw) != context->toklen)
         {
             // keyword and token are not the same length
             // so skip this keyword
@@ -220,7 +221,7 @@ void lex_next(lex_context_t *context)
             }
             break;
         case LS_LABEL:
-            if (isNumeric(c) || isAlpha(c))
+            if (isNumeric(c) || isAlpha(c) || (c == '_'))
             {
                 lex_acceptchar(context);
             }
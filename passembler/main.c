@@ -7,6 +7,8 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
 #include "lex.h"
 #include "parse.h"
 
@@ -14,16 +16,38 @@ int main(int argc, char *argv[])
 {
     printf("; p-code assembler v0.1\n\n");
 
-    if (argc < 2)
+    const char *fname   = NULL;
+    const char *outname = "code.bin";
+    bool raw = false;
+    for(int i=1; i<argc; i++)
     {
-        printf("Usage: %s <infile>\n", argv[0]);
+        if ((strcmp(argv[i], "-o") == 0) && (i+1 < argc))
+        {
+            outname = argv[++i];
+        }
+        else if (strcmp(argv[i], "--raw") == 0)
+        {
+            raw = true;
+        }
+        else
+        {
+            fname = argv[i];
+        }
+    }
+
+    if (fname == NULL)
+    {
+        printf("Usage: %s [-o <outfile>] [--raw] <infile>\n", argv[0]);
+        printf("  -o <f>   output file (default: code.bin)\n");
+        printf("  --raw    packed instructions only, as the 6309 ROM takes them,\n");
+        printf("           and the labels in a .sym file next to the output\n");
         return -1;
     }
 
-    FILE *fin = fopen(argv[1],"rb");
+    FILE *fin = fopen(fname,"rb");
     if (fin == 0)
     {
-        printf("Could not read file %s\n", argv[1]);
+        printf("Could not read file %s\n", fname);
         return -1;
     }   
 
@@ -33,12 +57,14 @@ int main(int argc, char *argv[])
 
     printf("; Loading %lu bytes\n", bytes);
 
-    char *src = malloc(bytes);
-    if (fread(src, 1, bytes, fin) != bytes)
+    // the lexer stops at a 0
+    char *src = malloc(bytes+1);
+    if ((src == NULL) || (fread(src, 1, bytes, fin) != bytes))
     {
-        printf("Could not read file %s\n", argv[1]);
+        printf("Could not read file %s\n", fname);
         return -1;
     }
+    src[bytes] = 0;
 
-    parse(src);
+    return parse(src, outname, raw) ? 0 : -1;
 }
@@ -0,0 +1,180 @@
+/*
+
+    Output files of the p-code assembler
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "output.h"
+#include "image.h"
+#include "../virtualmachine/vm.h"
+#include "../virtualmachine/verify.h"
+
+#define MAXSECTIONS 4
+
+typedef struct
+{
+    const void  *data;
+    vm_section_t s;
+} section_t;
+
+static void addsection(section_t *tab, uint16_t *n, uint32_t type, const void *data, uint32_t size, uint32_t info)
+{
+    tab[*n].data     = data;
+    tab[*n].s.type   = type;
+    tab[*n].s.offset = 0;
+    tab[*n].s.size   = size;
+    tab[*n].s.info   = info;
+    (*n)++;
+}
+
+// label table text, "<address> <name>" per line
+static char* symboltext(symtbl_t *syms, uint32_t *len)
+{
+    size_t size = 1;
+    for(uint16_t i=0; i<syms->Nsymbols; i++)
+    {
+        size += syms->syms[i].namelen + 8;
+    }
+
+    char *text = malloc(size);
+    *len = 0;
+    for(uint16_t i=0; (text != NULL) && (i<syms->Nsymbols); i++)
+    {
+        const sym_t *s = &syms->syms[i];
+        *len += sprintf(text + *len, "%u %.*s\n", s->address, s->namelen, s->name);
+    }
+    return text;
+}
+
+// one entry where the source line changes
+static vm_lineentry_t* linetable(const uint32_t *lines, uint16_t count, uint32_t *n)
+{
+    vm_lineentry_t *tab = malloc((count+1)*sizeof(vm_lineentry_t));
+    *n = 0;
+    for(uint16_t pc=0; (tab != NULL) && (pc<count); pc++)
+    {
+        if ((*n == 0) || (tab[*n-1].line != lines[pc]))
+        {
+            tab[*n].pc       = pc;
+            tab[*n].reserved = 0;
+            tab[*n].line     = lines[pc];
+            (*n)++;
+        }
+    }
+    return tab;
+}
+
+bool out_image(const char *fname, const uint8_t *code, uint16_t count,
+    symtbl_t *syms, const uint32_t *lines)
+{
+    vm_imageheader_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, VM_IMAGE_MAGIC, 4);
+    h.version = VM_IMAGE_VERSION;
+    h.entry   = 0;
+
+    // the stack bound of the verifier, if it has one
+    vm_verify_t r;
+    if (vm_verify_image(code, count, h.entry, &r))
+    {
+        h.stackcells = r.stackcells;
+        if (r.stackcells != 0)
+            printf("; Needs %u stack cells\n", r.stackcells);
+        else
+            printf("; Recursive, no stack bound\n");
+    }
+    else
+    {
+        printf("; Warning: the VM cannot verify the program, pc %u: %s\n", r.pc, r.msg);
+    }
+    vm_verify_free(&r);
+
+    // decoded as the VM runs it by default
+    vm_dins_t *decoded = malloc((count+1)*sizeof(vm_dins_t));
+    if (decoded != NULL)
+    {
+        vm_decode(decoded, code, count);
+        vm_fuse(decoded, count);
+    }
+
+    uint32_t symlen;
+    uint32_t nlines;
+    char *symbols = symboltext(syms, &symlen);
+    vm_lineentry_t *linetab = linetable(lines, count, &nlines);
+
+    section_t tab[MAXSECTIONS];
+    h.nsections = 0;
+    addsection(tab, &h.nsections, VM_SECTION_CODE, code, count*sizeof(instruction_t), 0);
+    if (symbols != NULL)
+        addsection(tab, &h.nsections, VM_SECTION_SYMBOLS, symbols, symlen, 0);
+    if (linetab != NULL)
+        addsection(tab, &h.nsections, VM_SECTION_LINES, linetab, nlines*sizeof(vm_lineentry_t), 0);
+    if (decoded != NULL)
+        addsection(tab, &h.nsections, VM_SECTION_DECODED, decoded, (count+1)*sizeof(vm_dins_t), VM_DECODED_ABI);
+
+    // each section on a page of its own
+    uint32_t offset = sizeof(h) + h.nsections*sizeof(vm_section_t);
+    for(uint16_t i=0; i<h.nsections; i++)
+    {
+        offset = (offset + VM_IMAGE_ALIGN - 1) / VM_IMAGE_ALIGN * VM_IMAGE_ALIGN;
+        tab[i].s.offset = offset;
+        offset += tab[i].s.size;
+    }
+
+    FILE *f = fopen(fname, "wb");
+    bool ok = (f != NULL);
+    if (ok)
+    {
+        ok = (fwrite(&h, sizeof(h), 1, f) == 1);
+        for(uint16_t i=0; ok && (i<h.nsections); i++)
+        {
+            ok = (fwrite(&tab[i].s, sizeof(vm_section_t), 1, f) == 1);
+        }
+        for(uint16_t i=0; ok && (i<h.nsections); i++)
+        {
+            ok = (fseek(f, tab[i].s.offset, SEEK_SET) == 0) &&
+                 (fwrite(tab[i].data, 1, tab[i].s.size, f) == tab[i].s.size);
+        }
+        ok = (fclose(f) == 0) && ok;
+    }
+
+    free(linetab);
+    free(symbols);
+    free(decoded);
+    return ok;
+}
+
+bool out_raw(const char *fname, const uint8_t *code, uint16_t count,
+    symtbl_t *syms)
+{
+    FILE *cfile = fopen(fname, "wb");
+    if (cfile == NULL)
+        return false;
+    bool ok = (fwrite(code, 3, count, cfile) == count);
+    ok = (fclose(cfile) == 0) && ok;
+
+    // label table for the VM's profiler: <address> <name> per line,
+    // in <name>.sym next to <name>.bin
+    char symname[1024];
+    const char *dot = strrchr(fname, '.');
+    size_t len = ((dot != NULL) && (strchr(dot, '/') == NULL)) ? (size_t)(dot - fname) : strlen(fname);
+    if (len + 5 > sizeof(symname))
+        return ok;
+    memcpy(symname, fname, len);
+    strcpy(symname + len, ".sym");
+
+    FILE *sfile = fopen(symname, "wt");
+    if (sfile != NULL)
+    {
+        for(uint16_t i=0; i<syms->Nsymbols; i++)
+        {
+            const sym_t *s = &syms->syms[i];
+            fprintf(sfile, "%u %.*s\n", s->address, s->namelen, s->name);
+        }
+        fclose(sfile);
+    }
+    return ok;
+}
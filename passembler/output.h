@@ -0,0 +1,21 @@
+/*
+
+    Output files of the p-code assembler
+
+*/
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "symtbl.h"
+
+/** write a program image (see common/image.h) with the code, the
+    labels, the source line of each instruction (lines[pc]) and the
+    decoded program, for a VM that starts at pc 0 */
+bool out_image(const char *fname, const uint8_t *code, uint16_t count,
+    symtbl_t *syms, const uint32_t *lines);
+
+/** write the packed instructions alone, as the 6309 ROM takes them,
+    and the labels to a .sym file next to fname */
+bool out_raw(const char *fname, const uint8_t *code, uint16_t count,
+    symtbl_t *syms);
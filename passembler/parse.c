@@ -12,8 +12,12 @@
 #include "symtbl.h"
 #include "parse.h"
 #include "fixuptbl.h"
+#include "output.h"
 #include "opcodes.h"
 
+// the image holds at most 64k bytes of code
+#define MAXINS  (0xFFFF/3)
+
 typedef struct 
 {
     lex_context_t lex;
@@ -22,16 +26,49 @@ typedef struct
     uint16_t      emitaddress;   ///< address of next emitted instruction
 
     uint8_t       *code;
-    uint16_t      codelen;
+    uint32_t      codelen;       ///< bytes allocated for code, 3 per instruction
+    uint32_t      *lines;        ///< source line of each instruction
+    bool          toolarge;      ///< an instruction did not fit, see emit_ins()
 } parse_context_t;
 
+// make room for the instruction at emitaddress; code and lines grow together
+static bool reserve(parse_context_t *context)
+{
+    if (context->emitaddress < context->codelen/3)
+        return true;
+    if (context->emitaddress >= MAXINS)
+        return false;
+
+    uint32_t ninstr = 2*(context->codelen/3);
+    if (ninstr > MAXINS)
+        ninstr = MAXINS;
+    uint8_t  *code  = realloc(context->code, ninstr*3);
+    if (code == NULL)
+        return false;
+    context->code = code;
+    uint32_t *lines = realloc(context->lines, ninstr * sizeof(uint32_t));
+    if (lines == NULL)
+        return false;
+    context->lines   = lines;
+    context->codelen = ninstr*3;
+    return true;
+}
+
+// line is the source line of the mnemonic
 void emit_ins(parse_context_t *context, 
+    const uint32_t line,
     const uint8_t  opcode,
     const uint16_t imm16)
 {
+    if (!reserve(context))
+    {
+        context->toolarge = true;
+        return;
+    }
     context->code[context->emitaddress*3  ] = opcode;
     context->code[context->emitaddress*3+1] = imm16 & 0xFF;
     context->code[context->emitaddress*3+2] = (imm16 >> 8) & 0xFF;
+    context->lines[context->emitaddress] = line;
 }
 
 void next(parse_context_t *context)
@@ -53,8 +90,8 @@ void parse_error(parse_context_t *context, const char *str)
     printf("'\n");
 }
 
-// instruction (level|aluop) (offset | addr)
-bool parse_instruction(parse_context_t *context)
+// instruction (level|aluop) (offset | addr), line is where it starts
+bool parse_instruction(parse_context_t *context, uint32_t line)
 {
     token_t optok  = token(context);
     uint8_t opcode = optok - 100;
@@ -66,7 +103,7 @@ bool parse_instruction(parse_context_t *context)
         // expect label or absolute address
         if (token(context) == TOK_INTEGER)
         {
-            emit_ins(context, opcode, context->lex.lit);
+            emit_ins(context, line, opcode, context->lex.lit);
             context->emitaddress++;
         }
         else if (token(context) == TOK_LABEL)
@@ -81,11 +118,11 @@ bool parse_instruction(parse_context_t *context)
                 fix_add(&context->fixtbl, context->lex.tokstr, context->lex.toklen,
                     context->emitaddress);
 
-                emit_ins(context, opcode, 0);
+                emit_ins(context, line, opcode, 0);
             }
             else
             {
-                emit_ins(context, opcode, label->address);
+                emit_ins(context, line, opcode, label->address);
             }
             context->emitaddress++;            
         }
@@ -112,7 +149,7 @@ bool parse_instruction(parse_context_t *context)
         // expect label or absolute address
         if (token(context) == TOK_INTEGER)
         {
-            emit_ins(context, opcode, context->lex.lit);
+            emit_ins(context, line, opcode, context->lex.lit);
             context->emitaddress++;
         }
         else if (token(context) == TOK_LABEL)
@@ -127,11 +164,11 @@ bool parse_instruction(parse_context_t *context)
                 fix_add(&context->fixtbl, context->lex.tokstr, context->lex.toklen,
                     context->emitaddress);
 
-                emit_ins(context, opcode, 0);
+                emit_ins(context, line, opcode, 0);
             }
             else
             {
-                emit_ins(context, opcode, label->address);
+                emit_ins(context, line, opcode, label->address);
             }
             context->emitaddress++;            
         }
@@ -144,7 +181,7 @@ bool parse_instruction(parse_context_t *context)
     }
     else if (optok == TOK_HALT)
     {
-        emit_ins(context, opcode, 0);
+        emit_ins(context, line, opcode, 0);
         context->emitaddress++;
     }    
     else if ((optok == TOK_LIT) || (optok == TOK_INT))
@@ -156,7 +193,7 @@ bool parse_instruction(parse_context_t *context)
             return false;
         }
 
-        emit_ins(context, opcode, context->lex.lit);
+        emit_ins(context, line, opcode, context->lex.lit);
         context->emitaddress++;
     }
     else if ((optok == TOK_LOD) || (optok == TOK_STO) || (optok == TOK_LODX) || (optok == TOK_STOX))
@@ -176,7 +213,7 @@ bool parse_instruction(parse_context_t *context)
             parse_error(context, "expected integer\n");
             return false;
         }
-        emit_ins(context, opcode, context->lex.lit);
+        emit_ins(context, line, opcode, context->lex.lit);
         context->emitaddress++;
     }
     else
@@ -184,102 +221,102 @@ bool parse_instruction(parse_context_t *context)
         // alu operations
         if (optok == TOK_RET)
         {
-            emit_ins(context, 0x01, OPR_RET); // opr
+            emit_ins(context, line, 0x01, OPR_RET); // opr
             context->emitaddress++;
         }
         else if (optok == TOK_NEG)
         {
-            emit_ins(context, 0x01, OPR_NEG); // opr
+            emit_ins(context, line, 0x01, OPR_NEG); // opr
             context->emitaddress++;       
         }
         else if (optok == TOK_ADD)
         {
-            emit_ins(context, 0x01, OPR_ADD); // opr
+            emit_ins(context, line, 0x01, OPR_ADD); // opr
             context->emitaddress++;
         }
         else if (optok == TOK_SUB)
         {
-            emit_ins(context, 0x01, OPR_SUB); // opr
+            emit_ins(context, line, 0x01, OPR_SUB); // opr
             context->emitaddress++; 
         }
         else if (optok == TOK_MUL)
         {
-            emit_ins(context, 0x01, OPR_MUL); // opr
+            emit_ins(context, line, 0x01, OPR_MUL); // opr
             context->emitaddress++; 
         }
         else if (optok == TOK_DIV)
         {
-            emit_ins(context, 0x01, OPR_DIV); // opr
+            emit_ins(context, line, 0x01, OPR_DIV); // opr
             context->emitaddress++;
         }
         else if (optok == TOK_ODD)
         {
-            emit_ins(context, 0x01, OPR_ODD); // opr
+            emit_ins(context, line, 0x01, OPR_ODD); // opr
             context->emitaddress++; 
         }
         else if (optok == TOK_EQU)
         {
-            emit_ins(context, 0x01, OPR_EQ); // opr
+            emit_ins(context, line, 0x01, OPR_EQ); // opr
             context->emitaddress++; 
         }
         else if (optok == TOK_NEQ)
         {
-            emit_ins(context, 0x01, OPR_NEQ); // opr
+            emit_ins(context, line, 0x01, OPR_NEQ); // opr
             context->emitaddress++; 
         }
         else if (optok == TOK_LES)
         {
-            emit_ins(context, 0x01, OPR_LESS); // opr
+            emit_ins(context, line, 0x01, OPR_LESS); // opr
             context->emitaddress++; 
         }
         else if (optok == TOK_LEQ)
         {
-            emit_ins(context, 0x01, OPR_LEQ); // opr
+            emit_ins(context, line, 0x01, OPR_LEQ); // opr
             context->emitaddress++; 
         }
         else if (optok == TOK_GRE)
         {
-            emit_ins(context, 0x01, OPR_GREATER); // opr
+            emit_ins(context, line, 0x01, OPR_GREATER); // opr
             context->emitaddress++; 
         }
         else if (optok == TOK_GEQ)
         {
-            emit_ins(context, 0x01, OPR_GEQ); // opr
+            emit_ins(context, line, 0x01, OPR_GEQ); // opr
             context->emitaddress++; 
         }
         else if (optok == TOK_OUTCHAR)
         {
-            emit_ins(context, 0x01, OPR_OUTCHAR); // opr
+            emit_ins(context, line, 0x01, OPR_OUTCHAR); // opr
             context->emitaddress++;             
         }
         else if (optok == TOK_OUTINT)
         {
-            emit_ins(context, 0x01, OPR_OUTINT); // opr
+            emit_ins(context, line, 0x01, OPR_OUTINT); // opr
             context->emitaddress++;             
         }   
         else if (optok == TOK_INCHAR)
         {
-            emit_ins(context, 0x01, OPR_INCHAR); // opr
+            emit_ins(context, line, 0x01, OPR_INCHAR); // opr
             context->emitaddress++;             
         }
         else if (optok == TOK_ININT)
         {
-            emit_ins(context, 0x01, OPR_ININT); // opr
+            emit_ins(context, line, 0x01, OPR_ININT); // opr
             context->emitaddress++;             
         }        
         else if (optok == TOK_SHL)
         {
-            emit_ins(context, 0x01, OPR_SHL); // opr
+            emit_ins(context, line, 0x01, OPR_SHL); // opr
             context->emitaddress++;             
         }   
         else if (optok == TOK_SHR)
         {
-            emit_ins(context, 0x01, OPR_SHR); // opr
+            emit_ins(context, line, 0x01, OPR_SHR); // opr
             context->emitaddress++;             
         }
         else if (optok == TOK_SAR)
         {
-            emit_ins(context, 0x01, OPR_SAR); // opr
+            emit_ins(context, line, 0x01, OPR_SAR); // opr
             context->emitaddress++;             
         }                
         else
@@ -305,7 +342,10 @@ bool parseLine(parse_context_t *context)
     {
         if (context->lex.curtok >= 100)
         {
-            if (!parse_instruction(context))
+            // the lexer counts the end of the line once it reads
+            // past an instruction without operands
+            uint32_t line = context->lex.linenum;
+            if (!parse_instruction(context, line))
                 return false;
         }
         else if (context->lex.curtok == TOK_LABEL)
@@ -327,7 +367,7 @@ bool parseLine(parse_context_t *context)
     return true;
 }
 
-bool parse(const char *src)
+bool parse(const char *src, const char *outname, bool raw)
 {
     parse_context_t context;
     lex_init(&context.lex, src);
@@ -335,15 +375,28 @@ bool parse(const char *src)
     sym_init(&context.symtbl);
     fix_init(&context.fixtbl);
 
-    context.codelen = 4096;
+    context.codelen = 4095;
     context.code = malloc(context.codelen);
+    context.lines = malloc(context.codelen/3 * sizeof(uint32_t));
+    if ((context.code == NULL) || (context.lines == NULL))
+    {
+        printf("Error: out of memory\n");
+        return false;
+    }
     
     context.emitaddress = 0;
+    context.toolarge = false;
 
     while(context.lex.curtok != TOK_EOF)
     {
         if (!parseLine(&context))
             return false;
+        if (context.toolarge)
+        {
+            printf("\nLine %d: program too large, at most %d instructions\n",
+                context.lex.linenum, MAXINS);
+            return false;
+        }
     }
 
     printf("; Label table:\n");
@@ -378,9 +431,11 @@ bool parse(const char *src)
         printf("0x%04x\t0x%02x 0x%04x\n", i, context.code[3*i], imm);
     }
 
-    FILE *cfile = fopen("code.bin","wb");
-    fwrite(context.code, 3, context.emitaddress, cfile);
-    fclose(cfile);
-
-    return true;
+    bool ok = raw ? out_raw(outname, context.code, context.emitaddress, &context.symtbl) :
+        out_image(outname, context.code, context.emitaddress, &context.symtbl, context.lines);
+    if (!ok)
+    {
+        printf("Error: cannot write %s\n", outname);
+    }
+    return ok;
 }
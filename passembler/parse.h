@@ -9,4 +9,6 @@
 #include <stdbool.h>
 #include "lex.h"
 
-bool parse(const char *src);
+/** assemble src and write the result to outname: a program
+    image, or the packed instructions alone if raw */
+bool parse(const char *src, const char *outname, bool raw);
@@ -0,0 +1,390 @@
+/*
+
+    Benchmark driver for the p-code tool chain
+
+    Compiles each program with nanopascal, assembles it with
+    passembler and runs it in vm, a few warmup runs and then
+    the measured ones. Each step is timed as a whole process,
+    wall clock. The instruction count is the one vm reports,
+    so ns per instruction includes starting the vm; keep the
+    programs long enough for that not to matter (see bench/).
+
+    Prints a table and writes the results as JSON:
+
+    {
+      "label": "...", "vm_args": [...], "warmup": 2, "runs": 10,
+      "benchmarks": [
+        { "name": "sieve", "source": "...", "instructions": 94357215,
+          "compile_ms":  { "median": .., "min": .., "max": .., "spread": .. },
+          "assemble_ms": { ... }, "run_ms": { ... },
+          "ns_per_instruction": { ... }, "mips": { ... } }, ...
+      ]
+    }
+
+    spread is (max - min) / median over the measured runs.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAXVMARGS   16
+#define MAXRUNS     1000
+
+typedef struct
+{
+    double median;
+    double min;
+    double max;
+    double spread;
+} stats_t;
+
+typedef struct
+{
+    char    name[64];
+    const char *source;
+    bool    ok;
+    size_t  instructions;
+    stats_t compile;
+    stats_t assemble;
+    stats_t run;
+    stats_t nsperins;
+    stats_t mips;
+} result_t;
+
+static char tools[1024] = ".";
+static const char *workdir = "pbench.tmp";
+static const char *vmargs[MAXVMARGS];
+static int nvmargs = 0;
+
+static double now_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e3 + ts.tv_nsec*1e-6;
+}
+
+// run argv with stdout to outname (or /dev/null), stderr to
+// /dev/null. returns the wall time in ms, or -1 on failure.
+static double run(char *const argv[], const char *outname)
+{
+    double start = now_ms();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int out = open((outname != NULL) ? outname : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        int err = open("/dev/null", O_WRONLY);
+        if ((out < 0) || (err < 0))
+            _exit(127);
+        dup2(out, STDOUT_FILENO);
+        dup2(err, STDERR_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    if ((pid < 0) || (waitpid(pid, &status, 0) != pid))
+        return -1;
+    double ms = now_ms() - start;
+    return (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? ms : -1;
+}
+
+static int bydouble(const void *a, const void *b)
+{
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+    return (da < db) ? -1 : (da > db) ? 1 : 0;
+}
+
+static stats_t summarize(double *v, int n)
+{
+    stats_t s;
+    qsort(v, n, sizeof(double), bydouble);
+    s.median = ((n & 1) != 0) ? v[n/2] : (v[n/2-1] + v[n/2]) / 2;
+    s.min    = v[0];
+    s.max    = v[n-1];
+    s.spread = (s.median > 0) ? (s.max - s.min) / s.median : 0;
+    return s;
+}
+
+// the count of the "Executed <n> instructions" line of the vm,
+// which can follow the "\n\r" of the program's last line
+static bool instructions(const char *outname, size_t *n)
+{
+    FILE *f = fopen(outname, "rt");
+    if (f == NULL)
+        return false;
+    char line[256];
+    bool found = false;
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        if (sscanf(line, " Executed %zu instructions", n) == 1)
+            found = true;
+    }
+    fclose(f);
+    return found;
+}
+
+// time one step of the tool chain, runs times; t holds the times
+static bool timestep(stats_t *s, double *t, char *const argv[], const char *outname, int runs)
+{
+    for(int i=0; i<runs; i++)
+    {
+        t[i] = run(argv, outname);
+        if (t[i] < 0)
+            return false;
+    }
+    *s = summarize(t, runs);
+    return true;
+}
+
+static bool bench(result_t *r, const char *source, int warmup, int runs)
+{
+    // name: the file name without directory and extension
+    const char *base = strrchr(source, '/');
+    base = (base != NULL) ? base + 1 : source;
+    size_t len = strcspn(base, ".");
+    if (len >= sizeof(r->name))
+        len = sizeof(r->name) - 1;
+    memset(r, 0, sizeof(result_t));
+    memcpy(r->name, base, len);
+    r->source = source;
+
+    char compiler[1100], assembler[1100], vm[1100];
+    char asmname[1100], binname[1100], outname[1100];
+    snprintf(compiler,  sizeof(compiler),  "%s/nanopascal", tools);
+    snprintf(assembler, sizeof(assembler), "%s/passembler", tools);
+    snprintf(vm,        sizeof(vm),        "%s/vm", tools);
+    snprintf(asmname,   sizeof(asmname),   "%s/%s.asm", workdir, r->name);
+    snprintf(binname,   sizeof(binname),   "%s/%s.bin", workdir, r->name);
+    snprintf(outname,   sizeof(outname),   "%s/%s.out", workdir, r->name);
+
+    double t[MAXRUNS];
+    char *cargs[] = {compiler, (char*)source, NULL};
+    if (!timestep(&r->compile, t, cargs, asmname, runs))
+    {
+        printf("%s: %s failed\n", r->name, compiler);
+        return false;
+    }
+
+    char *aargs[] = {assembler, "-o", binname, asmname, NULL};
+    if (!timestep(&r->assemble, t, aargs, NULL, runs))
+    {
+        printf("%s: %s failed\n", r->name, assembler);
+        return false;
+    }
+
+    char *vargs[MAXVMARGS+3];
+    int n = 0;
+    vargs[n++] = vm;
+    for(int i=0; i<nvmargs; i++)
+        vargs[n++] = (char*)vmargs[i];
+    vargs[n++] = binname;
+    vargs[n]   = NULL;
+
+    stats_t dummy;
+    if (((warmup > 0) && !timestep(&dummy, t, vargs, outname, warmup)) ||
+        !timestep(&r->run, t, vargs, outname, runs))
+    {
+        printf("%s: %s failed\n", r->name, vm);
+        return false;
+    }
+    if (!instructions(outname, &r->instructions) || (r->instructions == 0))
+    {
+        printf("%s: the vm does not report the instruction count (--no-count?)\n", r->name);
+        return false;
+    }
+
+    // per run, every run executes the same instructions
+    double nsperins[MAXRUNS];
+    double mips[MAXRUNS];
+    for(int i=0; i<runs; i++)
+    {
+        double ms = (t[i] > 0) ? t[i] : 1e-6;
+        nsperins[i] = ms * 1e6 / r->instructions;
+        mips[i]     = r->instructions / (ms * 1e3);
+    }
+    r->nsperins = summarize(nsperins, runs);
+    r->mips     = summarize(mips, runs);
+    r->ok = true;
+    return true;
+}
+
+static void jsonstats(FILE *f, const char *name, const stats_t *s, bool last)
+{
+    fprintf(f, "      \"%s\": { \"median\": %.6g, \"min\": %.6g, \"max\": %.6g, \"spread\": %.4f }%s\n",
+        name, s->median, s->min, s->max, s->spread, last ? "" : ",");
+}
+
+// s as a JSON string, for the few characters file names can have
+static void jsonstring(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for(; *s != 0; s++)
+    {
+        if ((*s == '"') || (*s == '\\'))
+            fputc('\\', f);
+        if ((unsigned char)*s >= ' ')
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static bool writejson(const char *fname, const char *label, int warmup, int runs,
+    const result_t *res, int nres)
+{
+    FILE *f = fopen(fname, "wt");
+    if (f == NULL)
+        return false;
+
+    fprintf(f, "{\n  \"label\": ");
+    jsonstring(f, label);
+    fprintf(f, ",\n  \"time\": %ld,\n  \"vm_args\": [", (long)time(NULL));
+    for(int i=0; i<nvmargs; i++)
+    {
+        if (i > 0)
+            fprintf(f, ", ");
+        jsonstring(f, vmargs[i]);
+    }
+    fprintf(f, "],\n  \"warmup\": %d,\n  \"runs\": %d,\n  \"benchmarks\": [\n", warmup, runs);
+
+    bool first = true;
+    for(int i=0; i<nres; i++)
+    {
+        const result_t *r = &res[i];
+        if (!r->ok)
+            continue;
+        fprintf(f, "%s    {\n      \"name\": ", first ? "" : ",\n");
+        jsonstring(f, r->name);
+        fprintf(f, ",\n      \"source\": ");
+        jsonstring(f, r->source);
+        fprintf(f, ",\n      \"instructions\": %zu,\n", r->instructions);
+        jsonstats(f, "compile_ms",  &r->compile, false);
+        jsonstats(f, "assemble_ms", &r->assemble, false);
+        jsonstats(f, "run_ms",      &r->run, false);
+        jsonstats(f, "ns_per_instruction", &r->nsperins, false);
+        jsonstats(f, "mips",        &r->mips, true);
+        fprintf(f, "    }");
+        first = false;
+    }
+    fprintf(f, "\n  ]\n}\n");
+    return (fclose(f) == 0);
+}
+
+int main(int argc, char *argv[])
+{
+    int warmup = 2;
+    int runs = 10;
+    const char *out = "bench.json";
+    const char *label = "";
+    const char **sources = calloc(argc, sizeof(char*));
+    int nsources = 0;
+
+    // the tools are next to pbench unless --tools says otherwise
+    const char *slash = strrchr(argv[0], '/');
+    if ((slash != NULL) && ((size_t)(slash - argv[0]) < sizeof(tools)))
+    {
+        memcpy(tools, argv[0], slash - argv[0]);
+        tools[slash - argv[0]] = 0;
+    }
+
+    for(int i=1; i<argc; i++)
+    {
+        if ((strcmp(argv[i], "--runs") == 0) && (i+1 < argc))
+        {
+            runs = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--warmup") == 0) && (i+1 < argc))
+        {
+            warmup = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--out") == 0) && (i+1 < argc))
+        {
+            out = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--label") == 0) && (i+1 < argc))
+        {
+            label = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--vm") == 0) && (i+1 < argc))
+        {
+            if (nvmargs == MAXVMARGS)
+            {
+                printf("Too many --vm arguments\n");
+                return -1;
+            }
+            vmargs[nvmargs++] = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--tools") == 0) && (i+1 < argc))
+        {
+            snprintf(tools, sizeof(tools), "%s", argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--work") == 0) && (i+1 < argc))
+        {
+            workdir = argv[++i];
+        }
+        else if (argv[i][0] == '-')
+        {
+            printf("Unknown option %s\n", argv[i]);
+            return -1;
+        }
+        else
+        {
+            sources[nsources++] = argv[i];
+        }
+    }
+
+    if ((nsources == 0) || (runs < 1) || (runs > MAXRUNS) || (warmup < 0))
+    {
+        printf("Usage: %s [options] <program.pl0>...\n", argv[0]);
+        printf("  --runs <n>    measured runs of each step (default: 10, up to %d)\n", MAXRUNS);
+        printf("  --warmup <n>  vm runs before the measured ones (default: 2)\n");
+        printf("  --vm <arg>    pass arg to the vm, e.g. --vm --jit; repeatable\n");
+        printf("  --label <s>   stored in the results, e.g. the commit\n");
+        printf("  --out <f>     JSON results (default: bench.json)\n");
+        printf("  --tools <dir> nanopascal, passembler and vm (default: next to pbench)\n");
+        printf("  --work <dir>  intermediate files (default: pbench.tmp)\n");
+        return -1;
+    }
+
+    mkdir(workdir, 0755);
+
+    result_t *res = calloc(nsources, sizeof(result_t));
+    int failed = 0;
+    printf("%-12s %10s %10s %10s %12s %8s %8s %7s\n",
+        "program", "compile ms", "asm ms", "run ms", "instructions", "ns/ins", "MIPS", "spread");
+    for(int i=0; i<nsources; i++)
+    {
+        result_t *r = &res[i];
+        if (!bench(r, sources[i], warmup, runs))
+        {
+            failed++;
+            continue;
+        }
+        printf("%-12s %10.2f %10.2f %10.2f %12zu %8.3f %8.1f %6.1f%%\n",
+            r->name, r->compile.median, r->assemble.median, r->run.median,
+            r->instructions, r->nsperins.median, r->mips.median, 100*r->run.spread);
+    }
+
+    if (!writejson(out, label, warmup, runs, res, nsources))
+    {
+        printf("Cannot write %s\n", out);
+        failed++;
+    }
+    else
+    {
+        printf("Results written to %s\n", out);
+    }
+
+    free(res);
+    free(sources);
+    return (failed == 0) ? 0 : -1;
+}
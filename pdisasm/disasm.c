@@ -0,0 +1,89 @@
+/*
+
+    p-code instruction decoding, shared by pdisasm and ptrview
+
+*/
+
+#include <stdio.h>
+#include "disasm.h"
+
+static const char *alunames[] =
+{
+    [OPR_RET]       = "RET",
+    [OPR_NEG]       = "NEG",
+    [OPR_ADD]       = "ADD",
+    [OPR_SUB]       = "SUB",
+    [OPR_MUL]       = "MUL",
+    [OPR_DIV]       = "DIV",
+    [OPR_ODD]       = "ODD",
+    [OPR_EQ]        = "EQU",
+    [OPR_NEQ]       = "NEQ",
+    [OPR_LESS]      = "LES",
+    [OPR_LEQ]       = "LEQ",
+    [OPR_GREATER]   = "GRE",
+    [OPR_GEQ]       = "GEQ",
+    [OPR_SHR]       = "SHR",
+    [OPR_SHL]       = "SHL",
+    [OPR_SAR]       = "SAR",
+    [OPR_OUTCHAR]   = "OUTCHAR",
+    [OPR_OUTINT]    = "OUTINT",
+    [OPR_INCHAR]    = "INCHAR",
+    [OPR_ININT]     = "ININT"
+};
+
+const char* disasm_alu(uint16_t imm16)
+{
+    if (imm16 >= sizeof(alunames) / sizeof(alunames[0]))
+        return NULL;
+    return alunames[imm16];
+}
+
+void disasm_ins(char *buf, size_t size, const instruction_t *ins)
+{
+    uint8_t     opcode = ins->opcode;
+    uint16_t    imm16  = ins->opt16;
+    const char  *alu;
+    switch (opcode & 0xF)
+    {
+    case VM_LIT:
+        snprintf(buf, size, "LIT %d", imm16);
+        break;
+    case VM_OPR:
+        alu = disasm_alu(imm16);
+        if (alu != NULL)
+            snprintf(buf, size, "%s", alu);
+        else
+            snprintf(buf, size, "??? ALU OPR %04X", imm16);
+        break;
+    case VM_LOD:
+        snprintf(buf, size, "LOD lvl:%d  ofs:%d", opcode >> 4 ,imm16);
+        break;
+    case VM_STO:
+        snprintf(buf, size, "STO lvl:%d  ofs:%d", opcode >> 4 ,imm16);
+        break;
+    case VM_LODX:
+        snprintf(buf, size, "LODX lvl:%d  ofs:%d", opcode >> 4 ,imm16);
+        break;
+    case VM_STOX:
+        snprintf(buf, size, "STOX lvl:%d  ofs:%d", opcode >> 4 ,imm16);
+        break;
+    case VM_CAL:
+        snprintf(buf, size, "CAL lvl:%d  0x%04X", opcode >> 4, imm16);
+        break;
+    case VM_INT:
+        snprintf(buf, size, "INT %d", imm16);
+        break;
+    case VM_JMP:
+        snprintf(buf, size, "JMP 0x%04X", imm16);
+        break;
+    case VM_JPC:
+        snprintf(buf, size, "JPC 0x%04X", imm16);
+        break;
+    case VM_HALT:
+        snprintf(buf, size, "HALT");
+        break;
+    default:
+        snprintf(buf, size, "??? opcode = 0x%02X", opcode);
+        break;
+    }
+}
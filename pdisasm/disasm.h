@@ -0,0 +1,16 @@
+/*
+
+    p-code instruction decoding, shared by pdisasm and ptrview
+
+*/
+
+#pragma once
+
+#include <stddef.h>
+#include "opcodes.h"
+
+/** the mnemonic of an ALU function (VM_OPR), NULL if unknown */
+const char* disasm_alu(uint16_t imm16);
+
+/** the text of an instruction, without newline, in buf */
+void disasm_ins(char *buf, size_t size, const instruction_t *ins);
@@ -1,159 +1,147 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
-#include "../passembler/keywords.h"
+#include <string.h>
 #include "../virtualmachine/vm.h"
+#include "../virtualmachine/imagefile.h"
+#include "../virtualmachine/symfile.h"
+#include "../virtualmachine/verify.h"
+#include "disasm.h"
 
-void printalu(uint16_t imm16)
+// the HD6309 target runs code and stack in its 64 KiB address space
+#define TARGET_MEMORY   65536
+
+// the labels of the image, or <code>.sym next to fname
+static void loadsyms(vm_symtab_t *syms, const vm_image_t *image, const char *fname)
 {
-    switch(imm16)
+    if (image->symbols != NULL)
+    {
+        vm_sym_parse(syms, image->symbols, image->symbolslen);
+        return;
+    }
+
+    char symname[1024];
+    const char *dot = strrchr(fname, '.');
+    size_t len = ((dot != NULL) && (strchr(dot, '/') == NULL)) ? (size_t)(dot - fname) : strlen(fname);
+    if (len + 5 <= sizeof(symname))
     {
-    case OPR_RET:
-        printf("RET\n");
-        break;
-    case OPR_NEG:
-        printf("NEG\n");
-        break;
-    case OPR_ADD:    
-        printf("ADD\n");
-        break;
-    case OPR_SUB:    
-        printf("SUB\n");
-        break;    
-    case OPR_MUL:    
-        printf("SUB\n");
-        break;            
-    case OPR_DIV:    
-        printf("SUB\n");
-        break;            
-    case OPR_ODD:    
-        printf("ODD\n");
-        break;
-    case OPR_EQ:
-        printf("EQU\n");
-        break;                   
-    case OPR_NEQ:
-        printf("NEQ\n");
-        break;             
-    case OPR_LESS:
-        printf("LES\n");
-        break;     
-    case OPR_LEQ:
-        printf("LEQ\n");
-        break;     
-    case OPR_GREATER:
-        printf("GRE\n");
-        break;     
-    case OPR_GEQ:
-        printf("GEQ\n");
-        break;                                                
-    case OPR_SHL:
-        printf("SHL\n");
-        break;
-    case OPR_SHR:
-        printf("SHR\n");
-        break;  
-    case OPR_SAR:
-        printf("SAR\n");
-        break;
-    case OPR_ININT:
-        printf("ININT\n");
-        break;
-    case OPR_OUTINT:
-        printf("OUTINT\n");
-        break;        
-    case OPR_INCHAR:
-        printf("INCHAR\n");
-        break;                        
-    case OPR_OUTCHAR:
-        printf("OUTCHAR\n");
-        break;                        
-    default:
-        printf("??? ALU OPR %04X\n", imm16);
-        break;
+        memcpy(symname, fname, len);
+        strcpy(symname + len, ".sym");
+        vm_sym_load(syms, symname);
     }
 }
 
-void printins(const instruction_t *ins)
+// frame and stack bounds of every procedure, see verify.h
+static int stackreport(const vm_image_t *image, const char *fname)
 {
-    uint8_t     opcode = ins->opcode;
-    uint16_t    imm16  = ins->opt16;
-    switch (opcode & 0xF)
+    uint16_t count = image->codebytes / sizeof(instruction_t);
+    vm_verify_t r;
+    bool ok = vm_verify_image(image->code, count, image->entry, &r);
+
+    vm_symtab_t syms;
+    vm_sym_init(&syms);
+    loadsyms(&syms, image, fname);
+
+    printf("; %-20s %6s %5s %6s %8s %10s\n", "procedure", "entry", "depth", "frame", "operands", "with calls");
+    for(uint16_t p=0; p<r.nprocs; p++)
+    {
+        const vm_procinfo_t *proc = &r.procs[p];
+        const char *name = vm_sym_name(&syms, proc->entry);
+        char pcname[16];
+        if (p == 0)
+            name = "(program)";
+        if (name == NULL)
+        {
+            snprintf(pcname, sizeof(pcname), "@%u", proc->entry);
+            name = pcname;
+        }
+        printf("; %-20s 0x%04X %5u %6u %8u", name, proc->entry, proc->depth, proc->frame,
+            (proc->maxstack > proc->frame) ? proc->maxstack - proc->frame : 0);
+        if (proc->need > 0)
+            printf(" %10u\n", proc->need);
+        else
+            printf(" %10s\n", ok ? "recursive" : "-");
+    }
+
+    if (!ok)
+    {
+        printf("; Cannot verify the program, pc %u: %s\n", r.pc, r.msg);
+    }
+    else if (r.stackcells == 0)
     {
-    case VM_LIT:
-        printf("LIT %d\n", imm16);
-        break;
-    case VM_OPR:
-        printalu(imm16);
-        break;
-    case VM_LOD:
-        printf("LOD lvl:%d  ofs:%d\n", opcode >> 4 ,imm16);
-        break;
-    case VM_STO:
-        printf("STO lvl:%d  ofs:%d\n", opcode >> 4 ,imm16);
-        break;
-    case VM_LODX:
-        printf("LODX lvl:%d  ofs:%d\n", opcode >> 4 ,imm16);
-        break;
-    case VM_STOX:
-        printf("STOX lvl:%d  ofs:%d\n", opcode >> 4 ,imm16);
-        break;        
-    case VM_CAL:
-        printf("CAL lvl:%d  0x%04X\n", opcode >> 4, imm16);
-        break;
-    case VM_INT:
-        printf("INT %d\n", imm16);
-        break;
-    case VM_JMP:
-        printf("JMP 0x%04X\n", imm16);
-        break;
-    case VM_JPC:
-        printf("JPC 0x%04X\n", imm16);
-        break;
-    case VM_HALT:
-        printf("HALT\n");
-        break; 
-    default:
-        printf("??? opcode = 0x%02X\n", opcode);
-        break;
+        printf("; The procedure at 0x%04X can recurse, the stack has no static bound\n", r.recursive);
     }
+    else
+    {
+        uint32_t code  = count * sizeof(instruction_t);
+        uint32_t stack = r.stackcells * sizeof(int16_t);
+        printf("; Stack: %u cells, %u bytes\n", r.stackcells, stack);
+        printf("; Code and stack: %u bytes, %s the %u bytes of the 6309 target\n", code + stack,
+            (code + stack <= TARGET_MEMORY) ? "fits" : "does not fit", TARGET_MEMORY);
+    }
+
+    vm_sym_free(&syms);
+    vm_verify_free(&r);
+    return ok ? 0 : -1;
 }
 
 int main(int argc, char *argv[])
 {
     printf("; p-code disassembler v0.1\n");
 
-    if (argc < 2)
+    bool stack = (argc > 2) && (strcmp(argv[1], "--stack") == 0);
+    if (argc < (stack ? 3 : 2))
     {
-        printf("Usage: %s <infile>\n", argv[0]);
+        printf("Usage: %s [--stack] <infile>\n", argv[0]);
+        printf("  --stack  frame and stack size of every procedure instead of the listing\n");
         return -1;
     }
 
-    FILE *fin = fopen(argv[1],"rb");
-    if (fin == 0)
+    const char *fname = argv[stack ? 2 : 1];
+    vm_image_t image;
+    if (!vm_image_open(&image, fname))
     {
-        printf("Could not read file %s\n", argv[1]);
+        printf("Could not read file %s, or it is not a valid program image\n", fname);
         return -1;
-    }   
-
-    fseek(fin,0,SEEK_END);
-    size_t bytes = ftell(fin);
-    rewind(fin);
-
-    printf("; Loading %lu bytes\n", bytes);
+    }
+    if (stack)
+    {
+        int result = stackreport(&image, fname);
+        vm_image_close(&image);
+        return result;
+    }
 
-    char *src = malloc(bytes);
-    if (fread(src, 1, bytes, fin) != bytes)
+    size_t bytes = image.codebytes;
+    if (image.hdr != NULL)
     {
-        printf("Could not read file %s\n", argv[1]);
-        return -1;
+        printf("; Image version %u, entry 0x%04X, ", image.hdr->version, image.entry);
+        if (image.stackcells != 0)
+            printf("%u stack cells\n", image.stackcells);
+        else
+            printf("no stack bound\n");
+        printf("; Sections:%s%s%s%s%s\n", " code",
+            (image.data != NULL) ? " data" : "",
+            (image.symbols != NULL) ? " symbols" : "",
+            (image.lines != NULL) ? " lines" : "",
+            (image.decoded != NULL) ? " decoded" : "");
     }
+    printf("; Loading %lu bytes\n", bytes);
 
-    for(uint16_t ofs=0; ofs<bytes; ofs+=3)
+    // a mapped file is only readable up to its length,
+    // so a trailing partial instruction is skipped
+    char text[64];
+    uint32_t line = 0;
+    for(size_t ofs=0; ofs+sizeof(instruction_t) <= bytes; ofs+=sizeof(instruction_t))
     {
-        printf("0x%04X:\t", ofs/3);
-        printins((instruction_t*) &src[ofs]);
+        uint16_t pc = ofs/sizeof(instruction_t);
+        uint32_t l  = vm_image_line(&image, pc);
+        disasm_ins(text, sizeof(text), (const instruction_t*) &image.code[ofs]);
+        if (l != line)
+            printf("0x%04X:\t%-24s; line %u\n", pc, text, l);
+        else
+            printf("0x%04X:\t%s\n", pc, text);
+        line = l;
     }
 
-    free(src);
+    vm_image_close(&image);
 }
@@ -0,0 +1,311 @@
+/*
+
+    Analyzer for the instruction trace ring dumps of the
+    p-code virtual machine (vm --trace-ring <file>)
+
+    Prints an opcode histogram, the hottest pcs and control
+    transfers of the traced window and the last instructions
+    before the VM stopped. With the program image, the
+    instructions are listed as pdisasm shows them.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include "../virtualmachine/vm.h"
+#include "../virtualmachine/tracebuf.h"
+#include "../virtualmachine/imagefile.h"
+#include "../pdisasm/disasm.h"
+
+typedef struct
+{
+    uint32_t key;       // opcode, pc or (from << 16) | to
+    uint64_t count;
+} entry_t;
+
+static int bycount(const void *a, const void *b)
+{
+    const entry_t *ea = a;
+    const entry_t *eb = b;
+    if (ea->count != eb->count)
+        return (ea->count < eb->count) ? 1 : -1;
+    return (ea->key < eb->key) ? -1 : 1;
+}
+
+static vm_image_t image;
+static const uint8_t *code = NULL;
+static size_t  codelen = 0;    // instructions
+
+// the instruction at pc as pdisasm shows it, or the decoded opcode
+static const char* describe(char *buf, size_t size, const vm_ringrec_t *r)
+{
+    if (r->pc < codelen)
+        disasm_ins(buf, size, (const instruction_t*) &code[r->pc * sizeof(instruction_t)]);
+    else
+        snprintf(buf, size, "%s lvl:%d", vm_dopname(r->op), r->level);
+    return buf;
+}
+
+static const char* stopname(uint8_t stop)
+{
+    switch(stop)
+    {
+    case VM_STOP_NONE:
+        return "running";
+    case VM_STOP_HALT:
+        return "HALT";
+    case VM_STOP_BAD:
+        return "illegal instruction";
+    case VM_STOP_BOUNDS:
+        return "stack access out of bounds";
+    case VM_STOP_BREAK:
+        return "breakpoint";
+    case VM_STOP_LIMIT:
+        return "instruction limit";
+    case VM_STOP_OVERFLOW:
+        return "stack overflow";
+    case VM_STOP_INPUT:
+        return "waiting for input";
+    case VM_STOP_HOT:
+        return "hot loop";
+    default:
+        return "?";
+    }
+}
+
+static void histogram(const vm_ringrec_t *rec, uint32_t count)
+{
+    entry_t ops[256];
+    for(uint32_t i=0; i<256; i++)
+    {
+        ops[i].key   = i;
+        ops[i].count = 0;
+    }
+    for(uint32_t i=0; i<count; i++)
+    {
+        ops[rec[i].op].count++;
+    }
+    qsort(ops, 256, sizeof(entry_t), bycount);
+
+    printf("\nOpcodes:\n");
+    for(uint32_t i=0; (i<256) && (ops[i].count != 0); i++)
+    {
+        printf("  %-12s %12lu %7.2f%%\n", vm_dopname(ops[i].key),
+            ops[i].count, 100.0 * ops[i].count / count);
+    }
+}
+
+static int bykey(const void *a, const void *b)
+{
+    const entry_t *ea = a;
+    const entry_t *eb = b;
+    return (ea->key < eb->key) ? -1 : (ea->key > eb->key) ? 1 : 0;
+}
+
+// sum the counts of equal keys, returns the number of distinct keys
+static uint32_t merge(entry_t *e, uint32_t n)
+{
+    if (n == 0)
+        return 0;
+
+    qsort(e, n, sizeof(entry_t), bykey);
+    uint32_t m = 0;
+    for(uint32_t i=1; i<n; i++)
+    {
+        if (e[i].key == e[m].key)
+        {
+            e[m].count += e[i].count;
+        }
+        else
+        {
+            e[++m] = e[i];
+        }
+    }
+    return m+1;
+}
+
+static void hotpcs(const vm_ringrec_t *rec, uint32_t count, uint32_t top)
+{
+    entry_t  *pcs = calloc(65536, sizeof(entry_t));
+    uint32_t *at  = calloc(65536, sizeof(uint32_t));   // a record of each pc
+    for(uint32_t i=0; i<count; i++)
+    {
+        pcs[rec[i].pc].count++;
+        at[rec[i].pc] = i;
+    }
+    for(uint32_t pc=0; pc<65536; pc++)
+    {
+        pcs[pc].key = pc;
+    }
+    qsort(pcs, 65536, sizeof(entry_t), bycount);
+
+    char text[64];
+    printf("\nHot instructions:\n");
+    for(uint32_t i=0; (i<top) && (pcs[i].count != 0); i++)
+    {
+        printf("  0x%04X %12lu %7.2f%%   %s\n", pcs[i].key, pcs[i].count,
+            100.0 * pcs[i].count / count,
+            describe(text, sizeof(text), &rec[at[pcs[i].key]]));
+    }
+    free(at);
+    free(pcs);
+}
+
+// jumps, calls and returns: consecutive records whose pcs
+// are not consecutive. Loops show up as their back edge.
+static void hotpaths(const vm_ringrec_t *rec, uint32_t count, uint32_t top)
+{
+    entry_t  *edges = malloc(((size_t)count + 1) * sizeof(entry_t));
+    uint32_t *at    = calloc(65536, sizeof(uint32_t));  // a record of each pc
+    uint32_t n = 0;
+    for(uint32_t i=1; i<count; i++)
+    {
+        at[rec[i].pc] = i;
+        if (rec[i].pc != (uint16_t)(rec[i-1].pc + 1))
+        {
+            at[rec[i-1].pc] = i-1;
+            edges[n].key   = ((uint32_t)rec[i-1].pc << 16) | rec[i].pc;
+            edges[n].count = 1;
+            n++;
+        }
+    }
+    n = merge(edges, n);
+    qsort(edges, n, sizeof(entry_t), bycount);
+
+    char from[64];
+    char to[64];
+    printf("\nHot control transfers:\n");
+    for(uint32_t i=0; (i<top) && (i<n); i++)
+    {
+        uint16_t pcfrom = edges[i].key >> 16;
+        uint16_t pcto   = edges[i].key & 0xFFFF;
+        printf("  0x%04X -> 0x%04X %12lu   %-24s -> %s\n", pcfrom, pcto, edges[i].count,
+            describe(from, sizeof(from), &rec[at[pcfrom]]),
+            describe(to, sizeof(to), &rec[at[pcto]]));
+    }
+    free(at);
+    free(edges);
+}
+
+static void last(const vm_ringrec_t *rec, uint32_t count, uint32_t nlast)
+{
+    uint32_t first = (count > nlast) ? count - nlast : 0;
+    char text[64];
+
+    printf("\nLast %u instructions:\n", count - first);
+    printf("     pc  %-24s %6s %6s %7s\n", "instruction", "t", "b", "top");
+    for(uint32_t i=first; i<count; i++)
+    {
+        printf("  0x%04X  %-24s %6u %6u %7d\n", rec[i].pc,
+            describe(text, sizeof(text), &rec[i]), rec[i].t, rec[i].b, rec[i].tos);
+    }
+}
+
+static bool loadcode(const char *fname)
+{
+    if (!vm_image_open(&image, fname))
+        return false;
+
+    code    = image.code;
+    codelen = image.codebytes / sizeof(instruction_t);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *tracename = NULL;
+    const char *codename  = NULL;
+    uint32_t top   = 20;
+    uint32_t nlast = 20;
+
+    for(int i=1; i<argc; i++)
+    {
+        if ((strcmp(argv[i], "--top") == 0) && (i+1 < argc))
+        {
+            top = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--last") == 0) && (i+1 < argc))
+        {
+            nlast = atoi(argv[++i]);
+        }
+        else if (argv[i][0] == '-')
+        {
+            printf("Unknown option %s\n", argv[i]);
+            return -1;
+        }
+        else if (tracename == NULL)
+        {
+            tracename = argv[i];
+        }
+        else
+        {
+            codename = argv[i];
+        }
+    }
+
+    if (tracename == NULL)
+    {
+        printf("Usage: %s [options] <trace> [code.bin]\n", argv[0]);
+        printf("  --top <n>   hot instructions and control transfers to list (default: 20)\n");
+        printf("  --last <n>  last instructions to list (default: 20)\n");
+        return -1;
+    }
+
+    if ((codename != NULL) && !loadcode(codename))
+    {
+        printf("Could not read file %s\n", codename);
+        return -1;
+    }
+
+    FILE *fin = fopen(tracename, "rb");
+    if (fin == NULL)
+    {
+        printf("Could not read file %s\n", tracename);
+        return -1;
+    }
+
+    vm_ringheader_t h;
+    if ((fread(&h, sizeof(h), 1, fin) != 1) ||
+        (memcmp(h.magic, VM_RING_MAGIC, 4) != 0) ||
+        (h.version != VM_RING_VERSION) ||
+        (h.recsize != sizeof(vm_ringrec_t)))
+    {
+        printf("%s is not a trace ring dump of this version\n", tracename);
+        return -1;
+    }
+
+    vm_ringrec_t *rec = malloc(((size_t)h.count + 1) * sizeof(vm_ringrec_t));
+    if ((rec == NULL) || (fread(rec, sizeof(vm_ringrec_t), h.count, fin) != h.count))
+    {
+        printf("Could not read file %s\n", tracename);
+        return -1;
+    }
+    fclose(fin);
+
+    // the first instruction of a superinstruction is recorded
+    // with its opcode, the others with their own
+    for(uint32_t i=0; i<h.count; i++)
+    {
+        rec[i].op = vm_unfused(rec[i].op);
+    }
+
+    printf("%lu instructions executed, the last %u traced\n", h.total, h.count);
+    if (h.signal != 0)
+        printf("Stopped by signal %d (%s)\n", h.signal, strsignal(h.signal));
+    else
+        printf("Stopped: %s\n", stopname(h.stop));
+
+    if (h.count > 0)
+    {
+        histogram(rec, h.count);
+        hotpcs(rec, h.count, top);
+        hotpaths(rec, h.count, top);
+        last(rec, h.count, nlast);
+    }
+
+    free(rec);
+    vm_image_close(&image);
+    return 0;
+}
@@ -77,6 +77,7 @@ char lex_toupper(const char c)
     {
         return c - 'a' + 'A';
     }
+    return c;
 }
 
 // add the current character to the token string
@@ -121,7 +122,7 @@ void lexer_checkKeyword(lexer_context_t *context)
     {
         const char *kw = keywords[kwindex];
         
-        if (kw[context->toklen] != 0)
+        if (strlen(kw) != context->toklen)
         {
             // keyword and token are not the same length
             // so skip this keyword
@@ -35,12 +35,14 @@ int main(int argc, char *argv[])
     printf("; file = %s\n", argv[1]);
     printf("; Loading %lu bytes\n\n", bytes);
 
-    char *src = malloc(bytes);
-    if (fread(src, 1, bytes, fin) != bytes)
+    // the lexer stops at a 0
+    char *src = malloc(bytes+1);
+    if ((src == NULL) || (fread(src, 1, bytes, fin) != bytes))
     {
         printf("Could not read file %s\n", argv[1]);
         return -1;
     }
+    src[bytes] = 0;
 
     if (!parse(src))
     {
@@ -219,7 +219,8 @@ static bool match(parse_context_t *context, const token_t tok)
 // --======== GRAMMAR/PRODUCTIONS ========--
 
 // predeclarations
-bool parse_block(parse_context_t *context, uint16_t labelid);
+bool parse_block(parse_context_t *context, uint16_t labelid,
+    const char *procname, uint16_t procnamelen);
 bool parse_expression(parse_context_t *context);
 
 bool parse_const_id(parse_context_t *context)
@@ -1327,7 +1328,7 @@ bool parse_procedure(parse_context_t *context)
         return false;
     }
 
-    if (!parse_block(context, proc_label))
+    if (!parse_block(context, proc_label, procname, procnamelen))
     {
         return false;
     }
@@ -1349,7 +1350,8 @@ bool parse_procedure(parse_context_t *context)
     return true;
 }
 
-bool parse_block(parse_context_t *context, uint16_t labelid)
+bool parse_block(parse_context_t *context, uint16_t labelid,
+    const char *procname, uint16_t procnamelen)
 {
     // zero or more const
     while (match(context, TOK_CONST))
@@ -1372,6 +1374,14 @@ bool parse_block(parse_context_t *context, uint16_t labelid)
             return false;
     }
 
+    // named label for the assembler's label table, '_' keeps
+    // it apart from the generated @L labels
+    if (procname != NULL)
+    {
+        emit_txt("@proc_");
+        emit_tokstr(procname, procnamelen);
+        emit_txt(":\n");
+    }
     emit_label(labelid);
 
     // create space for local variables    
@@ -1412,7 +1422,7 @@ bool parse(char *src)
     emit_with_label(VM_JMP, entry_label);
 
     // parse program
-    if (!parse_block(&context, entry_label))
+    if (!parse_block(&context, entry_label, NULL, 0))
     {
         parse_error("Parse error\n", context.lex.linenum);
         return false;
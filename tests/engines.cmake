@@ -0,0 +1,76 @@
+# Runs the tests/*.pl0 programs on every engine of the vm and
+# checks that each prints the same, instruction count included,
+# as the default engine, and that the trace ring of the fused
+# program has the instructions of the plain program.
+#
+#   cmake -DNANOPASCAL=<exe> -DPASSEMBLER=<exe> -DVM=<exe> -DPTRVIEW=<exe>
+#         -DTESTS=<dir of the programs> -DWORK=<scratch dir> -P engines.cmake
+
+set(ENGINES --jit --trace-jit --no-tos --check)
+
+file(MAKE_DIRECTORY ${WORK})
+set(INPUT ${WORK}/input.txt)
+file(WRITE ${INPUT} "13\n7\n91\n7\n12\n18\n5\n")
+
+# a host without the JITs runs the interpreter instead, and says so
+function(runvm OUT PROGRAM)
+    execute_process(COMMAND ${VM} ${ARGN} --input ${INPUT} ${PROGRAM}
+        OUTPUT_VARIABLE out ERROR_VARIABLE err)
+    string(REGEX REPLACE "[^\n]*JIT not available[^\n]*\n" "" out "${out}")
+    set(${OUT} "${out}" PARENT_SCOPE)
+endfunction()
+
+set(FAILED 0)
+file(GLOB PROGRAMS ${TESTS}/*.pl0)
+foreach(SOURCE ${PROGRAMS})
+    get_filename_component(NAME ${SOURCE} NAME_WE)
+    # the compiler's error tests have no program to run
+    if(NAME MATCHES "error")
+        continue()
+    endif()
+
+    execute_process(COMMAND ${NANOPASCAL} ${SOURCE}
+        OUTPUT_FILE ${WORK}/${NAME}.asm RESULT_VARIABLE rc)
+    if(rc EQUAL 0)
+        execute_process(COMMAND ${PASSEMBLER} -o ${WORK}/${NAME}.bin ${WORK}/${NAME}.asm
+            OUTPUT_QUIET RESULT_VARIABLE rc)
+    endif()
+    if(NOT rc EQUAL 0)
+        message(SEND_ERROR "${NAME}: cannot compile or assemble")
+        math(EXPR FAILED "${FAILED} + 1")
+        continue()
+    endif()
+
+    runvm(REF ${WORK}/${NAME}.bin)
+    if(NOT REF MATCHES "Executed [0-9]+ instructions")
+        message(SEND_ERROR "${NAME}: no instruction count from the default engine")
+        math(EXPR FAILED "${FAILED} + 1")
+        continue()
+    endif()
+    foreach(ENGINE ${ENGINES})
+        runvm(OUT ${WORK}/${NAME}.bin ${ENGINE})
+        if(NOT OUT STREQUAL REF)
+            file(WRITE ${WORK}/${NAME}${ENGINE}.out "${OUT}")
+            file(WRITE ${WORK}/${NAME}.out "${REF}")
+            message(SEND_ERROR "${NAME}: vm ${ENGINE} differs, see ${WORK}/${NAME}${ENGINE}.out")
+            math(EXPR FAILED "${FAILED} + 1")
+        endif()
+    endforeach()
+
+    # the tops of stack can differ, fused code does not write
+    # the scratch cells that a later INT takes into a frame
+    runvm(OUT ${WORK}/${NAME}.bin --trace-ring ${WORK}/${NAME}.ring)
+    runvm(OUT ${WORK}/${NAME}.bin --no-fuse --trace-ring ${WORK}/${NAME}-plain.ring)
+    execute_process(COMMAND ${PTRVIEW} --top 100000 --last 0 ${WORK}/${NAME}.ring
+        OUTPUT_VARIABLE FUSED)
+    execute_process(COMMAND ${PTRVIEW} --top 100000 --last 0 ${WORK}/${NAME}-plain.ring
+        OUTPUT_VARIABLE PLAIN)
+    if(NOT FUSED STREQUAL PLAIN)
+        message(SEND_ERROR "${NAME}: the trace ring differs from the one of vm --no-fuse")
+        math(EXPR FAILED "${FAILED} + 1")
+    endif()
+endforeach()
+
+if(FAILED GREATER 0)
+    message(FATAL_ERROR "${FAILED} engine runs failed")
+endif()
@@ -0,0 +1,30 @@
+# Assembles a program and checks the line table that pdisasm
+# lists: every instruction maps to the line of its mnemonic,
+# the OPR ones without operands included.
+#
+#   cmake -DPASSEMBLER=<exe> -DPDISASM=<exe> -DWORK=<scratch dir> -P lines.cmake
+
+file(MAKE_DIRECTORY ${WORK})
+file(WRITE ${WORK}/lines.asm "JMP @main\n@proc:\nINT 3\nRET\n@main:\nINT 4\nLIT 1\nOUTINT\nCAL 0 @proc\n\nHALT\n")
+
+execute_process(COMMAND ${PASSEMBLER} -o ${WORK}/lines.bin ${WORK}/lines.asm
+    OUTPUT_QUIET RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "cannot assemble ${WORK}/lines.asm")
+endif()
+execute_process(COMMAND ${PDISASM} ${WORK}/lines.bin
+    OUTPUT_VARIABLE listing RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "cannot disassemble ${WORK}/lines.bin")
+endif()
+
+# pc=line of every instruction, RET and OUTINT are OPRs
+set(EXPECTED 0000=1 0001=3 0002=4 0003=6 0004=7 0005=8 0006=9 0007=11)
+foreach(PAIR ${EXPECTED})
+    string(REPLACE "=" ";" PAIR ${PAIR})
+    list(GET PAIR 0 PC)
+    list(GET PAIR 1 LINE)
+    if(NOT listing MATCHES "0x${PC}:[^\n]*; line ${LINE}\n")
+        message(SEND_ERROR "0x${PC} does not map to line ${LINE}")
+    endif()
+endforeach()
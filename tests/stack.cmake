@@ -0,0 +1,22 @@
+# Compiles and assembles a program and runs test_stack on it.
+#
+#   cmake -DNANOPASCAL=<exe> -DPASSEMBLER=<exe> -DTEST=<test_stack>
+#         -DSOURCE=<program.pl0> -DWORK=<scratch dir> -P stack.cmake
+
+file(MAKE_DIRECTORY ${WORK})
+get_filename_component(NAME ${SOURCE} NAME_WE)
+
+execute_process(COMMAND ${NANOPASCAL} ${SOURCE}
+    OUTPUT_FILE ${WORK}/${NAME}.asm RESULT_VARIABLE rc)
+if(rc EQUAL 0)
+    execute_process(COMMAND ${PASSEMBLER} -o ${WORK}/${NAME}.bin ${WORK}/${NAME}.asm
+        OUTPUT_QUIET RESULT_VARIABLE rc)
+endif()
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "${NAME}: cannot compile or assemble")
+endif()
+
+execute_process(COMMAND ${TEST} ${WORK}/${NAME}.bin RESULT_VARIABLE rc)
+if(NOT rc EQUAL 0)
+    message(FATAL_ERROR "${TEST} ${WORK}/${NAME}.bin failed")
+endif()
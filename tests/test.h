@@ -0,0 +1,50 @@
+/*
+
+    Helpers of the unit tests in tests/
+
+    Each test is a program that returns nonzero if an
+    EXPECT() failed. Programs under test are put together
+    one packed instruction at a time with ins().
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "opcodes.h"
+
+static int failures = 0;
+
+#define EXPECT(cond) \
+    do { \
+        if (!(cond)) \
+        { \
+            printf("%s:%d: failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while(0)
+
+#define TEST_MAXINS 256
+
+typedef struct
+{
+    uint8_t  mem[TEST_MAXINS * 3];
+    uint16_t len;       ///< instructions
+} test_prog_t;
+
+/** append op level,a to p, returns its pc */
+static inline uint16_t ins(test_prog_t *p, uint8_t op, uint8_t level, int16_t a)
+{
+    uint8_t *m = &p->mem[p->len * 3];
+    m[0] = (uint8_t)((level << 4) | op);
+    m[1] = (uint8_t)((uint16_t)a & 0xFF);
+    m[2] = (uint8_t)((uint16_t)a >> 8);
+    return p->len++;
+}
+
+/** the bytes of p */
+static inline uint16_t bytes(const test_prog_t *p)
+{
+    return p->len * 3;
+}
@@ -0,0 +1,120 @@
+/*
+
+    Checkpoints: a run that is stopped, written, opened and
+    restored prints and counts what an uninterrupted run does
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include "vm.h"
+#include "hostio.h"
+#include "checkpoint.h"
+#include "test.h"
+
+#define CKPTFILE "test_checkpoint.ckpt"
+
+// prints 1..20
+static void counter(test_prog_t *p)
+{
+    p->len = 0;
+    ins(p, VM_INT, 0, 4);
+    ins(p, VM_LIT, 0, 1);
+    ins(p, VM_STO, 0, 3);
+    ins(p, VM_LOD, 0, 3);           // 3: loop
+    ins(p, VM_OPR, 0, OPR_OUTINT);
+    ins(p, VM_LOD, 0, 3);
+    ins(p, VM_LIT, 0, 1);
+    ins(p, VM_OPR, 0, OPR_ADD);
+    ins(p, VM_STO, 0, 3);
+    ins(p, VM_LOD, 0, 3);
+    ins(p, VM_LIT, 0, 20);
+    ins(p, VM_OPR, 0, OPR_LEQ);
+    ins(p, VM_JPC, 0, 14);
+    ins(p, VM_JMP, 0, 3);
+    ins(p, VM_HALT, 0, 0);          // 14
+}
+
+int main()
+{
+    test_prog_t p;
+    counter(&p);
+
+    // uninterrupted
+    vm_context_t whole;
+    vm_memio_t wout;
+    EXPECT(vm_init(&whole, p.mem, bytes(&p)));
+    vm_host_memory(&whole.host, &wout, "", 0);
+    EXPECT(vm_run(&whole, SIZE_MAX) == VM_STOP_HALT);
+
+    // stopped after 25 instructions and written
+    vm_context_t first;
+    vm_memio_t fout;
+    EXPECT(vm_init(&first, p.mem, bytes(&p)));
+    vm_host_memory(&first.host, &fout, "", 0);
+    EXPECT(vm_run(&first, 25) == VM_STOP_LIMIT);
+    EXPECT(vm_checkpoint_write(&first, CKPTFILE));
+
+    // opened and resumed in a new VM
+    vm_ckptfile_t f;
+    EXPECT(vm_checkpoint_open(&f, CKPTFILE));
+    if (failures > 0)
+        return 1;
+    EXPECT(f.memsize == bytes(&p));
+    EXPECT(memcmp(f.mem, p.mem, f.memsize) == 0);
+
+    vm_context_t rest;
+    vm_memio_t rout;
+    EXPECT(vm_init(&rest, f.mem, f.memsize));
+    vm_host_memory(&rest.host, &rout, "", 0);
+    EXPECT(vm_checkpoint_restore(&f, &rest));
+    EXPECT(rest.inscount == 25);
+    EXPECT((rest.pc == first.pc) && (rest.t == first.t) && (rest.b == first.b));
+    EXPECT(vm_run(&rest, SIZE_MAX) == VM_STOP_HALT);
+
+    EXPECT(rest.inscount == whole.inscount);
+    EXPECT(fout.outlen + rout.outlen == wout.outlen);
+    EXPECT((fout.outlen <= wout.outlen) &&
+           (memcmp(wout.out, fout.out, fout.outlen) == 0) &&
+           (memcmp(wout.out + fout.outlen, rout.out, rout.outlen) == 0));
+
+    vm_free(&rest);
+    vm_checkpoint_close(&f);
+
+    // a checkpoint whose cells do not match t is rejected
+    vm_checkpoint_t h;
+    FILE *fp = fopen(CKPTFILE, "r+b");
+    EXPECT((fp != NULL) && (fread(&h, sizeof(h), 1, fp) == 1));
+    if (fp != NULL)
+    {
+        h.ncells++;
+        rewind(fp);
+        fwrite(&h, sizeof(h), 1, fp);
+        fclose(fp);
+        EXPECT(!vm_checkpoint_open(&f, CKPTFILE));
+    }
+
+    // t at the last cell of the largest stack
+    EXPECT(vm_stack_resize(&first, VM_STACKMAX));
+    first.t = UINT16_MAX;
+    first.dstack[UINT16_MAX] = 7;
+    EXPECT(vm_checkpoint_write(&first, CKPTFILE));
+    EXPECT(vm_checkpoint_open(&f, CKPTFILE));
+    if (failures == 0)
+    {
+        EXPECT(f.hdr->ncells == VM_STACKMAX);
+        EXPECT(vm_init(&rest, f.mem, f.memsize));
+        EXPECT(vm_checkpoint_restore(&f, &rest));
+        EXPECT((rest.t == UINT16_MAX) && (rest.dstack[UINT16_MAX] == 7));
+        vm_free(&rest);
+        vm_checkpoint_close(&f);
+    }
+    remove(CKPTFILE);
+
+    vm_memio_free(&wout);
+    vm_memio_free(&fout);
+    vm_memio_free(&rout);
+    vm_free(&whole);
+    vm_free(&first);
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+/*
+
+    Data stack bounds: recursion past the end of the stack
+    stops the VM with VM_STOP_OVERFLOW and leaves everything
+    else intact, and a program runs on a stack of exactly
+    the cells the verifier bounds it by.
+
+    test_stack [<image>]: the image, see stack.cmake, is
+    tests/recursion.pl0.
+
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include "vm.h"
+#include "verify.h"
+#include "hostio.h"
+#include "imagefile.h"
+#include "test.h"
+
+// a procedure that calls itself for ever
+static void endless(test_prog_t *p)
+{
+    p->len = 0;
+    ins(p, VM_JMP, 0, 4);
+    ins(p, VM_INT, 0, 3);           // 1: procedure
+    ins(p, VM_CAL, 1, 1);
+    ins(p, VM_OPR, 0, OPR_RET);
+    ins(p, VM_INT, 0, 4);           // 4: program
+    ins(p, VM_CAL, 0, 1);
+    ins(p, VM_HALT, 0, 0);
+}
+
+// prints 42
+static void answer(test_prog_t *p)
+{
+    p->len = 0;
+    ins(p, VM_INT, 0, 4);
+    ins(p, VM_LIT, 0, 42);
+    ins(p, VM_OPR, 0, OPR_OUTINT);
+    ins(p, VM_HALT, 0, 0);
+}
+
+static void overflow()
+{
+    test_prog_t p;
+    endless(&p);
+
+    vm_context_t c;
+    vm_verify_t r;
+    EXPECT(vm_init(&c, p.mem, bytes(&p)));
+    EXPECT(vm_verify(&c, &r));
+    EXPECT(r.stackcells == 0);      // it recurses
+    vm_verify_free(&r);
+    EXPECT(vm_stack_resize(&c, 64));
+    vm_reset(&c);
+
+    uint8_t mem[sizeof(p.mem)];
+    memcpy(mem, p.mem, sizeof(mem));
+    vm_dins_t *code = malloc((c.codelen+1) * sizeof(vm_dins_t));
+    memcpy(code, c.code, (c.codelen+1) * sizeof(vm_dins_t));
+
+    // unchecked, the guard pages stop it
+    EXPECT(!vm_needs_checks(&c));
+    EXPECT(vm_run(&c, SIZE_MAX) == VM_STOP_OVERFLOW);
+    EXPECT(memcmp(mem, p.mem, sizeof(mem)) == 0);
+    EXPECT(memcmp(code, c.code, (c.codelen+1) * sizeof(vm_dins_t)) == 0);
+
+    // and again, the guard is set up for every run
+    vm_reset(&c);
+    EXPECT(vm_run(&c, SIZE_MAX) == VM_STOP_OVERFLOW);
+
+    // the checked engine stops before the access
+    vm_reset(&c);
+    vm_run_guarded(&c, vm_engine(VM_POLICY_COUNT | VM_POLICY_TOS | VM_POLICY_BOUNDS));
+    EXPECT(c.stop == VM_STOP_BOUNDS);
+    EXPECT(c.t < c.stacksize);
+
+    // another VM on the same thread runs as usual
+    test_prog_t q;
+    answer(&q);
+    vm_context_t d;
+    vm_memio_t out;
+    EXPECT(vm_init(&d, q.mem, bytes(&q)));
+    vm_host_memory(&d.host, &out, "", 0);
+    EXPECT(vm_run(&d, SIZE_MAX) == VM_STOP_HALT);
+    EXPECT((out.outlen == 2) && (memcmp(out.out, "42", 2) == 0));
+
+    vm_memio_free(&out);
+    vm_free(&d);
+    free(code);
+    vm_free(&c);
+}
+
+// a procedure that stores v into cell 'cell' of its frame header
+// and returns; LOD 1 after HALT makes the display two levels deep
+static void header(test_prog_t *p, int16_t cell, int16_t v)
+{
+    p->len = 0;
+    ins(p, VM_JMP, 0, 5);
+    ins(p, VM_INT, 0, 3);           // 1: procedure
+    ins(p, VM_LIT, 0, v);
+    ins(p, VM_STO, 0, cell);
+    ins(p, VM_OPR, 0, OPR_RET);     // 4
+    ins(p, VM_INT, 0, 4);           // 5: program
+    ins(p, VM_CAL, 0, 1);
+    ins(p, VM_HALT, 0, 0);
+    ins(p, VM_LOD, 1, 3);
+}
+
+// a RET to a bad address or base stops before it changes anything
+static void badreturn()
+{
+    static const int16_t cells[] = { 2, 1 };
+    for(unsigned i=0; i<sizeof(cells)/sizeof(cells[0]); i++)
+    {
+        test_prog_t p;
+        header(&p, cells[i], -1);
+
+        vm_context_t c;
+        EXPECT(vm_init(&c, p.mem, bytes(&p)));
+        vm_run_guarded(&c, vm_engine(VM_POLICY_COUNT | VM_POLICY_TOS | VM_POLICY_BOUNDS));
+        EXPECT(c.stop == VM_STOP_BOUNDS);
+        EXPECT((c.pc == 4) && (c.t == 7) && (c.b == 5));
+        // the top of stack is not spilled into the caller's frame
+        EXPECT((c.dstack[5 + cells[i]] == -1) && (c.dstack[4] == 0));
+        vm_free(&c);
+    }
+}
+
+// run the image on a checked stack of cells cells, returns the stop
+static vm_stop_t runon(const vm_image_t *img, uint32_t cells, vm_memio_t *out)
+{
+    vm_context_t c;
+    vm_verify_t r;
+    EXPECT(vm_init(&c, img->code, img->codebytes));
+    c.entry = img->entry;
+    c.data  = img->data;
+    c.ndata = img->ndata;
+    vm_verify(&c, &r);
+    vm_verify_free(&r);
+    if (cells != 0)
+    {
+        EXPECT(vm_stack_resize(&c, cells));
+        // the mapped stack is whole pages, the checks see the cells only
+        c.stacksize = cells;
+    }
+    vm_reset(&c);
+    vm_host_memory(&c.host, out, "", 0);
+    vm_run_guarded(&c, vm_engine(VM_POLICY_COUNT | VM_POLICY_TOS | VM_POLICY_BOUNDS));
+    vm_stop_t stop = (vm_stop_t)c.stop;
+    vm_free(&c);
+    return stop;
+}
+
+static void bounded(const char *fname)
+{
+    vm_image_t img;
+    EXPECT(vm_image_open(&img, fname));
+    if (failures > 0)
+        return;
+
+    vm_context_t c;
+    vm_verify_t r;
+    EXPECT(vm_init(&c, img.code, img.codebytes));
+    c.entry = img.entry;
+    EXPECT(vm_verify(&c, &r));
+    uint32_t cells = r.stackcells;
+    EXPECT(cells != 0);
+    vm_verify_free(&r);
+    vm_free(&c);
+
+    vm_memio_t ref, out, less;
+    EXPECT(runon(&img, 0, &ref) == VM_STOP_HALT);
+    EXPECT(runon(&img, cells, &out) == VM_STOP_HALT);
+    EXPECT((out.outlen == ref.outlen) && (memcmp(out.out, ref.out, ref.outlen) == 0));
+
+    // and the bound is tight
+    EXPECT(runon(&img, cells-1, &less) == VM_STOP_BOUNDS);
+
+    vm_memio_free(&ref);
+    vm_memio_free(&out);
+    vm_memio_free(&less);
+    vm_image_close(&img);
+}
+
+int main(int argc, char *argv[])
+{
+    overflow();
+    badreturn();
+    if (argc > 1)
+        bounded(argv[1]);
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+/*
+
+    Load-time verifier: programs it must accept and reject
+
+*/
+
+#include <string.h>
+#include "vm.h"
+#include "verify.h"
+#include "test.h"
+
+static bool verify(const test_prog_t *p, vm_verify_t *r)
+{
+    return vm_verify_image(p->mem, p->len, 0, r);
+}
+
+// a loop with a variable, as the compiler makes them
+static void accepted()
+{
+    test_prog_t p;
+    vm_verify_t r;
+    p.len = 0;
+    ins(&p, VM_INT, 0, 4);
+    ins(&p, VM_LIT, 0, 3);
+    ins(&p, VM_STO, 0, 3);
+    ins(&p, VM_LOD, 0, 3);          // 3: loop
+    ins(&p, VM_LIT, 0, 1);
+    ins(&p, VM_OPR, 0, OPR_SUB);
+    ins(&p, VM_STO, 0, 3);
+    ins(&p, VM_LOD, 0, 3);
+    ins(&p, VM_JPC, 0, 10);
+    ins(&p, VM_JMP, 0, 3);
+    ins(&p, VM_HALT, 0, 0);         // 10
+    EXPECT(verify(&p, &r));
+    EXPECT(r.stackcells != 0);
+    vm_verify_free(&r);
+}
+
+// one path to the join pushes a value, the other does not
+static void unbalanced()
+{
+    test_prog_t p;
+    vm_verify_t r;
+    p.len = 0;
+    ins(&p, VM_INT, 0, 4);
+    ins(&p, VM_LIT, 0, 0);
+    ins(&p, VM_JPC, 0, 5);
+    ins(&p, VM_LIT, 0, 1);
+    ins(&p, VM_JMP, 0, 5);
+    ins(&p, VM_HALT, 0, 0);         // 5: join
+    EXPECT(!verify(&p, &r));
+    vm_verify_free(&r);
+
+    // balanced, the other path pushes too
+    p.len = 0;
+    ins(&p, VM_INT, 0, 4);
+    ins(&p, VM_LIT, 0, 0);
+    ins(&p, VM_JPC, 0, 5);
+    ins(&p, VM_LIT, 0, 1);
+    ins(&p, VM_JMP, 0, 6);
+    ins(&p, VM_LIT, 0, 2);          // 5
+    ins(&p, VM_OPR, 0, OPR_OUTINT); // 6: join
+    ins(&p, VM_HALT, 0, 0);
+    EXPECT(verify(&p, &r));
+    vm_verify_free(&r);
+}
+
+// JMP, JPC and CAL targets past the last instruction
+static void outside()
+{
+    static const uint8_t ops[] = { VM_JMP, VM_JPC, VM_CAL };
+    for(unsigned i=0; i<sizeof(ops); i++)
+    {
+        test_prog_t p;
+        vm_verify_t r;
+        p.len = 0;
+        ins(&p, VM_INT, 0, 4);
+        ins(&p, VM_LIT, 0, 0);
+        ins(&p, ops[i], 0, 50);
+        ins(&p, VM_HALT, 0, 0);
+        EXPECT(!verify(&p, &r));
+        EXPECT(r.pc == 2);
+        vm_verify_free(&r);
+    }
+}
+
+// LOD and print it, or store a literal with STO; returns the pc of op
+static uint16_t access(test_prog_t *p, uint8_t op, uint8_t level, int16_t n)
+{
+    if (op == VM_LOD)
+    {
+        uint16_t pc = ins(p, VM_LOD, level, n);
+        ins(p, VM_OPR, 0, OPR_OUTINT);
+        return pc;
+    }
+    ins(p, VM_LIT, 0, 0);
+    return ins(p, VM_STO, level, n);
+}
+
+// LOD and STO of the cell above the frame, in the program
+// and in a procedure that reaches into the program's frame
+static void aboveframe()
+{
+    static const uint8_t ops[] = { VM_LOD, VM_STO };
+    for(unsigned i=0; i<sizeof(ops); i++)
+    {
+        test_prog_t p;
+        vm_verify_t r;
+
+        // the frame of INT 4 is cells 0..3
+        p.len = 0;
+        ins(&p, VM_INT, 0, 4);
+        uint16_t pc = access(&p, ops[i], 0, 4);
+        ins(&p, VM_HALT, 0, 0);
+        EXPECT(!verify(&p, &r));
+        EXPECT(r.pc == pc);
+        vm_verify_free(&r);
+
+        p.len = 0;
+        ins(&p, VM_JMP, 0, 5);
+        ins(&p, VM_INT, 0, 3);          // 1: procedure
+        pc = access(&p, ops[i], 1, 4);
+        ins(&p, VM_OPR, 0, OPR_RET);
+        ins(&p, VM_INT, 0, 4);          // 5: program
+        ins(&p, VM_CAL, 0, 1);
+        ins(&p, VM_HALT, 0, 0);
+        EXPECT(!verify(&p, &r));
+        EXPECT(r.pc == pc);
+        vm_verify_free(&r);
+
+        // the variable of the program is fine
+        p.mem[pc*3 + 1] = 3;
+        EXPECT(verify(&p, &r));
+        vm_verify_free(&r);
+    }
+}
+
+// the callee has no INT, CAL still writes cells 5..7
+static void header()
+{
+    test_prog_t p;
+    vm_verify_t r;
+    p.len = 0;
+    ins(&p, VM_JMP, 0, 2);
+    ins(&p, VM_OPR, 0, OPR_RET);    // 1: procedure
+    ins(&p, VM_INT, 0, 4);          // 2: program
+    ins(&p, VM_CAL, 0, 1);
+    ins(&p, VM_HALT, 0, 0);
+    EXPECT(verify(&p, &r));
+    EXPECT(r.stackcells == 8);
+    vm_verify_free(&r);
+}
+
+int main()
+{
+    accepted();
+    unbalanced();
+    outside();
+    aboveframe();
+    header();
+    return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,215 @@
+/*
+
+    Batch runner: a pool of worker threads, each with its own
+    VM instance on the shared program
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "batch.h"
+#include "hostio.h"
+#include "mapfile.h"
+#include "scheduler.h"
+
+typedef struct
+{
+    const vm_context_t *image;
+    vm_engine_t     engine;
+    vm_batchjob_t   *jobs;
+    size_t          njobs;
+    atomic_size_t   next;       ///< next job to take
+} batch_t;
+
+static bool writefile(const char *fname, const char *p, size_t len)
+{
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    bool ok = vm_writeall(fd, p, len);
+    return (close(fd) == 0) && ok;
+}
+
+static void runjob(batch_t *batch, vm_context_t *c, vm_batchjob_t *job)
+{
+    vm_mapfile_t in;
+    if ((job->output == NULL) || !vm_map_open(&in, job->input))
+        return;
+
+    vm_memio_t m;
+    vm_host_memory(&c->host, &m, (const char*)in.data, in.len);
+    vm_reset(c);
+    vm_run_guarded(c, batch->engine);
+
+    job->stop     = c->stop;
+    job->inscount = c->inscount;
+    job->outlen   = m.outlen;
+    job->ok       = writefile(job->output, m.out, m.outlen);
+
+    vm_memio_free(&m);
+    vm_map_close(&in);
+}
+
+static void* worker(void *arg)
+{
+    batch_t *batch = arg;
+    vm_context_t c;
+    bool ready = vm_share(&c, batch->image);
+
+    while(1)
+    {
+        size_t i = atomic_fetch_add_explicit(&batch->next, 1, memory_order_relaxed);
+        if (i >= batch->njobs)
+            break;
+        // without a stack the jobs it takes stay failed
+        if (ready)
+            runjob(batch, &c, &batch->jobs[i]);
+    }
+
+    vm_free(&c);
+    return NULL;
+}
+
+static char* outname(const char *input, const char *outdir)
+{
+    const char *base = input;
+    if (outdir != NULL)
+    {
+        const char *slash = strrchr(input, '/');
+        base = (slash != NULL) ? slash+1 : input;
+    }
+
+    size_t len = ((outdir != NULL) ? strlen(outdir) + 1 : 0) + strlen(base) + 5;
+    char *name = malloc(len);
+    if (name != NULL)
+    {
+        if (outdir != NULL)
+            snprintf(name, len, "%s/%s.out", outdir, base);
+        else
+            snprintf(name, len, "%s.out", base);
+    }
+    return name;
+}
+
+static void initjobs(vm_batchjob_t *jobs, size_t njobs, const char *outdir)
+{
+    for(size_t i=0; i<njobs; i++)
+    {
+        jobs[i].output   = outname(jobs[i].input, outdir);
+        jobs[i].stop     = VM_STOP_NONE;
+        jobs[i].inscount = 0;
+        jobs[i].outlen   = 0;
+        jobs[i].ok       = false;
+        jobs[i].slices   = 0;
+        jobs[i].maxdelay = 0;
+    }
+}
+
+void vm_batch_run(const vm_context_t *image, vm_engine_t engine,
+    vm_batchjob_t *jobs, size_t njobs, unsigned nthreads, const char *outdir)
+{
+    batch_t batch;
+    batch.image  = image;
+    batch.engine = engine;
+    batch.jobs   = jobs;
+    batch.njobs  = njobs;
+    atomic_init(&batch.next, 0);
+    initjobs(jobs, njobs, outdir);
+
+    if (nthreads == 0)
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = (n > 0) ? (unsigned)n : 1;
+    }
+    if (nthreads > njobs)
+        nthreads = (njobs > 0) ? (unsigned)njobs : 1;
+
+    // the calling thread is the first worker
+    pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+    unsigned started = 0;
+    while((threads != NULL) && (started+1 < nthreads) &&
+        (pthread_create(&threads[started], NULL, worker, &batch) == 0))
+    {
+        started++;
+    }
+    worker(&batch);
+
+    for(unsigned i=0; i<started; i++)
+    {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+void vm_batch_sched(const vm_context_t *image, vm_batchjob_t *jobs, size_t njobs,
+    unsigned nthreads, const char *outdir, size_t slice, size_t quota)
+{
+    initjobs(jobs, njobs, outdir);
+
+    vm_sched_t s;
+    vm_task_t *tasks = calloc(njobs, sizeof(vm_task_t));
+    bool *queued = calloc(njobs, sizeof(bool));
+    if ((tasks == NULL) || (queued == NULL) || !vm_sched_init(&s, nthreads, slice))
+    {
+        free(tasks);
+        free(queued);
+        return;
+    }
+
+    // the whole input is there from the start
+    for(size_t i=0; i<njobs; i++)
+    {
+        vm_mapfile_t in;
+        if ((jobs[i].output == NULL) || !vm_map_open(&in, jobs[i].input))
+            continue;
+
+        if (!vm_task_init(&tasks[i], image, quota))
+        {
+            vm_map_close(&in);
+            continue;
+        }
+        queued[i] = vm_queueio_feed(&tasks[i].io, (const char*)in.data, in.len);
+        vm_map_close(&in);
+        if (!queued[i])
+        {
+            vm_task_free(&tasks[i]);
+            continue;
+        }
+        vm_queueio_close(&tasks[i].io);
+        vm_sched_add(&s, &tasks[i]);
+    }
+    vm_sched_wait(&s);
+    vm_sched_free(&s);
+
+    for(size_t i=0; i<njobs; i++)
+    {
+        if (!queued[i])
+            continue;
+
+        vm_task_t *t = &tasks[i];
+        jobs[i].stop     = t->stop;
+        jobs[i].inscount = t->ctx.inscount;
+        jobs[i].outlen   = t->io.out.outlen;
+        jobs[i].slices   = t->slices;
+        jobs[i].maxdelay = t->maxdelay;
+        jobs[i].ok       = writefile(jobs[i].output, t->io.out.out, t->io.out.outlen);
+        vm_task_free(t);
+    }
+    free(queued);
+    free(tasks);
+}
+
+void vm_batch_free(vm_batchjob_t *jobs, size_t njobs)
+{
+    for(size_t i=0; i<njobs; i++)
+    {
+        free(jobs[i].output);
+        jobs[i].output = NULL;
+    }
+}
@@ -0,0 +1,51 @@
+/*
+
+    Batch runner of the p-code virtual machine
+
+    Runs one program against many input files on a pool of
+    worker threads. Every worker has its own vm_context_t
+    (see vm_share()) with a memory host, the decoded code
+    is shared read-only. Workers take the next input from
+    an atomic counter and keep no other shared state, so
+    the run scales with the number of cores.
+
+    vm_batch_sched() runs all inputs at once as tasks of the
+    time-sliced scheduler instead (see scheduler.h), so a long
+    job does not hold up the short ones behind it.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include "vm.h"
+
+/** one input file and the result of running it */
+typedef struct
+{
+    const char *input;      ///< input file name
+    char    *output;        ///< output file name, set by vm_batch_run()
+    uint8_t stop;           ///< vm_stop_t
+    size_t  inscount;
+    size_t  outlen;         ///< bytes of output
+    bool    ok;             ///< input read and output written
+    uint64_t slices;        ///< time slices, vm_batch_sched() only
+    uint64_t maxdelay;      ///< longest wait for a slice in ns, vm_batch_sched() only
+} vm_batchjob_t;
+
+/** run the program of image on every job with nthreads workers
+    (0: one per online CPU). The output of an input file goes to
+    <input>.out, or <outdir>/<input basename>.out if outdir is set.
+    image must not be changed while the batch runs. */
+void vm_batch_run(const vm_context_t *image, vm_engine_t engine,
+    vm_batchjob_t *jobs, size_t njobs, unsigned nthreads, const char *outdir);
+
+/** as vm_batch_run(), on nthreads scheduler workers with slices
+    of 'slice' instructions. A job stops with VM_STOP_LIMIT after
+    'quota' instructions (SIZE_MAX: no quota); a superinstruction
+    completes, so it can end a few instructions past. */
+void vm_batch_sched(const vm_context_t *image, vm_batchjob_t *jobs, size_t njobs,
+    unsigned nthreads, const char *outdir, size_t slice, size_t quota);
+
+/** free the output names of the jobs */
+void vm_batch_free(vm_batchjob_t *jobs, size_t njobs);
@@ -0,0 +1,328 @@
+/*
+
+    Call-graph profiler
+
+    Recursion makes a procedure appear more than once on a
+    call path; its inclusive count only includes the
+    outermost activation.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "profile.h"
+#include "callgraph.h"
+
+bool vm_calls_init(vm_callgraph_t *cg, const vm_context_t *c)
+{
+    cg->capnodes = 64;
+    cg->nodes    = calloc(cg->capnodes, sizeof(vm_callnode_t));
+    if (cg->nodes == NULL)
+        return false;
+
+    cg->nnodes   = 1;
+    cg->nodes[0].proc = c->pc;
+    cg->nodes[0].calls = 1;
+    cg->stack[0] = 0;
+    cg->depth    = 0;
+    cg->overflow = 0;
+    cg->tcycles  = ((c->probes != NULL) && (c->probes->tcost != NULL)) ? &c->probes->tcycles : NULL;
+    vm_calls_resume(cg, c->inscount);
+    return true;
+}
+
+void vm_calls_free(vm_callgraph_t *cg)
+{
+    free(cg->nodes);
+    cg->nodes  = NULL;
+    cg->nnodes = 0;
+}
+
+// charge everything since the last event to the top of the shadow stack
+static void charge(vm_callgraph_t *cg, size_t n)
+{
+    uint64_t now = vm_cycles();
+    vm_callnode_t *top = &cg->nodes[cg->stack[cg->depth]];
+    top->ins    += n - cg->lastins;
+    top->cycles += now - cg->lastcycles;
+    cg->lastins    = n;
+    cg->lastcycles = now;
+    if (cg->tcycles != NULL)
+    {
+        top->target   += *cg->tcycles - cg->lasttarget;
+        cg->lasttarget = *cg->tcycles;
+    }
+}
+
+void vm_calls_pause(vm_callgraph_t *cg, size_t n)
+{
+    charge(cg, n);
+}
+
+void vm_calls_resume(vm_callgraph_t *cg, size_t n)
+{
+    cg->lastins    = n;
+    cg->lastcycles = vm_cycles();
+    cg->lasttarget = (cg->tcycles != NULL) ? *cg->tcycles : 0;
+}
+
+static uint32_t callee(vm_callgraph_t *cg, uint32_t parent, uint16_t proc)
+{
+    for(uint32_t i = cg->nodes[parent].child; i != 0; i = cg->nodes[i].sibling)
+    {
+        if (cg->nodes[i].proc == proc)
+            return i;
+    }
+
+    if (cg->nnodes == cg->capnodes)
+    {
+        vm_callnode_t *nodes = realloc(cg->nodes, 2*cg->capnodes*sizeof(vm_callnode_t));
+        if (nodes == NULL)
+            return parent;      // out of memory: charge the caller
+        cg->nodes     = nodes;
+        cg->capnodes *= 2;
+    }
+
+    uint32_t i = cg->nnodes++;
+    memset(&cg->nodes[i], 0, sizeof(vm_callnode_t));
+    cg->nodes[i].proc    = proc;
+    cg->nodes[i].parent  = parent;
+    cg->nodes[i].sibling = cg->nodes[parent].child;
+    cg->nodes[parent].child = i;
+    return i;
+}
+
+void vm_calls_enter(vm_callgraph_t *cg, uint16_t proc, size_t n)
+{
+    charge(cg, n);
+    if (cg->depth+1 == VM_CALLS_MAXDEPTH)
+    {
+        cg->overflow++;
+        return;
+    }
+
+    uint32_t node = callee(cg, cg->stack[cg->depth], proc);
+    cg->nodes[node].calls++;
+    cg->stack[++cg->depth] = node;
+}
+
+void vm_calls_leave(vm_callgraph_t *cg, size_t n)
+{
+    charge(cg, n);
+    if (cg->overflow > 0)
+        cg->overflow--;
+    else if (cg->depth > 0)
+        cg->depth--;
+}
+
+/*
+    reports
+*/
+
+typedef struct
+{
+    uint64_t ins;
+    uint64_t cycles;
+    uint64_t target;
+} totals_t;
+
+typedef struct
+{
+    uint16_t proc;
+    uint64_t calls;
+    totals_t excl;
+    totals_t incl;
+    uint32_t active;    // activations on the current path
+} procstat_t;
+
+typedef struct
+{
+    procstat_t *procs;
+    uint32_t   nprocs;
+} stats_t;
+
+static procstat_t* findproc(stats_t *st, uint16_t proc)
+{
+    for(uint32_t i=0; i<st->nprocs; i++)
+    {
+        if (st->procs[i].proc == proc)
+            return &st->procs[i];
+    }
+    procstat_t *p = &st->procs[st->nprocs++];
+    memset(p, 0, sizeof(procstat_t));
+    p->proc = proc;
+    return p;
+}
+
+// adds the subtree totals of node to its procedure and returns
+// them. st->procs has room for every node, so p stays valid.
+static void add(totals_t *sum, const totals_t *t)
+{
+    sum->ins    += t->ins;
+    sum->cycles += t->cycles;
+    sum->target += t->target;
+}
+
+static void walk(const vm_callgraph_t *cg, stats_t *st, uint32_t node, totals_t *sub)
+{
+    const vm_callnode_t *nd = &cg->nodes[node];
+    procstat_t *p = findproc(st, nd->proc);
+    totals_t own = { nd->ins, nd->cycles, nd->target };
+    p->calls += nd->calls;
+    add(&p->excl, &own);
+
+    *sub = own;
+    p->active++;
+    for(uint32_t i = nd->child; i != 0; i = cg->nodes[i].sibling)
+    {
+        totals_t child;
+        walk(cg, st, i, &child);
+        add(sub, &child);
+    }
+    p->active--;
+    if (p->active == 0)
+    {
+        add(&p->incl, sub);
+    }
+}
+
+static int byinclusive(const void *a, const void *b)
+{
+    const procstat_t *pa = a;
+    const procstat_t *pb = b;
+    if (pa->incl.ins != pb->incl.ins)
+        return (pa->incl.ins < pb->incl.ins) ? 1 : -1;
+    return (pa->proc < pb->proc) ? -1 : 1;
+}
+
+static int byinclusivetarget(const void *a, const void *b)
+{
+    const procstat_t *pa = a;
+    const procstat_t *pb = b;
+    if (pa->incl.target != pb->incl.target)
+        return (pa->incl.target < pb->incl.target) ? 1 : -1;
+    return (pa->proc < pb->proc) ? -1 : 1;
+}
+
+static const char* procname(const vm_symtab_t *syms, uint16_t proc, bool root, char *buf)
+{
+    if (root)
+        return "main";
+
+    const char *name = (syms != NULL) ? vm_sym_name(syms, proc) : NULL;
+    if (name != NULL)
+        return name;
+
+    sprintf(buf, "pc%u", proc);
+    return buf;
+}
+
+// per procedure totals sorted by cmp, NULL if there is no memory
+static procstat_t* procstats(const vm_callgraph_t *cg, totals_t *total, uint32_t *nprocs,
+    int (*cmp)(const void*, const void*))
+{
+    stats_t st;
+    st.procs  = malloc(cg->nnodes*sizeof(procstat_t));
+    st.nprocs = 0;
+    if (st.procs == NULL)
+        return NULL;
+
+    walk(cg, &st, 0, total);
+    qsort(st.procs, st.nprocs, sizeof(procstat_t), cmp);
+    *nprocs = st.nprocs;
+    return st.procs;
+}
+
+void vm_calls_report(const vm_callgraph_t *cg, const vm_symtab_t *syms, FILE *f)
+{
+    totals_t t;
+    uint32_t nprocs;
+    procstat_t *procs = procstats(cg, &t, &nprocs, byinclusive);
+    if (procs == NULL)
+        return;
+
+    uint64_t total = t.ins;
+    fprintf(f, "\nCall graph profile: %lu instructions\n\n", total);
+    fprintf(f, "  %-20s %10s %14s %7s %14s %7s %16s %16s\n", "procedure", "calls",
+        "inclusive", "%", "exclusive", "%", "incl. cycles", "excl. cycles");
+    for(uint32_t i=0; i<nprocs; i++)
+    {
+        const procstat_t *p = &procs[i];
+        char buf[16];
+        fprintf(f, "  %-20s %10lu %14lu %6.2f%% %14lu %6.2f%% %16lu %16lu\n",
+            procname(syms, p->proc, p->proc == cg->nodes[0].proc, buf), p->calls,
+            p->incl.ins, (total > 0) ? 100.0*p->incl.ins/total : 0.0,
+            p->excl.ins, (total > 0) ? 100.0*p->excl.ins/total : 0.0,
+            p->incl.cycles, p->excl.cycles);
+    }
+    free(procs);
+}
+
+void vm_calls_target_report(const vm_callgraph_t *cg, const vm_symtab_t *syms, FILE *f)
+{
+    totals_t t;
+    uint32_t nprocs;
+    procstat_t *procs = procstats(cg, &t, &nprocs, byinclusivetarget);
+    if (procs == NULL)
+        return;
+
+    uint64_t total = t.target;
+    fprintf(f, "\nEstimated target cycles per procedure: %lu\n\n", total);
+    fprintf(f, "  %-20s %10s %16s %7s %16s %7s %10s\n", "procedure", "calls",
+        "inclusive", "%", "exclusive", "%", "per call");
+    for(uint32_t i=0; i<nprocs; i++)
+    {
+        const procstat_t *p = &procs[i];
+        char buf[16];
+        fprintf(f, "  %-20s %10lu %16lu %6.2f%% %16lu %6.2f%% %10.0f\n",
+            procname(syms, p->proc, p->proc == cg->nodes[0].proc, buf), p->calls,
+            p->incl.target, (total > 0) ? 100.0*p->incl.target/total : 0.0,
+            p->excl.target, (total > 0) ? 100.0*p->excl.target/total : 0.0,
+            (p->calls > 0) ? (double)p->incl.target/p->calls : 0.0);
+    }
+    free(procs);
+}
+
+static void fold(const vm_callgraph_t *cg, const vm_symtab_t *syms, FILE *f,
+    uint32_t node, char *path, size_t len, size_t cap)
+{
+    const vm_callnode_t *nd = &cg->nodes[node];
+    char buf[16];
+    const char *name = procname(syms, nd->proc, node == 0, buf);
+
+    size_t namelen = strlen(name);
+    size_t newlen  = len + ((len > 0) ? 1 : 0) + namelen;
+    if (newlen >= cap)
+        return;     // absurdly deep, leave it out
+    if (len > 0)
+        path[len] = ';';
+    memcpy(path + newlen - namelen, name, namelen);
+    path[newlen] = 0;
+
+    if (nd->ins > 0)
+        fprintf(f, "%s %lu\n", path, nd->ins);
+
+    for(uint32_t i = nd->child; i != 0; i = cg->nodes[i].sibling)
+    {
+        fold(cg, syms, f, i, path, newlen, cap);
+    }
+    path[len] = 0;
+}
+
+bool vm_calls_folded(const vm_callgraph_t *cg, const vm_symtab_t *syms, const char *fname)
+{
+    FILE *f = fopen(fname, "wt");
+    if (f == NULL)
+        return false;
+
+    size_t cap = 65536;
+    char *path = malloc(cap);
+    if (path != NULL)
+    {
+        path[0] = 0;
+        fold(cg, syms, f, 0, path, 0, cap);
+        free(path);
+    }
+    return (fclose(f) == 0) && (path != NULL);
+}
@@ -0,0 +1,73 @@
+/*
+
+    Call-graph profiler of the p-code virtual machine
+
+    The VM_POLICY_CALLS interpreter variants report every
+    CAL and RET here. A shadow call stack follows the
+    procedure activations, and the instructions and host
+    cycles between two events are charged to the procedure
+    on top of it. The counts are kept per call path (a node
+    of the call tree), from which per procedure inclusive
+    and exclusive counts and folded stacks are derived.
+
+    If the context has a target cost model (see target.h)
+    when the profile is set up, the estimated target cycles
+    of c->probes->tcycles are charged along with the instructions.
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "opcodes.h"
+#include "symfile.h"
+
+#define VM_CALLS_MAXDEPTH   4096
+
+typedef struct
+{
+    uint16_t proc;      ///< entry pc of the procedure
+    uint32_t parent;    ///< index of the caller's node
+    uint32_t child;     ///< first callee, 0 if none
+    uint32_t sibling;   ///< next callee of the parent, 0 if none
+    uint64_t calls;
+    uint64_t ins;       ///< exclusive instructions
+    uint64_t cycles;    ///< exclusive host cycles
+    uint64_t target;    ///< exclusive target cycles
+} vm_callnode_t;
+
+typedef struct vm_callgraph_s
+{
+    vm_callnode_t *nodes;   ///< call tree, nodes[0] is the program
+    uint32_t nnodes;
+    uint32_t capnodes;
+    uint32_t stack[VM_CALLS_MAXDEPTH];  ///< shadow stack of nodes
+    uint32_t depth;
+    uint32_t overflow;      ///< activations deeper than the shadow stack
+    size_t   lastins;       ///< inscount at the last event
+    uint64_t lastcycles;
+    const uint64_t *tcycles;    ///< target cycles of the context, or NULL
+    uint64_t lasttarget;
+} vm_callgraph_t;
+
+/** set up the profile for the program of c, starting at c->pc */
+bool vm_calls_init(vm_callgraph_t *cg, const vm_context_t *c);
+void vm_calls_free(vm_callgraph_t *cg);
+
+/** events from the interpreter; n is the instruction count */
+void vm_calls_resume(vm_callgraph_t *cg, size_t n);
+void vm_calls_enter(vm_callgraph_t *cg, uint16_t proc, size_t n);
+void vm_calls_leave(vm_callgraph_t *cg, size_t n);
+void vm_calls_pause(vm_callgraph_t *cg, size_t n);
+
+/** per procedure report, sorted by inclusive instructions.
+    syms may be NULL. */
+void vm_calls_report(const vm_callgraph_t *cg, const vm_symtab_t *syms, FILE *f);
+
+/** per procedure estimated target cycles, sorted by inclusive
+    cycles. syms may be NULL. */
+void vm_calls_target_report(const vm_callgraph_t *cg, const vm_symtab_t *syms, FILE *f);
+
+/** folded stacks ("main;a;b <instructions>") for flame graph tools */
+bool vm_calls_folded(const vm_callgraph_t *cg, const vm_symtab_t *syms, const char *fname);
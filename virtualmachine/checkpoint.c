@@ -0,0 +1,102 @@
+/*
+
+    Checkpoints: writing, mapping and restoring
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "vm.h"
+#include "checkpoint.h"
+
+#define ALIGN8(x)   (((x) + 7u) & ~7u)
+
+bool vm_checkpoint_write(const vm_context_t *c, const char *fname)
+{
+    if ((c->t >= c->stacksize) || (c->b >= c->stacksize))
+        return false;
+
+    vm_checkpoint_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, VM_CHECKPOINT_MAGIC, 4);
+    h.version  = VM_CHECKPOINT_VERSION;
+    h.memsize  = c->memsize;
+    h.pc       = c->pc;
+    h.t        = c->t;
+    h.b        = c->b;
+    h.ncells   = (uint32_t)c->t + 1;
+    h.inscount = c->inscount;
+    h.codeofs  = sizeof(h);
+    h.stackofs = ALIGN8(h.codeofs + h.memsize);
+
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    static const uint8_t zeros[8] = {0};
+    bool ok = vm_writeall(fd, &h, sizeof(h)) &&
+              vm_writeall(fd, c->mem, h.memsize) &&
+              vm_writeall(fd, zeros, h.stackofs - h.codeofs - h.memsize) &&
+              vm_writeall(fd, c->dstack, (size_t)h.ncells * sizeof(int16_t));
+    return (close(fd) == 0) && ok;
+}
+
+bool vm_checkpoint_open(vm_ckptfile_t *f, const char *fname)
+{
+    f->hdr = NULL;
+    f->mem = NULL;
+    f->memsize = 0;
+    if (!vm_map_open(&f->file, fname))
+        return false;
+
+    // t and b are 16 bit, any value fits a stack of VM_STACKMAX
+    // cells, which vm_checkpoint_restore() can set up
+    const vm_checkpoint_t *h = (const vm_checkpoint_t*)f->file.data;
+    if ((f->file.len < sizeof(vm_checkpoint_t)) ||
+        (memcmp(h->magic, VM_CHECKPOINT_MAGIC, 4) != 0) ||
+        (h->version != VM_CHECKPOINT_VERSION) ||
+        (h->ncells != h->t + 1) ||
+        (h->pc > h->memsize / sizeof(instruction_t)) ||
+        ((h->stackofs & 7) != 0) ||
+        ((uint64_t)h->codeofs + h->memsize > h->stackofs) ||
+        ((uint64_t)h->stackofs + (uint64_t)h->ncells * sizeof(int16_t) > f->file.len))
+    {
+        vm_map_close(&f->file);
+        return false;
+    }
+
+    f->hdr     = h;
+    f->mem     = (uint8_t*)f->file.data + h->codeofs;
+    f->memsize = h->memsize;
+    return true;
+}
+
+bool vm_checkpoint_restore(const vm_ckptfile_t *f, vm_context_t *c)
+{
+    const vm_checkpoint_t *h = f->hdr;
+    if ((h->ncells > c->stacksize) || (h->b >= c->stacksize))
+    {
+        if (!vm_stack_resize(c, (h->ncells > h->b) ? h->ncells : h->b + 1))
+            return false;
+    }
+    else
+    {
+        vm_stack_clear(c);
+    }
+    memcpy(c->dstack, f->file.data + h->stackofs, (size_t)h->ncells * sizeof(int16_t));
+    c->pc = h->pc;
+    c->t  = h->t;
+    c->b  = h->b;
+    c->inscount = h->inscount;
+    c->stop = VM_STOP_NONE;
+    return true;
+}
+
+void vm_checkpoint_close(vm_ckptfile_t *f)
+{
+    vm_map_close(&f->file);
+    f->hdr = NULL;
+    f->mem = NULL;
+}
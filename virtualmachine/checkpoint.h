@@ -0,0 +1,66 @@
+/*
+
+    Checkpoints of the p-code virtual machine
+
+    A checkpoint holds the registers, the instruction count,
+    the program image and the used part of the data stack,
+    dstack[0..t]. Cells above t read back as 0. Console I/O
+    is not part of it: input already read is not replayed.
+
+    File layout, host byte order:
+
+        vm_checkpoint_t     header
+        program image       at codeofs, memsize bytes
+        stack cells         at stackofs (8 byte aligned), ncells int16_t
+
+    vm_checkpoint_open() maps the file, the image is used
+    in place and the cells are copied in one go.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include "opcodes.h"
+#include "mapfile.h"
+
+#define VM_CHECKPOINT_MAGIC     "PCKP"
+#define VM_CHECKPOINT_VERSION   2
+
+typedef struct
+{
+    char     magic[4];      ///< VM_CHECKPOINT_MAGIC
+    uint16_t version;       ///< VM_CHECKPOINT_VERSION
+    uint16_t memsize;       ///< bytes of the program image
+    uint16_t pc;
+    uint16_t t;
+    uint16_t b;
+    uint16_t reserved;      ///< 0
+    uint32_t ncells;        ///< stack cells stored, t+1, up to VM_STACKMAX
+    uint32_t codeofs;       ///< file offset of the program image
+    uint32_t stackofs;      ///< file offset of the stack cells
+    uint64_t inscount;
+} vm_checkpoint_t;
+
+/** a checkpoint file opened for restoring */
+typedef struct
+{
+    const vm_checkpoint_t *hdr;
+    uint8_t *mem;           ///< program image, for vm_init()
+    uint16_t memsize;
+    vm_mapfile_t file;
+} vm_ckptfile_t;
+
+/** write the state of a stopped VM, fails if t or b are off the stack */
+bool vm_checkpoint_write(const vm_context_t *c, const char *fname);
+
+/** open and check a checkpoint, returns false if it is not valid */
+bool vm_checkpoint_open(vm_ckptfile_t *f, const char *fname);
+
+/** load the registers and stack of f into c, which must have been
+    set up with vm_init(c, f->mem, f->memsize). The stack grows if
+    the checkpoint needs more; returns false if it cannot. */
+bool vm_checkpoint_restore(const vm_ckptfile_t *f, vm_context_t *c);
+
+/** unmap f; the program image goes with it, so free the VM first */
+void vm_checkpoint_close(vm_ckptfile_t *f);
@@ -0,0 +1,232 @@
+/*
+
+    Console I/O of the p-code virtual machine: the stdio
+    host interface, see vm_host_stdio().
+
+    Output of OPR_OUTCHAR/OUTINT goes into a buffer that
+    is written to stdout according to the flush policy:
+
+    VM_FLUSH_INTERACTIVE  on newline and on input requests
+    VM_FLUSH_BLOCK        every VM_BLOCKSIZE bytes
+    VM_FLUSH_EXIT         when the buffer is full or at exit
+
+    The buffer is always flushed before OPR_INCHAR/ININT
+    read, so prompts appear before the program waits.
+
+    vm_console_input() switches input to batch mode: the
+    whole input file is mapped (or read, if it cannot be
+    mapped, e.g. a pipe) and ININT/INCHAR take their values
+    straight from memory, without prompt and without stdio.
+    Integers are parsed like scanf("%d") and truncated to
+    16 bits; past the end of the input both return 0.
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "vm.h"
+#include "mapfile.h"
+
+#define VM_OUTBUFSIZE   65536
+#define VM_BLOCKSIZE    4096
+
+static char       outbuf[VM_OUTBUFSIZE];
+static size_t     outlen  = 0;
+static size_t     outmax  = VM_OUTBUFSIZE;
+static vm_flush_t policy  = VM_FLUSH_INTERACTIVE;
+static bool       atexitset = false;
+
+// batch input, inbuf == NULL for console input
+static vm_mapfile_t infile;
+static const char *inbuf  = NULL;
+static const char *inptr  = NULL;
+static const char *inend  = NULL;
+
+void vm_console_flush()
+{
+    if (outlen > 0)
+    {
+        fwrite(outbuf, 1, outlen, stdout);
+        outlen = 0;
+    }
+    fflush(stdout);
+}
+
+void vm_console_policy(vm_flush_t p)
+{
+    vm_console_flush();
+    policy = p;
+    outmax = (p == VM_FLUSH_BLOCK) ? VM_BLOCKSIZE : VM_OUTBUFSIZE;
+}
+
+static void put(const char *s, size_t len)
+{
+    if (!atexitset)
+    {
+        atexit(vm_console_flush);
+        atexitset = true;
+    }
+
+    if (outlen + len > outmax)
+    {
+        vm_console_flush();
+    }
+
+    for(size_t i=0; i<len; i++)
+    {
+        outbuf[outlen++] = s[i];
+    }
+
+    if (outlen >= outmax)
+    {
+        vm_console_flush();
+    }
+}
+
+bool vm_console_input(const char *fname)
+{
+    vm_console_close();
+
+    if (!vm_map_open(&infile, fname))
+    {
+        return false;
+    }
+    if (infile.mapped)
+    {
+        madvise((void*)infile.data, infile.len, MADV_SEQUENTIAL);
+    }
+
+    inbuf = (const char*)infile.data;
+    inptr = inbuf;
+    inend = inbuf + infile.len;
+    return true;
+}
+
+void vm_console_close()
+{
+    if (inbuf != NULL)
+    {
+        vm_map_close(&infile);
+    }
+    inbuf  = NULL;
+    inptr  = NULL;
+    inend  = NULL;
+}
+
+const char* vm_parseint(const char *p, const char *end, int16_t *v)
+{
+    const char *start = p;
+    while((p < end) && ((*p == ' ') || ((*p >= '\t') && (*p <= '\r'))))
+    {
+        p++;
+    }
+
+    bool neg = false;
+    if ((p < end) && ((*p == '-') || (*p == '+')))
+    {
+        neg = (*p == '-');
+        p++;
+    }
+
+    *v = 0;
+    if ((p == end) || (*p < '0') || (*p > '9'))
+    {
+        // no number: leave the input where it was, like scanf
+        return start;
+    }
+
+    uint32_t u = 0;
+    while((p < end) && (*p >= '0') && (*p <= '9'))
+    {
+        u = u*10 + (*p - '0');
+        p++;
+    }
+
+    *v = (int16_t)(neg ? -u : u);
+    return p;
+}
+
+char* vm_formatint(char *end, int16_t v)
+{
+    // digits are produced backwards from end
+    char *p = end;
+    uint16_t u = (v < 0) ? -(uint16_t)v : (uint16_t)v;
+
+    do
+    {
+        *--p = '0' + (u % 10);
+        u /= 10;
+    } while(u != 0);
+
+    if (v < 0)
+    {
+        *--p = '-';
+    }
+    return p;
+}
+
+/*
+    The stdio host. The state is global, as there is only
+    one stdout; 'user' is not used.
+*/
+
+static int16_t stdioReadInt(void *user)
+{
+    (void)user;
+    if (inbuf != NULL)
+    {
+        int16_t v;
+        inptr = vm_parseint(inptr, inend, &v);
+        return v;
+    }
+
+    int v = 0;
+    put("> ", 2);
+    vm_console_flush();
+    scanf("%d", &v);
+    return v;
+}
+
+static void stdioWriteInt(void *user, int16_t v)
+{
+    (void)user;
+    char d[8];
+    char *p = vm_formatint(d + sizeof(d), v);
+    put(p, d + sizeof(d) - p);
+}
+
+static int16_t stdioReadChar(void *user)
+{
+    (void)user;
+    if (inbuf != NULL)
+    {
+        return (inptr < inend) ? *inptr++ : 0;
+    }
+
+    char v = 0;
+    vm_console_flush();
+    scanf("%c", &v);
+    return v;
+}
+
+static void stdioWriteChar(void *user, int16_t v)
+{
+    (void)user;
+    char ch = (char)v;
+    put(&ch, 1);
+    if ((ch == '\n') && (policy == VM_FLUSH_INTERACTIVE))
+    {
+        vm_console_flush();
+    }
+}
+
+void vm_host_stdio(vm_host_t *h)
+{
+    h->readInt   = stdioReadInt;
+    h->readChar  = stdioReadChar;
+    h->writeInt  = stdioWriteInt;
+    h->writeChar = stdioWriteChar;
+    h->user      = NULL;
+    h->ready     = NULL;
+}
@@ -0,0 +1,279 @@
+/*
+
+    Pre-decoder for the p-code virtual machine
+
+    Expands the packed 3-byte instruction_t image into
+    4-byte aligned vm_dins_t entries, so the interpreter
+    never touches the packed format:
+
+    * OPR n becomes one flat opcode per function
+    * the level nibble is split off
+    * jump targets outside the program point at the
+      DOP_BAD entry that terminates the decoded array
+
+    vm_fuse() then rewrites common compiler idioms into
+    superinstructions. Only the first entry of a sequence
+    is replaced; the handler reads the operands of the
+    entries that follow it. The decoded array therefore
+    stays indexed by the original pc, jumps into the
+    middle of a fused sequence still land on the plain
+    instructions, and the debugger can single-step
+    through a fused sequence (see vm_unfused()).
+
+*/
+
+#include <string.h>
+#include "vm.h"
+
+static uint16_t clamptarget(uint16_t a, uint16_t count)
+{
+    return (a < count) ? a : count;
+}
+
+// decode the instruction at pc of a count instruction program
+static void decodeone(vm_dins_t *d, const uint8_t *mem, uint16_t pc, uint16_t count)
+{
+    if (pc == count)
+    {
+        // sentinel: running off the end of the program stops the VM
+        d->op    = DOP_BAD;
+        d->level = 0;
+        d->n     = 0;
+        return;
+    }
+
+    const uint8_t *src = mem + pc*sizeof(instruction_t);
+    uint8_t  opcode = src[0];
+    uint16_t imm16  = src[1] | (src[2] << 8);
+
+    d->level = opcode >> 4;
+    d->n     = (int16_t)imm16;
+
+    switch(opcode & 0xF)
+    {
+    case VM_LIT:
+        d->op = DOP_LIT;
+        break;
+    case VM_OPR:
+        d->op = (imm16 <= OPR_ININT) ? DOP_RET + imm16 : DOP_NOP;
+        break;
+    case VM_LOD:
+        d->op = DOP_LOD;
+        break;
+    case VM_STO:
+        d->op = DOP_STO;
+        break;
+    case VM_LODX:
+        d->op = DOP_LODX;
+        break;
+    case VM_STOX:
+        d->op = DOP_STOX;
+        break;
+    case VM_CAL:
+        d->op = DOP_CAL;
+        d->a  = clamptarget(imm16, count);
+        break;
+    case VM_INT:
+        d->op = DOP_INT;
+        break;
+    case VM_JMP:
+        d->op = DOP_JMP;
+        d->a  = clamptarget(imm16, count);
+        break;
+    case VM_JPC:
+        d->op = DOP_JPC;
+        d->a  = clamptarget(imm16, count);
+        break;
+    case VM_HALT:
+        d->op = DOP_HALT;
+        break;
+    default:
+        d->op = DOP_BAD;
+        break;
+    }
+}
+
+void vm_decode(vm_dins_t *dst, const uint8_t *mem, uint16_t count)
+{
+    for(uint32_t pc=0; pc<=count; pc++)
+    {
+        decodeone(&dst[pc], mem, pc, count);
+    }
+}
+
+static bool iscmp(uint8_t op)
+{
+    return (op >= DOP_EQ) && (op <= DOP_GEQ);
+}
+
+static bool isarith(uint8_t op)
+{
+    return (op >= DOP_ADD) && (op <= DOP_DIV);
+}
+
+// returns the superinstruction that replaces the
+// sequence starting at d, or d->op if there is none.
+static uint8_t match(const vm_dins_t *d, uint16_t left)
+{
+    uint8_t op1 = (left > 1) ? d[1].op : DOP_BAD;
+    uint8_t op2 = (left > 2) ? d[2].op : DOP_BAD;
+    uint8_t op3 = (left > 3) ? d[3].op : DOP_BAD;
+
+    if (d->op == DOP_LOD)
+    {
+        // for-loop increment: LOD a / LIT n / ADD / STO b
+        if ((op1 == DOP_LIT) && (op2 == DOP_ADD) && (op3 == DOP_STO))
+            return DOP_LOD_LIT_ADD_STO;
+
+        // loop and if conditions: LOD a / LOD b / cmp / JPC
+        if ((op1 == DOP_LOD) && iscmp(op2) && (op3 == DOP_JPC))
+            return DOP_LOD_LOD_EQ_JPC + (op2 - DOP_EQ);
+
+        // LOD a / LIT n / cmp / JPC
+        if ((op1 == DOP_LIT) && iscmp(op2) && (op3 == DOP_JPC))
+            return DOP_LOD_LIT_EQ_JPC + (op2 - DOP_EQ);
+
+        // expression tail: <expr> / LOD a / cmp / JPC
+        if (iscmp(op1) && (op2 == DOP_JPC))
+            return DOP_LOD_EQ_JPC + (op1 - DOP_EQ);
+
+        if ((op1 == DOP_LOD) && isarith(op2))
+            return DOP_LOD_LOD_ADD + (op2 - DOP_ADD);
+
+        if (isarith(op1))
+            return DOP_LOD_ADD + (op1 - DOP_ADD);
+
+        if (op1 == DOP_STO)
+            return DOP_LOD_STO;
+    }
+    else if (d->op == DOP_LIT)
+    {
+        // newline after '!': LIT 10 / OUTCHAR / LIT 13 / OUTCHAR
+        if ((op1 == DOP_OUTCHAR) && (op2 == DOP_LIT) && (op3 == DOP_OUTCHAR))
+            return DOP_LIT_OUTCHAR_LIT_OUTCHAR;
+
+        if (op1 == DOP_STO)
+            return DOP_LIT_STO;
+    }
+
+    return d->op;
+}
+
+void vm_fuse(vm_dins_t *code, uint16_t count)
+{
+    // matching only looks at entries after pc, which
+    // have not been rewritten yet.
+    for(uint16_t pc=0; pc<count; pc++)
+    {
+        code[pc].op = match(&code[pc], count - pc);
+    }
+}
+
+bool vm_decode_check(const vm_dins_t *code, const uint8_t *mem, uint16_t count)
+{
+    // the plain entries pc..pc+3, all vm_fuse() looks at
+    vm_dins_t window[4];
+    for(uint32_t k=0; (k<4) && (k<=count); k++)
+    {
+        decodeone(&window[k], mem, k, count);
+    }
+
+    for(uint32_t pc=0; pc<=count; pc++)
+    {
+        uint8_t op = (pc < count) ? match(window, count - pc) : DOP_BAD;
+        if ((code[pc].op != op) || (code[pc].level != window[0].level) ||
+            (code[pc].n != window[0].n))
+        {
+            return false;
+        }
+
+        memmove(&window[0], &window[1], 3*sizeof(vm_dins_t));
+        if (pc+4 <= count)
+            decodeone(&window[3], mem, pc+4, count);
+    }
+    return true;
+}
+
+uint8_t vm_unfused(uint8_t op)
+{
+    switch(op)
+    {
+    case DOP_LIT_OUTCHAR_LIT_OUTCHAR:
+    case DOP_LIT_STO:
+        return DOP_LIT;
+    default:
+        return (op >= DOP_FUSED) ? DOP_LOD : op;
+    }
+}
+
+static const char * const dopnames[DOP_COUNT] =
+{
+    "LIT", "LOD", "STO", "CAL", "INT", "JMP", "JPC", "LODX", "STOX", "HALT",
+    "RET", "NEG", "ADD", "SUB", "MUL", "DIV", "ODD", "NOP",
+    "EQ", "NEQ", "LESS", "LEQ", "GREATER", "GEQ",
+    "SHR", "SHL", "SAR", "OUTCHAR", "OUTINT", "INCHAR", "ININT", "BAD",
+    "LOD+LIT+ADD+STO", "LIT+OUTCHAR+LIT+OUTCHAR", "LIT+STO", "LOD+STO",
+    "LOD+ADD", "LOD+SUB", "LOD+MUL", "LOD+DIV",
+    "LOD+LOD+ADD", "LOD+LOD+SUB", "LOD+LOD+MUL", "LOD+LOD+DIV",
+    "LOD+EQ+JPC", "LOD+NEQ+JPC", "LOD+LESS+JPC",
+    "LOD+LEQ+JPC", "LOD+GREATER+JPC", "LOD+GEQ+JPC",
+    "LOD+LOD+EQ+JPC", "LOD+LOD+NEQ+JPC", "LOD+LOD+LESS+JPC",
+    "LOD+LOD+LEQ+JPC", "LOD+LOD+GREATER+JPC", "LOD+LOD+GEQ+JPC",
+    "LOD+LIT+EQ+JPC", "LOD+LIT+NEQ+JPC", "LOD+LIT+LESS+JPC",
+    "LOD+LIT+LEQ+JPC", "LOD+LIT+GREATER+JPC", "LOD+LIT+GEQ+JPC"
+};
+
+const char* vm_dopname(uint8_t op)
+{
+    return (op < DOP_COUNT) ? dopnames[op] : "???";
+}
+
+// superinstructions don't write the scratch cells of
+// the sequence they replace, only their net effect counts.
+#define EFFECT_ARITH(x)     [x] = {2, 1}
+#define EFFECT_FUSEDCMP(x)  [DOP_LOD_##x##_JPC] = {1, 0}
+
+const vm_effect_t vm_effect[DOP_COUNT] =
+{
+    [DOP_LIT]   = {0, 1},
+    [DOP_LOD]   = {0, 1},
+    [DOP_STO]   = {1, 0},
+    [DOP_CAL]   = {0, 3},       // frame header of the callee
+    [DOP_LODX]  = {1, 1},
+    [DOP_STOX]  = {2, 0},
+    [DOP_JPC]   = {1, 0},
+    [DOP_NEG]   = {1, 1},
+    [DOP_ODD]   = {1, 1},
+    [DOP_SHR]   = {1, 1},
+    [DOP_SHL]   = {1, 1},
+    [DOP_SAR]   = {1, 1},
+    EFFECT_ARITH(DOP_ADD),
+    EFFECT_ARITH(DOP_SUB),
+    EFFECT_ARITH(DOP_MUL),
+    EFFECT_ARITH(DOP_DIV),
+    EFFECT_ARITH(DOP_EQ),
+    EFFECT_ARITH(DOP_NEQ),
+    EFFECT_ARITH(DOP_LESS),
+    EFFECT_ARITH(DOP_LEQ),
+    EFFECT_ARITH(DOP_GREATER),
+    EFFECT_ARITH(DOP_GEQ),
+    [DOP_OUTCHAR] = {1, 0},
+    [DOP_OUTINT]  = {1, 0},
+    [DOP_INCHAR]  = {0, 1},
+    [DOP_ININT]   = {0, 1},
+    [DOP_LOD_ADD] = {1, 1},
+    [DOP_LOD_SUB] = {1, 1},
+    [DOP_LOD_MUL] = {1, 1},
+    [DOP_LOD_DIV] = {1, 1},
+    [DOP_LOD_LOD_ADD] = {0, 1},
+    [DOP_LOD_LOD_SUB] = {0, 1},
+    [DOP_LOD_LOD_MUL] = {0, 1},
+    [DOP_LOD_LOD_DIV] = {0, 1},
+    EFFECT_FUSEDCMP(EQ),
+    EFFECT_FUSEDCMP(NEQ),
+    EFFECT_FUSEDCMP(LESS),
+    EFFECT_FUSEDCMP(LEQ),
+    EFFECT_FUSEDCMP(GREATER),
+    EFFECT_FUSEDCMP(GEQ)
+    // all others: {0, 0}
+};
@@ -0,0 +1,554 @@
+/*
+
+    Stock host interfaces: memory buffers, input queues,
+    file descriptors, and recording and replaying input
+
+    Input past the end returns 0, as the stdio host does.
+    None of them prints the "> " prompt of the console.
+
+*/
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "vm.h"
+#include "hostio.h"
+
+/*
+    memory host
+*/
+
+static void memPut(vm_memio_t *m, const char *s, size_t len)
+{
+    if (m->outlen + len > m->outcap)
+    {
+        size_t cap = (m->outcap == 0) ? 256 : m->outcap;
+        while(cap < m->outlen + len)
+            cap *= 2;
+
+        char *out = realloc(m->out, cap);
+        if (out == NULL)
+            return;
+        m->out    = out;
+        m->outcap = cap;
+    }
+    memcpy(m->out + m->outlen, s, len);
+    m->outlen += len;
+}
+
+static int16_t memReadInt(void *user)
+{
+    vm_memio_t *m = user;
+    const char *p = m->in + m->inpos;
+    int16_t v;
+    m->inpos = vm_parseint(p, m->in + m->inlen, &v) - m->in;
+    return v;
+}
+
+static int16_t memReadChar(void *user)
+{
+    vm_memio_t *m = user;
+    return (m->inpos < m->inlen) ? m->in[m->inpos++] : 0;
+}
+
+static void memWriteInt(void *user, int16_t v)
+{
+    char d[8];
+    char *p = vm_formatint(d + sizeof(d), v);
+    memPut(user, p, d + sizeof(d) - p);
+}
+
+static void memWriteChar(void *user, int16_t v)
+{
+    char ch = (char)v;
+    memPut(user, &ch, 1);
+}
+
+void vm_host_memory(vm_host_t *h, vm_memio_t *m, const char *in, size_t inlen)
+{
+    m->in     = in;
+    m->inlen  = (in != NULL) ? inlen : 0;
+    m->inpos  = 0;
+    m->out    = NULL;
+    m->outlen = 0;
+    m->outcap = 0;
+
+    h->readInt   = memReadInt;
+    h->readChar  = memReadChar;
+    h->writeInt  = memWriteInt;
+    h->writeChar = memWriteChar;
+    h->user      = m;
+    h->ready     = NULL;
+}
+
+void vm_memio_free(vm_memio_t *m)
+{
+    free(m->out);
+    m->out    = NULL;
+    m->outlen = 0;
+    m->outcap = 0;
+}
+
+/*
+    queue host
+*/
+
+static void queueLock(vm_queueio_t *q)
+{
+    pthread_mutex_lock(&q->lock);
+}
+
+static void queueUnlock(vm_queueio_t *q)
+{
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int16_t queueReadInt(void *user)
+{
+    vm_queueio_t *q = user;
+    queueLock(q);
+    const char *p = q->in + q->inpos;
+    int16_t v;
+    q->inpos = vm_parseint(p, q->in + q->inlen, &v) - q->in;
+    queueUnlock(q);
+    return v;
+}
+
+static int16_t queueReadChar(void *user)
+{
+    vm_queueio_t *q = user;
+    queueLock(q);
+    int16_t v = (q->inpos < q->inlen) ? q->in[q->inpos++] : 0;
+    queueUnlock(q);
+    return v;
+}
+
+static void queueWriteInt(void *user, int16_t v)
+{
+    vm_queueio_t *q = user;
+    memWriteInt(&q->out, v);
+}
+
+static void queueWriteChar(void *user, int16_t v)
+{
+    vm_queueio_t *q = user;
+    memWriteChar(&q->out, v);
+}
+
+static bool isspacec(char c)
+{
+    return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+static bool isdigitc(char c)
+{
+    return (c >= '0') && (c <= '9');
+}
+
+// a number is complete once something follows its digits,
+// so that input fed in pieces is not read half
+static bool queueReady(void *user, bool number)
+{
+    vm_queueio_t *q = user;
+    queueLock(q);
+    bool ready = q->closed;
+    if (!ready && !number)
+    {
+        ready = q->inpos < q->inlen;
+    }
+    else if (!ready)
+    {
+        size_t j = q->inpos;
+        while((j < q->inlen) && isspacec(q->in[j]))
+            j++;
+        if ((j < q->inlen) && ((q->in[j] == '-') || (q->in[j] == '+')))
+            j++;
+        while((j < q->inlen) && isdigitc(q->in[j]))
+            j++;
+        ready = j < q->inlen;
+    }
+    queueUnlock(q);
+    return ready;
+}
+
+void vm_host_queue(vm_host_t *h, vm_queueio_t *q)
+{
+    pthread_mutex_init(&q->lock, NULL);
+    q->in     = NULL;
+    q->inlen  = 0;
+    q->inpos  = 0;
+    q->incap  = 0;
+    q->closed = false;
+    vm_host_memory(h, &q->out, NULL, 0);
+
+    h->readInt   = queueReadInt;
+    h->readChar  = queueReadChar;
+    h->writeInt  = queueWriteInt;
+    h->writeChar = queueWriteChar;
+    h->user      = q;
+    h->ready     = queueReady;
+}
+
+void vm_queueio_free(vm_queueio_t *q)
+{
+    free(q->in);
+    q->in    = NULL;
+    q->inlen = 0;
+    q->inpos = 0;
+    q->incap = 0;
+    vm_memio_free(&q->out);
+    pthread_mutex_destroy(&q->lock);
+}
+
+bool vm_queueio_feed(vm_queueio_t *q, const char *p, size_t len)
+{
+    bool ok = true;
+    queueLock(q);
+
+    // drop what was read before growing
+    if ((q->inpos > 0) && (q->inlen + len > q->incap))
+    {
+        memmove(q->in, q->in + q->inpos, q->inlen - q->inpos);
+        q->inlen -= q->inpos;
+        q->inpos  = 0;
+    }
+    if (q->inlen + len > q->incap)
+    {
+        size_t cap = (q->incap == 0) ? 256 : q->incap;
+        while(cap < q->inlen + len)
+            cap *= 2;
+
+        char *in = realloc(q->in, cap);
+        if (in == NULL)
+            ok = false;
+        else
+        {
+            q->in    = in;
+            q->incap = cap;
+        }
+    }
+    if (ok)
+    {
+        memcpy(q->in + q->inlen, p, len);
+        q->inlen += len;
+    }
+
+    queueUnlock(q);
+    return ok;
+}
+
+void vm_queueio_close(vm_queueio_t *q)
+{
+    queueLock(q);
+    q->closed = true;
+    queueUnlock(q);
+}
+
+/*
+    file descriptor host
+*/
+
+void vm_fdio_flush(vm_fdio_t *f)
+{
+    size_t done = 0;
+    while((done < f->outlen) && !f->error)
+    {
+        ssize_t w = write(f->outfd, f->outbuf + done, f->outlen - done);
+        if (w > 0)
+            done += w;
+        else if ((w < 0) && (errno != EINTR))
+            f->error = true;
+    }
+    f->outlen = 0;
+}
+
+static void fdPut(vm_fdio_t *f, const char *s, size_t len)
+{
+    if (f->outlen + len > VM_FDIO_BUFSIZE)
+    {
+        vm_fdio_flush(f);
+    }
+    memcpy(f->outbuf + f->outlen, s, len);
+    f->outlen += len;
+}
+
+// move the unread input to the front of inbuf and read
+// more behind it. returns false at end of input or if
+// the buffer is full.
+static bool fdFill(vm_fdio_t *f)
+{
+    vm_fdio_flush(f);
+
+    if (f->inpos > 0)
+    {
+        memmove(f->inbuf, f->inbuf + f->inpos, f->inlen - f->inpos);
+        f->inlen -= f->inpos;
+        f->inpos  = 0;
+    }
+
+    while(f->inlen < VM_FDIO_BUFSIZE)
+    {
+        ssize_t r = read(f->infd, f->inbuf + f->inlen, VM_FDIO_BUFSIZE - f->inlen);
+        if (r > 0)
+        {
+            f->inlen += r;
+            return true;
+        }
+        if ((r == 0) || (errno != EINTR))
+            return false;
+    }
+    return false;
+}
+
+static int16_t fdReadInt(void *user)
+{
+    vm_fdio_t *f = user;
+
+    // skip white space, then make sure the whole number
+    // is buffered before handing it to vm_parseint().
+    while(1)
+    {
+        while((f->inpos < f->inlen) &&
+            ((f->inbuf[f->inpos] == ' ') ||
+             ((f->inbuf[f->inpos] >= '\t') && (f->inbuf[f->inpos] <= '\r'))))
+        {
+            f->inpos++;
+        }
+        if ((f->inpos < f->inlen) || !fdFill(f))
+            break;
+    }
+
+    while(1)
+    {
+        size_t j = f->inpos;
+        if ((j < f->inlen) && ((f->inbuf[j] == '-') || (f->inbuf[j] == '+')))
+            j++;
+        while((j < f->inlen) && isdigitc(f->inbuf[j]))
+            j++;
+        if ((j < f->inlen) || !fdFill(f))
+            break;
+    }
+
+    int16_t v;
+    const char *p = f->inbuf + f->inpos;
+    f->inpos = vm_parseint(p, f->inbuf + f->inlen, &v) - f->inbuf;
+    return v;
+}
+
+static int16_t fdReadChar(void *user)
+{
+    vm_fdio_t *f = user;
+    if ((f->inpos == f->inlen) && !fdFill(f))
+        return 0;
+    return f->inbuf[f->inpos++];
+}
+
+static void fdWriteInt(void *user, int16_t v)
+{
+    char d[8];
+    char *p = vm_formatint(d + sizeof(d), v);
+    fdPut(user, p, d + sizeof(d) - p);
+}
+
+static void fdWriteChar(void *user, int16_t v)
+{
+    char ch = (char)v;
+    fdPut(user, &ch, 1);
+}
+
+void vm_host_fd(vm_host_t *h, vm_fdio_t *f, int infd, int outfd)
+{
+    f->infd   = infd;
+    f->outfd  = outfd;
+    f->inpos  = 0;
+    f->inlen  = 0;
+    f->outlen = 0;
+    f->error  = false;
+
+    h->readInt   = fdReadInt;
+    h->readChar  = fdReadChar;
+    h->writeInt  = fdWriteInt;
+    h->writeChar = fdWriteChar;
+    h->user      = f;
+    h->ready     = NULL;
+}
+
+/*
+    record host
+*/
+
+static int16_t recordRead(vm_recordio_t *r, char kind, int16_t v)
+{
+    fprintf(r->log, "%zu %c %d\n", *r->inscount, kind, v);
+    r->n++;
+    return v;
+}
+
+static int16_t recordReadInt(void *user)
+{
+    vm_recordio_t *r = user;
+    return recordRead(r, 'i', r->inner.readInt(r->inner.user));
+}
+
+static int16_t recordReadChar(void *user)
+{
+    vm_recordio_t *r = user;
+    return recordRead(r, 'c', r->inner.readChar(r->inner.user));
+}
+
+static void recordWriteInt(void *user, int16_t v)
+{
+    vm_recordio_t *r = user;
+    r->inner.writeInt(r->inner.user, v);
+}
+
+static void recordWriteChar(void *user, int16_t v)
+{
+    vm_recordio_t *r = user;
+    r->inner.writeChar(r->inner.user, v);
+}
+
+static bool recordReady(void *user, bool number)
+{
+    vm_recordio_t *r = user;
+    return r->inner.ready(r->inner.user, number);
+}
+
+void vm_host_record(vm_host_t *h, vm_recordio_t *r, const vm_host_t *inner,
+    const size_t *inscount, FILE *log)
+{
+    r->inner    = *inner;
+    r->inscount = inscount;
+    r->log      = log;
+    r->n        = 0;
+    fprintf(log, "# p-code input log: <instruction> i|c <value>\n");
+
+    h->readInt   = recordReadInt;
+    h->readChar  = recordReadChar;
+    h->writeInt  = recordWriteInt;
+    h->writeChar = recordWriteChar;
+    h->user      = r;
+    h->ready     = (inner->ready != NULL) ? recordReady : NULL;
+}
+
+/*
+    replay host
+*/
+
+static int16_t replayRead(vm_replayio_t *r, char kind)
+{
+    if (r->pos == r->nrecs)
+    {
+        r->overrun++;
+        return 0;
+    }
+
+    const vm_inputrec_t *rec = &r->recs[r->pos];
+    if ((r->diverged == SIZE_MAX) && ((rec->kind != kind) ||
+        ((r->inscount != NULL) && (rec->inscount != *r->inscount))))
+    {
+        r->diverged   = r->pos;
+        r->divergedat = (r->inscount != NULL) ? *r->inscount : 0;
+        r->divergedkind = kind;
+    }
+    r->pos++;
+    return rec->value;
+}
+
+static int16_t replayReadInt(void *user)
+{
+    return replayRead(user, 'i');
+}
+
+static int16_t replayReadChar(void *user)
+{
+    return replayRead(user, 'c');
+}
+
+static void replayWriteInt(void *user, int16_t v)
+{
+    vm_replayio_t *r = user;
+    r->inner.writeInt(r->inner.user, v);
+}
+
+static void replayWriteChar(void *user, int16_t v)
+{
+    vm_replayio_t *r = user;
+    r->inner.writeChar(r->inner.user, v);
+}
+
+size_t vm_replayio_load(vm_replayio_t *r, const char *fname)
+{
+    memset(r, 0, sizeof(vm_replayio_t));
+    r->diverged = SIZE_MAX;
+
+    FILE *f = fopen(fname, "rt");
+    if (f == NULL)
+        return SIZE_MAX;
+
+    size_t cap  = 0;
+    size_t line = 0;
+    size_t bad  = 0;
+    char   buf[128];
+    while((bad == 0) && (fgets(buf, sizeof(buf), f) != NULL))
+    {
+        line++;
+        size_t ins;
+        char kind;
+        int  v;
+        if ((buf[0] == '#') || (strspn(buf, " \t\r\n") == strlen(buf)))
+            continue;
+        if ((sscanf(buf, "%zu %c %d", &ins, &kind, &v) != 3) ||
+            ((kind != 'i') && (kind != 'c')) || (v < INT16_MIN) || (v > INT16_MAX))
+        {
+            bad = line;
+            break;
+        }
+
+        if (r->nrecs == cap)
+        {
+            cap = (cap == 0) ? 64 : 2*cap;
+            vm_inputrec_t *recs = realloc(r->recs, cap*sizeof(vm_inputrec_t));
+            if (recs == NULL)
+            {
+                bad = SIZE_MAX;
+                break;
+            }
+            r->recs = recs;
+        }
+        r->recs[r->nrecs].inscount = ins;
+        r->recs[r->nrecs].kind     = kind;
+        r->recs[r->nrecs].value    = (int16_t)v;
+        r->nrecs++;
+    }
+    fclose(f);
+    return bad;
+}
+
+void vm_replayio_free(vm_replayio_t *r)
+{
+    free(r->recs);
+    r->recs  = NULL;
+    r->nrecs = 0;
+}
+
+void vm_host_replay(vm_host_t *h, vm_replayio_t *r, const vm_host_t *out,
+    const size_t *inscount)
+{
+    r->inner      = *out;
+    r->inscount   = inscount;
+    r->pos        = 0;
+    r->diverged   = SIZE_MAX;
+    r->divergedat = 0;
+    r->divergedkind = 0;
+    r->overrun    = 0;
+
+    h->readInt   = replayReadInt;
+    h->readChar  = replayReadChar;
+    h->writeInt  = replayWriteInt;
+    h->writeChar = replayWriteChar;
+    h->user      = r;
+    h->ready     = NULL;
+}
@@ -0,0 +1,132 @@
+/*
+
+    Stock host interfaces for embedding the p-code virtual machine
+
+    Each host keeps its state in the struct passed as
+    vm_host_t.user, so any number of VM instances can run
+    side by side, each with its own host.
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "opcodes.h"
+
+#define VM_FDIO_BUFSIZE 4096
+
+/** input from and output to memory */
+typedef struct
+{
+    const char *in;     ///< input text, not owned
+    size_t  inlen;
+    size_t  inpos;
+    char    *out;       ///< output, grows as needed, NULL until written
+    size_t  outlen;
+    size_t  outcap;
+} vm_memio_t;
+
+/** set up h to read from in[0..inlen) and write into m->out */
+void vm_host_memory(vm_host_t *h, vm_memio_t *m, const char *in, size_t inlen);
+
+/** free the output of a memory host */
+void vm_memio_free(vm_memio_t *m);
+
+/** input that arrives while the program runs, output to memory.
+    The host reports input as not ready (vm_host_t.ready) until
+    it is fed or closed, so vm_run() stops instead of blocking. */
+typedef struct
+{
+    pthread_mutex_t lock;   ///< input is fed from other threads
+    char    *in;            ///< owned, grows as needed
+    size_t  inlen;
+    size_t  inpos;
+    size_t  incap;
+    bool    closed;         ///< no more input, reads past the end return 0
+    vm_memio_t out;         ///< output, only written by the VM
+} vm_queueio_t;
+
+void vm_host_queue(vm_host_t *h, vm_queueio_t *q);
+void vm_queueio_free(vm_queueio_t *q);
+
+/** append input, returns false if there is no memory. Any thread. */
+bool vm_queueio_feed(vm_queueio_t *q, const char *p, size_t len);
+
+/** mark the end of the input. Any thread. */
+void vm_queueio_close(vm_queueio_t *q);
+
+/** buffered input from and output to file descriptors */
+typedef struct
+{
+    int     infd;
+    int     outfd;
+    size_t  inpos;
+    size_t  inlen;
+    size_t  outlen;
+    bool    error;      ///< a write failed, further output is dropped
+    char    inbuf[VM_FDIO_BUFSIZE];
+    char    outbuf[VM_FDIO_BUFSIZE];
+} vm_fdio_t;
+
+/** set up h to read from infd and write to outfd.
+    Output is flushed when the buffer is full and before input. */
+void vm_host_fd(vm_host_t *h, vm_fdio_t *f, int infd, int outfd);
+
+/** write buffered output of a file descriptor host */
+void vm_fdio_flush(vm_fdio_t *f);
+
+/** records the input of another host and the instruction count
+    at which the program read it (vm --record). The log is text,
+    after a '#' comment line one line per input:
+
+        <instruction> i|c <value>
+
+    i for OPR_ININT, c for OPR_INCHAR, the value as a number.
+    The count is only kept up to date by engines that count
+    (VM_POLICY_COUNT, or a JIT with counting on). */
+typedef struct
+{
+    vm_host_t inner;            ///< does the actual I/O
+    const size_t *inscount;     ///< &vm_context_t.inscount
+    FILE    *log;               ///< not owned
+    size_t  n;                  ///< inputs recorded
+} vm_recordio_t;
+
+/** set up h to pass everything on to inner and log the input */
+void vm_host_record(vm_host_t *h, vm_recordio_t *r, const vm_host_t *inner,
+    const size_t *inscount, FILE *log);
+
+typedef struct
+{
+    size_t  inscount;
+    int16_t value;
+    char    kind;       ///< 'i' or 'c'
+} vm_inputrec_t;
+
+/** feeds the input of a vm --record log back, without reading
+    anything, and writes the output to another host. Reads that
+    do not match the log, in kind or instruction count, mark the
+    run as diverged but still get the next value of the log. */
+typedef struct
+{
+    vm_host_t inner;            ///< output goes here, its input is not used
+    const size_t *inscount;     ///< NULL: the counts are not compared
+    vm_inputrec_t *recs;        ///< owned
+    size_t  nrecs;
+    size_t  pos;                ///< next input
+    size_t  diverged;           ///< first input that did not match, or SIZE_MAX
+    size_t  divergedat;         ///< instruction count of that read
+    char    divergedkind;       ///< and what it read, 'i' or 'c'
+    size_t  overrun;            ///< reads past the end of the log, these return 0
+} vm_replayio_t;
+
+/** read a log, returns 0 or the number of the first malformed line
+    (SIZE_MAX if the file cannot be read or there is no memory) */
+size_t vm_replayio_load(vm_replayio_t *r, const char *fname);
+void vm_replayio_free(vm_replayio_t *r);
+
+/** set up h to replay r, which vm_replayio_load() has filled */
+void vm_host_replay(vm_host_t *h, vm_replayio_t *r, const vm_host_t *out,
+    const size_t *inscount);
@@ -0,0 +1,135 @@
+/*
+
+    Program images: mapping and checking the sections
+
+*/
+
+#include <string.h>
+#include "vm.h"
+#include "imagefile.h"
+
+static void raw(vm_image_t *img)
+{
+    size_t len = img->file.len;
+    img->code      = (uint8_t*)img->file.data;
+    img->codebytes = (len < UINT16_MAX) ? len : UINT16_MAX;
+}
+
+// check s against the file, false if it is malformed
+static bool section(vm_image_t *img, const vm_section_t *s, uint32_t *seen)
+{
+    if (((s->offset % VM_IMAGE_ALIGN) != 0) ||
+        ((uint64_t)s->offset + s->size > img->file.len))
+    {
+        return false;
+    }
+    if (s->type < 32)
+    {
+        if (*seen & (1u << s->type))
+            return false;   // one of each
+        *seen |= 1u << s->type;
+    }
+
+    const uint8_t *p = img->file.data + s->offset;
+    switch(s->type)
+    {
+    case VM_SECTION_CODE:
+        if (s->size > UINT16_MAX)
+            return false;
+        img->code      = (uint8_t*)p;
+        img->codebytes = s->size;
+        break;
+    case VM_SECTION_DATA:
+        if (((s->size % sizeof(int16_t)) != 0) || (s->size/sizeof(int16_t) > VM_STACKMAX - 4))
+            return false;
+        img->data  = (const int16_t*)p;
+        img->ndata = s->size / sizeof(int16_t);
+        break;
+    case VM_SECTION_SYMBOLS:
+        img->symbols    = (const char*)p;
+        img->symbolslen = s->size;
+        break;
+    case VM_SECTION_LINES:
+        if ((s->size % sizeof(vm_lineentry_t)) != 0)
+            return false;
+        img->lines  = (const vm_lineentry_t*)p;
+        img->nlines = s->size / sizeof(vm_lineentry_t);
+        break;
+    case VM_SECTION_DECODED:
+        // checked against the code by vm_init_decoded()
+        if (s->info == VM_DECODED_ABI)
+            img->decoded = (const vm_dins_t*)p;
+        break;
+    default:
+        break;      // newer section type
+    }
+    return true;
+}
+
+bool vm_image_open(vm_image_t *img, const char *fname)
+{
+    memset(img, 0, sizeof(vm_image_t));
+    if (!vm_map_open(&img->file, fname))
+        return false;
+
+    const vm_imageheader_t *h = (const vm_imageheader_t*)img->file.data;
+    if ((img->file.len < sizeof(vm_imageheader_t)) ||
+        (memcmp(h->magic, VM_IMAGE_MAGIC, 4) != 0))
+    {
+        raw(img);
+        return true;
+    }
+
+    const vm_section_t *table = (const vm_section_t*)(h + 1);
+    bool ok = (h->version == VM_IMAGE_VERSION) &&
+        (sizeof(vm_imageheader_t) + (uint64_t)h->nsections*sizeof(vm_section_t) <= img->file.len);
+
+    uint32_t seen = 0;
+    for(uint16_t i=0; ok && (i<h->nsections); i++)
+    {
+        ok = section(img, &table[i], &seen);
+    }
+
+    // the decoded program has an entry per instruction and the sentinel
+    uint16_t count = img->codebytes / sizeof(instruction_t);
+    for(uint16_t i=0; ok && (i<h->nsections); i++)
+    {
+        if ((table[i].type == VM_SECTION_DECODED) && (table[i].size != (count+1u)*sizeof(vm_dins_t)))
+            img->decoded = NULL;
+    }
+
+    ok = ok && (img->code != NULL) && ((h->entry < count) || (h->entry == 0));
+    if (!ok)
+    {
+        vm_map_close(&img->file);
+        memset(img, 0, sizeof(vm_image_t));
+        return false;
+    }
+
+    img->hdr        = h;
+    img->entry      = h->entry;
+    img->stackcells = h->stackcells;
+    return true;
+}
+
+void vm_image_close(vm_image_t *img)
+{
+    vm_map_close(&img->file);
+    memset(img, 0, sizeof(vm_image_t));
+}
+
+uint32_t vm_image_line(const vm_image_t *img, uint16_t pc)
+{
+    // last entry at or before pc
+    uint32_t lo = 0;
+    uint32_t hi = img->nlines;
+    while(lo < hi)
+    {
+        uint32_t mid = (lo + hi) / 2;
+        if (img->lines[mid].pc <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo > 0) ? img->lines[lo-1].line : 0;
+}
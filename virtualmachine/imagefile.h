@@ -0,0 +1,40 @@
+/*
+
+    Reading program images, see common/image.h
+
+    The file is mapped (vm_map_open()) and every section is
+    used in place. Raw images, without a header, read as a
+    code section at entry 0.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include "image.h"
+#include "mapfile.h"
+
+typedef struct
+{
+    vm_mapfile_t file;
+    const vm_imageheader_t *hdr;    ///< NULL for a raw image
+    uint8_t  *code;             ///< packed program, for vm_init()
+    uint16_t codebytes;
+    uint16_t entry;
+    uint32_t stackcells;        ///< from the header, 0 if unknown
+    const int16_t *data;        ///< initial variables, or NULL
+    uint16_t ndata;
+    const char *symbols;        ///< label table text, or NULL
+    size_t   symbolslen;
+    const vm_lineentry_t *lines;    ///< or NULL
+    uint32_t nlines;
+    const vm_dins_t *decoded;   ///< NULL if missing or of another decoder
+} vm_image_t;
+
+/** map and check fname, returns false if it cannot be read or
+    has the magic of an image but is not a valid one */
+bool vm_image_open(vm_image_t *img, const char *fname);
+void vm_image_close(vm_image_t *img);
+
+/** source line of the instruction at pc, 0 if unknown */
+uint32_t vm_image_line(const vm_image_t *img, uint16_t pc);
@@ -0,0 +1,207 @@
+/*
+
+    Whole-program x86-64 JIT for the p-code virtual machine
+
+    Every instruction is translated to a fixed template that
+    works on dstack in memory, with t, b and the dstack base
+    held in registers (see x64emit.h). Within a basic block
+    the top of stack is kept in a register; it is written
+    back before every jump target and control transfer. Jumps and calls are
+    direct; RET and the entry go through a table holding the
+    native address of every pc, since return addresses on the
+    stack stay p-code addresses. That keeps the frame layout
+    identical to the interpreter.
+
+*/
+
+#include <stdlib.h>
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include "vm.h"
+#include "x64emit.h"
+
+typedef struct
+{
+    size_t      at;     // offset of the rel32
+    uint16_t    pc;     // target pc
+} fixup_t;
+
+bool vm_jit_compile(vm_jit_t *jit, const vm_context_t *c, bool count)
+{
+    uint16_t  count1  = c->codelen + 1;    // including the DOP_BAD sentinel
+    size_t   *offsets = malloc(count1*sizeof(size_t));
+    fixup_t  *fixups  = malloc(count1*sizeof(fixup_t));
+    uint16_t  nfixups = 0;
+    x64_buf_t x;
+
+    jit->table = malloc(count1*sizeof(void*));
+    bool *label = calloc(count1, sizeof(bool));
+    x64_init(&x);
+    if ((offsets == NULL) || (fixups == NULL) || (jit->table == NULL) || (label == NULL))
+        x.failed = true;
+
+    // entry: jump to table[c->pc]
+    x64_prologue(&x, jit->table);
+    x64_rm_mem(&x, false, false, 0x0FB7, X64_RAX, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, pc));
+    x64_rm_reg(&x, false, false, 0x81, 7, X64_RAX);       // cmp eax, codelen
+    x64_emit32(&x, c->codelen);
+    size_t entrybad = x64_jump(&x, X64_CC_A);
+    x64_rm_mem(&x, false, false, 0xFF, 4, X64_RBP, X64_RAX, 8, 0); // jmp [rbp + rax*8]
+
+    // exits: badofs with a pc past the program in eax, which
+    // stops as the DOP_BAD sentinel would; exitofs with the pc
+    // in eax and the stop code in edx
+    size_t badofs = x.len;
+    x64_patch(&x, entrybad, badofs);
+    x64_emit8(&x, 0xBA);                                    // mov edx, VM_STOP_BAD
+    x64_emit32(&x, VM_STOP_BAD);
+    size_t exitofs = x.len;
+    x64_epilogue(&x, count);
+
+    // instructions that can be entered from elsewhere start
+    // with the top of stack in memory
+    for(uint16_t pc=0; !x.failed && (pc<c->codelen); pc++)
+    {
+        uint8_t op = vm_unfused(c->code[pc].op);
+        if ((op == DOP_JMP) || (op == DOP_JPC) || (op == DOP_CAL))
+            label[c->code[pc].a] = true;
+        if (op == DOP_CAL)
+            label[pc+1] = true;
+    }
+
+    if (!x.failed)
+        label[c->pc < count1 ? c->pc : c->codelen] = true;
+    for(uint16_t pc=0; !x.failed && (pc<count1); pc++)
+    {
+        const vm_dins_t *ins = &c->code[pc];
+        if (label[pc])
+        {
+            x64_flush(&x);
+        }
+        offsets[pc] = x.len;
+
+        if (count)
+        {
+            x64_rm_reg(&x, false, true, 0xFF, 0, X64_R14);     // inc r14
+        }
+
+        if (x64_straight(&x, ins))
+            continue;
+
+        switch(vm_unfused(ins->op))
+        {
+        case DOP_JMP:
+            x64_flush(&x);
+            fixups[nfixups].pc = ins->a;
+            fixups[nfixups++].at = x64_jump(&x, -1);
+            break;
+        case DOP_JPC:
+            x64_tos(&x);
+            x.tos = false;
+            x64_rm_reg(&x, false, true, 0xFF, 1, X64_R12);     // dec r12
+            x64_rm_reg(&x, true, false, 0x85, X64_RCX, X64_RCX);   // test cx, cx
+            fixups[nfixups].pc = ins->a;
+            fixups[nfixups++].at = x64_jump(&x, X64_CC_E);
+            break;
+        case DOP_CAL:
+            x64_flush(&x);
+            x64_base(&x, ins->level);
+            x64_rm_mem(&x, true, false, 0x89, X64_RAX, X64_RBX, X64_R12, 2, 2);
+            x64_rm_mem(&x, true, false, 0x89, X64_R13, X64_RBX, X64_R12, 2, 4);
+            x64_rm_mem(&x, true, false, 0xC7, 0, X64_RBX, X64_R12, 2, 6);  // return address
+            x64_emit8(&x, (pc+1) & 0xFF);
+            x64_emit8(&x, (pc+1) >> 8);
+            x64_rm_mem(&x, false, true, 0x8D, X64_R13, X64_R12, X64_NOINDEX, 1, 1);  // lea r13, [r12+1]
+            fixups[nfixups].pc = ins->a;
+            fixups[nfixups++].at = x64_jump(&x, -1);
+            break;
+        case DOP_RET:
+        {
+            x.tos = false;
+            x64_rm_mem(&x, false, true, 0x8D, X64_R12, X64_R13, X64_NOINDEX, 1, -1); // lea r12, [r13-1]
+            x64_rm_mem(&x, false, false, 0x0FB7, X64_RAX, X64_RBX, X64_R12, 2, 6);
+            x64_rm_mem(&x, false, false, 0x0FB7, X64_R13, X64_RBX, X64_R12, 2, 4);
+            x64_rm_reg(&x, false, false, 0x81, 7, X64_RAX);   // cmp eax, codelen
+            x64_emit32(&x, c->codelen);
+            x64_patch(&x, x64_jump(&x, X64_CC_A), badofs);
+            x64_rm_mem(&x, false, false, 0xFF, 4, X64_RBP, X64_RAX, 8, 0);
+        }
+            break;
+        default:
+            // HALT and illegal opcodes stop with pc past the instruction
+            x64_flush(&x);
+            x64_emit8(&x, 0xB8);                                // mov eax, pc+1
+            x64_emit32(&x, pc+1);
+            x64_emit8(&x, 0xBA);                                // mov edx, stop
+            x64_emit32(&x, (vm_unfused(ins->op) == DOP_HALT) ? VM_STOP_HALT : VM_STOP_BAD);
+            x64_patch(&x, x64_jump(&x, -1), exitofs);
+            break;
+        }
+    }
+
+    for(uint16_t i=0; !x.failed && (i<nfixups); i++)
+    {
+        x64_patch(&x, fixups[i].at, offsets[fixups[i].pc]);
+    }
+
+    // out of memory anywhere: the caller falls back to the interpreter
+    jit->size = x.len;
+    jit->code = x64_finalize(&x);
+    x64_free(&x);
+    free(fixups);
+    free(label);
+
+    if (jit->code == NULL)
+    {
+        free(offsets);
+        free(jit->table);
+        jit->table = NULL;
+        return false;
+    }
+
+    for(uint16_t pc=0; pc<count1; pc++)
+    {
+        jit->table[pc] = (uint8_t*)jit->code + offsets[pc];
+    }
+    free(offsets);
+
+    jit->entry = (void (*)(vm_context_t*)) jit->code;
+    return true;
+}
+
+void vm_jit_run(vm_jit_t *jit, vm_context_t *c)
+{
+    jit->entry(c);
+}
+
+void vm_jit_free(vm_jit_t *jit)
+{
+    if (jit->code != NULL)
+    {
+        x64_release(jit->code, jit->size);
+    }
+    free(jit->table);
+    jit->code  = NULL;
+    jit->table = NULL;
+}
+
+#else
+
+bool vm_jit_compile(vm_jit_t *jit, const vm_context_t *c, bool count)
+{
+    jit->code  = NULL;
+    jit->table = NULL;
+    return false;
+}
+
+void vm_jit_run(vm_jit_t *jit, vm_context_t *c)
+{
+}
+
+void vm_jit_free(vm_jit_t *jit)
+{
+}
+
+#endif
@@ -0,0 +1,30 @@
+/*
+
+    Whole-program x86-64 JIT for the p-code virtual machine
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include "opcodes.h"
+
+typedef struct
+{
+    void    *code;      ///< executable code
+    size_t  size;       ///< size of the code in bytes
+    void    **table;    ///< native address of each pc, codelen+1 entries
+    void    (*entry)(vm_context_t *c);
+} vm_jit_t;
+
+/** translate the loaded program of c to native code.
+    with count set, the code keeps c->inscount up to date.
+    returns false if the JIT is not available on this host or
+    there is not enough memory. */
+bool vm_jit_compile(vm_jit_t *jit, const vm_context_t *c, bool count);
+
+/** run the translated program from c->pc until it stops; c->stop
+    is VM_STOP_HALT or VM_STOP_BAD, as with the interpreters */
+void vm_jit_run(vm_jit_t *jit, vm_context_t *c);
+
+void vm_jit_free(vm_jit_t *jit);
@@ -12,10 +12,484 @@
 
 #include <stdio.h>
 #include <malloc.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <unistd.h>
 
 #include "vm.h"
+#include "jit.h"
+#include "tracejit.h"
+#include "verify.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "tracebuf.h"
+#include "batch.h"
+#include "hostio.h"
+#include "scheduler.h"
+#include "checkpoint.h"
+#include "imagefile.h"
+#include "target.h"
+
+// the JITs as engines for vm_run_guarded()
+static vm_jit_t  *activejit  = NULL;
+static vm_tjit_t *activetjit = NULL;
+
+static void runjit(vm_context_t *c)
+{
+    vm_jit_run(activejit, c);
+}
+
+static void runtjit(vm_context_t *c)
+{
+    vm_tjit_run(activetjit, c);
+}
+
+// how a --batch job stopped; every vm_stop_t is listed, so
+// the compiler flags a new one
+static const char* batchstop(vm_stop_t stop)
+{
+    switch(stop)
+    {
+    case VM_STOP_HALT:
+        return "halted";
+    case VM_STOP_LIMIT:
+        return "over quota";
+    case VM_STOP_OVERFLOW:
+        return "stack overflow";
+    case VM_STOP_BOUNDS:
+        return "stack access out of bounds";
+    case VM_STOP_BAD:
+        return "illegal instruction";
+    case VM_STOP_BREAK:
+        return "breakpoint";
+    case VM_STOP_INPUT:
+        return "waiting for input";
+    case VM_STOP_HOT:
+        return "hot loop";
+    case VM_STOP_NONE:
+        return "still running";
+    }
+    return "?";
+}
+
+// load symfile, or the labels of the image, or <code>.sym next to fname
+static void loadsyms(vm_symtab_t *syms, const char *symfile, const vm_image_t *image, const char *fname)
+{
+    char symname[1024];
+    if ((symfile == NULL) && (image->symbols != NULL))
+    {
+        vm_sym_parse(syms, image->symbols, image->symbolslen);
+        return;
+    }
+    if ((symfile == NULL) && (fname != NULL))
+    {
+        const char *dot = strrchr(fname, '.');
+        size_t len = ((dot != NULL) && (strchr(dot, '/') == NULL)) ? (size_t)(dot - fname) : strlen(fname);
+        if (len + 5 <= sizeof(symname))
+        {
+            memcpy(symname, fname, len);
+            strcpy(symname + len, ".sym");
+            symfile = symname;
+        }
+    }
+    if ((symfile != NULL) && !vm_sym_load(syms, symfile))
+    {
+        fprintf(stderr, "No label table %s, procedures are named by pc\n", symfile);
+    }
+}
+
+// stops that end the run with an error status
+static bool isfault(vm_stop_t stop)
+{
+    return (stop == VM_STOP_BAD) || (stop == VM_STOP_BOUNDS) || (stop == VM_STOP_OVERFLOW);
+}
+
+/*
+    The profilers and the trace ring: the command line
+    options, and their state from starttools() before the
+    run to finishtools() after it.
+*/
+typedef struct
+{
+    bool        profile;
+    bool        profcycles;
+    const char  *profout;
+    bool        callgraph;
+    const char  *foldout;
+    const char  *symfile;
+    bool        targetcycles;
+    const char  *targetmodel;
+    const char  *ringout;
+    uint32_t    ringsize;
+
+    vm_probes_t     probes;
+    vm_callgraph_t  cg;
+    vm_symtab_t     syms;
+    vm_target_t     model;
+    vm_ring_t       ring;
+} tools_t;
+
+static bool anytool(const tools_t *tl)
+{
+    return tl->profile || tl->callgraph || tl->targetcycles || (tl->ringout != NULL);
+}
+
+// set up the selected tools and add their policies, false on an error.
+// c->probes is set in any case, the tracing JIT needs it.
+static bool starttools(tools_t *tl, vm_context_t *c, const vm_image_t *image, const char *fname,
+    bool jit, bool count, unsigned *policy)
+{
+    memset(&tl->probes, 0, sizeof(tl->probes));
+    c->probes = &tl->probes;
+    vm_sym_init(&tl->syms);
+    tl->model = vm_target_hd6309;
+
+    if (tl->profile)
+    {
+        if (jit || (*policy != 0))
+        {
+            printf("--profile cannot be combined with the JIT, --trace, --check or --break\n");
+            return false;
+        }
+        if (!vm_profile_init(c, tl->profcycles))
+        {
+            printf("Out of memory\n");
+            return false;
+        }
+        *policy |= VM_POLICY_PROFILE;
+    }
+
+    if (tl->callgraph)
+    {
+        if (jit || tl->profile || (*policy & ~VM_POLICY_PROFILE) != 0 || !count)
+        {
+            printf("--callgraph cannot be combined with the JIT, --profile, --trace, --check, --break or --no-count\n");
+            return false;
+        }
+        if (!vm_calls_init(&tl->cg, c))
+        {
+            printf("Out of memory\n");
+            return false;
+        }
+        tl->probes.calls = &tl->cg;
+        *policy |= VM_POLICY_CALLS;
+        loadsyms(&tl->syms, tl->symfile, image, fname);
+    }
+
+    // target cycles: the execution profile for the pcs and
+    // the call graph for the procedures, on unfused code
+    if (tl->targetcycles)
+    {
+        if (jit || tl->profile || tl->callgraph || (*policy != 0) || !count)
+        {
+            printf("--target-cycles cannot be combined with the JIT, the profilers, --trace, --check, --break or --no-count\n");
+            return false;
+        }
+        if ((tl->targetmodel != NULL) && !vm_target_load(&tl->model, tl->targetmodel))
+        {
+            printf("Cannot read target model %s\n", tl->targetmodel);
+            return false;
+        }
+        if (!vm_profile_init(c, false) || !vm_target_init(c, &tl->model) ||
+            !vm_calls_init(&tl->cg, c))
+        {
+            printf("Out of memory\n");
+            return false;
+        }
+        tl->probes.calls = &tl->cg;
+        *policy |= VM_POLICY_PROFILE | VM_POLICY_CALLS | VM_POLICY_TARGET;
+        loadsyms(&tl->syms, tl->symfile, image, fname);
+    }
+
+    if (tl->ringout != NULL)
+    {
+        if (jit || tl->profile || tl->callgraph || (*policy != 0))
+        {
+            printf("--trace-ring cannot be combined with the JIT, the profilers, --trace, --check or --break\n");
+            return false;
+        }
+        if ((tl->ringsize == 0) || !vm_ring_init(&tl->ring, tl->ringsize))
+        {
+            printf("Cannot allocate a trace ring of %u records\n", tl->ringsize);
+            return false;
+        }
+        tl->probes.ring = &tl->ring;
+        *policy |= VM_POLICY_RING;
+        vm_ring_catch(&tl->ring, tl->ringout);
+    }
+    return true;
+}
+
+// report and free the tools after the run
+static void finishtools(tools_t *tl, vm_context_t *c)
+{
+    if (tl->profile)
+    {
+        vm_profile_report(c, stderr);
+        if (!vm_profile_write(c, tl->profout))
+        {
+            printf("Cannot write profile %s\n", tl->profout);
+        }
+        vm_profile_free(c);
+    }
+
+    if (tl->callgraph)
+    {
+        vm_calls_report(&tl->cg, &tl->syms, stderr);
+        if (!vm_calls_folded(&tl->cg, &tl->syms, tl->foldout))
+        {
+            printf("Cannot write folded stacks %s\n", tl->foldout);
+        }
+        vm_calls_free(&tl->cg);
+    }
+
+    if (tl->targetcycles)
+    {
+        vm_calls_target_report(&tl->cg, &tl->syms, stderr);
+        vm_target_report(c, &tl->model, stderr);
+        vm_calls_free(&tl->cg);
+        vm_target_free(c);
+        vm_profile_free(c);
+    }
+    vm_sym_free(&tl->syms);
+
+    if (tl->ringout != NULL)
+    {
+        vm_ring_release();
+        if (!vm_ring_dump(&tl->ring, tl->ringout, c->stop, 0))
+        {
+            printf("Cannot write trace ring %s\n", tl->ringout);
+        }
+        vm_ring_free(&tl->ring);
+    }
+    c->probes = NULL;
+}
+
+// run the program once per input file, returns the number
+// of jobs that failed or stopped on a fault
+static int runbatch(vm_context_t *c, unsigned policy, bool count, const char **inputs, size_t ninputs,
+    unsigned nthreads, const char *batchout, size_t slice, size_t quota)
+{
+    vm_batchjob_t *jobs = calloc(ninputs, sizeof(vm_batchjob_t));
+    if (jobs == NULL)
+    {
+        printf("Out of memory\n");
+        return (int)ninputs;
+    }
+    for(size_t i=0; i<ninputs; i++)
+    {
+        jobs[i].input = inputs[i];
+    }
+    bool sliced = (slice != 0) || (quota != SIZE_MAX);
+    if (sliced)
+        vm_batch_sched(c, jobs, ninputs, nthreads, batchout, (slice != 0) ? slice : VM_SLICE_DEFAULT, quota);
+    else
+        vm_batch_run(c, vm_engine(policy), jobs, ninputs, nthreads, batchout);
+
+    int failed = 0;
+    uint64_t maxdelay = 0;
+    for(size_t i=0; i<ninputs; i++)
+    {
+        if (!jobs[i].ok)
+        {
+            printf("%s: cannot read the input or write %s\n", jobs[i].input,
+                (jobs[i].output != NULL) ? jobs[i].output : "the output");
+            failed++;
+            continue;
+        }
+        if (isfault((vm_stop_t)jobs[i].stop))
+            failed++;
+        printf("%s: %s", jobs[i].input, batchstop((vm_stop_t)jobs[i].stop));
+        if (count || sliced)
+            printf(", %lu instructions", jobs[i].inscount);
+        if (sliced)
+            printf(" in %lu slices", jobs[i].slices);
+        printf(", %lu bytes to %s\n", jobs[i].outlen, jobs[i].output);
+        if (jobs[i].maxdelay > maxdelay)
+            maxdelay = jobs[i].maxdelay;
+    }
+    if (sliced)
+    {
+        printf("Longest wait for a time slice: %.3f ms\n", maxdelay / 1e6);
+    }
+    vm_batch_free(jobs, ninputs);
+    free(jobs);
+    return failed;
+}
+
+// map the checkpoint to --restore, which holds the program
+static bool openrestore(vm_ckptfile_t *ckpt, const char *restore, const char *fname)
+{
+    if (fname != NULL)
+    {
+        printf("--restore takes the program from the checkpoint, not from %s\n", fname);
+        return false;
+    }
+    if (!vm_checkpoint_open(ckpt, restore))
+    {
+        printf("Cannot read checkpoint %s\n", restore);
+        return false;
+    }
+    return true;
+}
+
+// the state after --checkpoint-at
+static void writecheckpoint(const vm_context_t *c, const char *ckptout)
+{
+    if (vm_checkpoint_write(c, ckptout))
+        printf("Checkpoint after %lu instructions written to %s\n", c->inscount, ckptout);
+    else
+        printf("Cannot write checkpoint %s\n", ckptout);
+}
+
+// log the input of c to the file record, NULL on an error
+static FILE* startrecord(vm_recordio_t *rec, vm_context_t *c, const char *record)
+{
+    FILE *f = fopen(record, "wt");
+    if (f == NULL)
+    {
+        printf("Cannot write input log %s\n", record);
+        return NULL;
+    }
+    vm_host_record(&c->host, rec, &c->host, &c->inscount, f);
+    return f;
+}
+
+static void endrecord(const vm_recordio_t *rec, FILE *f, const char *record)
+{
+    if (fclose(f) == 0)
+        printf("Recorded %zu inputs to %s\n", rec->n, record);
+    else
+        printf("Cannot write input log %s\n", record);
+}
+
+// feed c the input logged in the file replay
+static bool startreplay(vm_replayio_t *rep, vm_context_t *c, const char *replay, bool count)
+{
+    size_t bad = vm_replayio_load(rep, replay);
+    if (bad == SIZE_MAX)
+    {
+        printf("Cannot read input log %s\n", replay);
+        return false;
+    }
+    if (bad != 0)
+    {
+        printf("Input log %s, line %zu: expected <instruction> i|c <value>\n", replay, bad);
+        return false;
+    }
+    vm_host_replay(&c->host, rep, &c->host, count ? &c->inscount : NULL);
+    return true;
+}
+
+// say how the replay went, returns the exit status: nonzero
+// if the run diverged from the log or read past its end
+static int endreplay(vm_replayio_t *rep, bool count)
+{
+    printf("Replayed %zu of %zu inputs\n", rep->pos, rep->nrecs);
+    const vm_inputrec_t *d = (rep->diverged != SIZE_MAX) ? &rep->recs[rep->diverged] : NULL;
+    if ((d != NULL) && count)
+    {
+        printf("The run diverged at input %zu: recorded at instruction %zu as '%c', read at %zu as '%c'\n",
+            rep->diverged + 1, d->inscount, d->kind, rep->divergedat, rep->divergedkind);
+    }
+    else if (d != NULL)
+    {
+        printf("The run diverged at input %zu: recorded as '%c', read as '%c'\n",
+            rep->diverged + 1, d->kind, rep->divergedkind);
+    }
+    if (rep->overrun != 0)
+    {
+        printf("The program read %zu inputs past the end of the log\n", rep->overrun);
+    }
+    int status = ((d != NULL) || (rep->overrun != 0)) ? -1 : 0;
+    vm_replayio_free(rep);
+    return status;
+}
+
+// say why the VM stopped, returns the exit status
+static int reportstop(const vm_context_t *c, bool count)
+{
+    switch((vm_stop_t)c->stop)
+    {
+    case VM_STOP_BAD:
+        // pc is past the instruction
+        printf("Illegal instruction or end of program at pc %u\n", c->pc - 1);
+        break;
+    case VM_STOP_BOUNDS:
+        printf("Stack access out of bounds at pc %u (t=%u, b=%u)\n", c->pc, c->t, c->b);
+        break;
+    case VM_STOP_OVERFLOW:
+        printf("Stack overflow, the program needs more than %u stack cells\n", c->stacksize);
+        break;
+    case VM_STOP_BREAK:
+        printf("Breakpoint at pc %u (t=%u, b=%u)\n", c->pc, c->t, c->b);
+        break;
+    case VM_STOP_NONE:
+    case VM_STOP_HALT:
+    case VM_STOP_LIMIT:
+    case VM_STOP_INPUT:
+    case VM_STOP_HOT:
+        break;
+    }
+
+    if (count && (c->stop != VM_STOP_OVERFLOW))
+    {
+        printf("Executed %lu instructions\n", c->inscount);
+    }
+    return isfault((vm_stop_t)c->stop) ? -1 : 0;
+}
+
+static void usage(const char *name)
+{
+    printf("Usage: %s [options] <code.bin>\n", name);
+    printf("       %s [options] --restore <checkpoint>\n", name);
+    printf("       %s --batch [--jobs <n>] [--batch-out <dir>] <code.bin> <input>...\n", name);
+    printf("  --stack <n> data stack cells, up to %u (default: what the program\n", VM_STACKMAX);
+    printf("              needs if it does not recurse, otherwise %u)\n", VM_STACKSIZE);
+    printf("  --no-fuse   do not use superinstructions\n");
+    printf("  --no-tos    keep the top of stack in memory\n");
+    printf("  --flush <p> console output: interactive, block or exit\n");
+    printf("              (default: interactive on a terminal, block otherwise)\n");
+    printf("  --input <f> read program input from a file, without prompts\n");
+    printf("  --record <f> log every input value and the instruction count\n");
+    printf("              at which it was read\n");
+    printf("  --replay <f> feed the input of a --record log back, without\n");
+    printf("              reading anything, and report where the run differs;\n");
+    printf("              exits nonzero if it does or reads past the log\n");
+    printf("  --jit       translate to native code before running (x86-64 Linux)\n");
+    printf("  --trace-jit compile hot loops to native code (x86-64 Linux)\n");
+    printf("  --trace     print every executed instruction to stderr\n");
+    printf("  --check     check stack accesses and stop on a violation\n");
+    printf("              (always on for programs that fail verification)\n");
+    printf("  --no-verify trust the program: skip the load-time verifier and\n");
+    printf("              run without stack checks\n");
+    printf("  --break <pc> stop before executing the instruction at pc\n");
+    printf("  --profile   count executions per opcode and pc, report on stderr\n");
+    printf("  --profile-cycles  also measure host cycles per opcode\n");
+    printf("  --profile-out <f> machine readable profile (default: vm.prof)\n");
+    printf("  --callgraph instructions and time per procedure, report on stderr\n");
+    printf("  --callgraph-out <f> folded stacks for flame graphs (default: vm.folded)\n");
+    printf("  --symbols <f> assembler label table (default: <code>.sym)\n");
+    printf("  --target-cycles estimated HD6309 cycles per procedure and pc,\n");
+    printf("              report on stderr (see target.h)\n");
+    printf("  --target-model <f> cycle costs that replace the built-in estimates\n");
+    printf("  --trace-ring <f> keep the last executed instructions in a ring buffer,\n");
+    printf("              written to f at exit or on a fatal signal (see ptrview)\n");
+    printf("  --trace-ring-size <n> records in the ring (default: %u)\n", VM_RING_DEFSIZE);
+    printf("  --no-count  do not count executed instructions\n");
+    printf("  --batch     run the program once per input file on a pool of threads,\n");
+    printf("              the output of <input> goes to <input>.out\n");
+    printf("  --jobs <n>  worker threads for --batch (default: one per CPU)\n");
+    printf("  --batch-out <dir> write the --batch outputs to dir\n");
+    printf("  --slice <n> run the --batch inputs all at once, time-sliced\n");
+    printf("              by n instructions (default with --quota: %u)\n", VM_SLICE_DEFAULT);
+    printf("  --quota <n> stop each --batch input after n instructions\n");
+    printf("  --checkpoint-at <n> stop after n instructions and save the machine state\n");
+    printf("  --checkpoint-out <f> checkpoint file (default: vm.ckpt)\n");
+    printf("  --restore <f> continue from a checkpoint, which holds the program\n");
+}
 
 int main(int argc, char *argv[])
 {
@@ -23,47 +497,446 @@ int main(int argc, char *argv[])
     printf("Instruction size is %lu bytes\n\n", sizeof(instruction_t));
 
     uint8_t *mem = NULL;
+    const char *fname = NULL;
+    bool fuse = true;
+    bool usejit = false;
+    bool usetjit = false;
+    bool verify = true;
+    bool count = true;
+    bool tos = true;
+    unsigned policy = 0;
+    uint16_t breaks[64];
+    int nbreaks = 0;
+    const char *input = NULL;
+    const char *record = NULL;
+    const char *replay = NULL;
+    tools_t tools;
+    memset(&tools, 0, sizeof(tools));
+    tools.profout  = "vm.prof";
+    tools.foldout  = "vm.folded";
+    tools.ringsize = VM_RING_DEFSIZE;
+    bool batch = false;
+    unsigned nthreads = 0;
+    const char *batchout = NULL;
+    size_t slice = 0;
+    size_t quota = SIZE_MAX;
+    const char **inputs = calloc(argc, sizeof(char*));
+    size_t ninputs = 0;
+    bool checkpoint = false;
+    size_t ckptat = 0;
+    const char *ckptout = "vm.ckpt";
+    const char *restore = NULL;
+    uint32_t stackcells = 0;
+    vm_flush_t flush = isatty(STDOUT_FILENO) ? VM_FLUSH_INTERACTIVE : VM_FLUSH_BLOCK;
+
+    for(int i=1; i<argc; i++)
+    {
+        if (strcmp(argv[i], "--no-fuse") == 0)
+        {
+            fuse = false;
+        }
+        else if (strcmp(argv[i], "--no-tos") == 0)
+        {
+            tos = false;
+        }
+        else if (strcmp(argv[i], "--trace") == 0)
+        {
+            policy |= VM_POLICY_TRACE;
+        }
+        else if (strcmp(argv[i], "--check") == 0)
+        {
+            policy |= VM_POLICY_BOUNDS;
+        }
+        else if ((strcmp(argv[i], "--break") == 0) && (i+1 < argc))
+        {
+            if (nbreaks == 64)
+            {
+                printf("Too many breakpoints\n");
+                return -1;
+            }
+            breaks[nbreaks++] = atoi(argv[++i]);
+            policy |= VM_POLICY_BREAK;
+        }
+        else if (strcmp(argv[i], "--profile") == 0)
+        {
+            tools.profile = true;
+        }
+        else if (strcmp(argv[i], "--profile-cycles") == 0)
+        {
+            tools.profile = true;
+            tools.profcycles = true;
+        }
+        else if ((strcmp(argv[i], "--profile-out") == 0) && (i+1 < argc))
+        {
+            tools.profile = true;
+            tools.profout = argv[++i];
+        }
+        else if (strcmp(argv[i], "--callgraph") == 0)
+        {
+            tools.callgraph = true;
+        }
+        else if ((strcmp(argv[i], "--callgraph-out") == 0) && (i+1 < argc))
+        {
+            tools.callgraph = true;
+            tools.foldout = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--symbols") == 0) && (i+1 < argc))
+        {
+            tools.symfile = argv[++i];
+        }
+        else if (strcmp(argv[i], "--target-cycles") == 0)
+        {
+            tools.targetcycles = true;
+        }
+        else if ((strcmp(argv[i], "--target-model") == 0) && (i+1 < argc))
+        {
+            tools.targetcycles = true;
+            tools.targetmodel = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--trace-ring") == 0) && (i+1 < argc))
+        {
+            tools.ringout = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--trace-ring-size") == 0) && (i+1 < argc))
+        {
+            tools.ringsize = strtoul(argv[++i], NULL, 0);
+        }
+        else if (strcmp(argv[i], "--batch") == 0)
+        {
+            batch = true;
+        }
+        else if ((strcmp(argv[i], "--jobs") == 0) && (i+1 < argc))
+        {
+            nthreads = atoi(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--batch-out") == 0) && (i+1 < argc))
+        {
+            batchout = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--slice") == 0) && (i+1 < argc))
+        {
+            slice = strtoull(argv[++i], NULL, 0);
+        }
+        else if ((strcmp(argv[i], "--quota") == 0) && (i+1 < argc))
+        {
+            quota = strtoull(argv[++i], NULL, 0);
+        }
+        else if ((strcmp(argv[i], "--checkpoint-at") == 0) && (i+1 < argc))
+        {
+            checkpoint = true;
+            ckptat = strtoull(argv[++i], NULL, 0);
+        }
+        else if ((strcmp(argv[i], "--checkpoint-out") == 0) && (i+1 < argc))
+        {
+            ckptout = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--restore") == 0) && (i+1 < argc))
+        {
+            restore = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--stack") == 0) && (i+1 < argc))
+        {
+            stackcells = strtoul(argv[++i], NULL, 0);
+        }
+        else if ((strcmp(argv[i], "--flush") == 0) && (i+1 < argc))
+        {
+            i++;
+            if (strcmp(argv[i], "interactive") == 0)
+                flush = VM_FLUSH_INTERACTIVE;
+            else if (strcmp(argv[i], "block") == 0)
+                flush = VM_FLUSH_BLOCK;
+            else if (strcmp(argv[i], "exit") == 0)
+                flush = VM_FLUSH_EXIT;
+            else
+            {
+                printf("Unknown flush policy %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if ((strcmp(argv[i], "--input") == 0) && (i+1 < argc))
+        {
+            input = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--record") == 0) && (i+1 < argc))
+        {
+            record = argv[++i];
+        }
+        else if ((strcmp(argv[i], "--replay") == 0) && (i+1 < argc))
+        {
+            replay = argv[++i];
+        }
+        else if (strcmp(argv[i], "--jit") == 0)
+        {
+            usejit = true;
+        }
+        else if (strcmp(argv[i], "--trace-jit") == 0)
+        {
+            usetjit = true;
+        }
+        else if (strcmp(argv[i], "--no-count") == 0)
+        {
+            count = false;
+        }
+        else if (strcmp(argv[i], "--no-verify") == 0)
+        {
+            verify = false;
+        }
+        else if (argv[i][0] == '-')
+        {
+            printf("Unknown option %s\n", argv[i]);
+            return -1;
+        }
+        else if (batch && (fname != NULL))
+        {
+            inputs[ninputs++] = argv[i];
+        }
+        else
+        {
+            fname = argv[i];
+        }
+    }
 
     size_t bytes = 0;
-    if (argc < 2)
+    vm_image_t image;
+    memset(&image, 0, sizeof(image));
+    vm_ckptfile_t ckpt;
+    if ((fname == NULL) && (restore == NULL))
+    {
+        usage(argv[0]);
+        return -1;
+    }
+    else if (restore != NULL)
     {
-        printf("Usage: %s <code.bin>\n", argv[0]);  
-        return -1;      
+        if (!openrestore(&ckpt, restore, fname))
+            return -1;
+        bytes = ckpt.memsize;
     }
     else
     {
-        FILE *fin = fopen(argv[1],"rb");
-        if (fin == NULL)
+        // the program is used straight from the mapped file
+        if (!vm_image_open(&image, fname))
         {
-            printf("Cannot open file %s\n", argv[1]);
+            printf("Cannot read file %s, or it is not a valid program image\n", fname);
             return -1;
         }
+        mem   = image.code;
+        bytes = image.codebytes;
+    }
 
-        fseek(fin, 0, SEEK_END);
-        bytes = ftell(fin);
-        rewind(fin);
+    vm_console_policy(flush);
+    if ((input != NULL) && !vm_console_input(input))
+    {
+        printf("Cannot read input file %s\n", input);
+        return -1;
+    }
 
-        mem = malloc(bytes);
-        if (fread(mem, 1, bytes, fin) != bytes)
+    if ((record != NULL) && ((replay != NULL) || !count))
+    {
+        printf("--record cannot be combined with --replay or --no-count\n");
+        return -1;
+    }
+    if ((replay != NULL) && (input != NULL))
+    {
+        printf("--replay cannot be combined with --input\n");
+        return -1;
+    }
+
+    // the target cycles are summed per pc
+    fuse = fuse && !tools.targetcycles;
+
+    // a fused program decoded by the assembler is used in place
+    vm_context_t vm;
+    bool decoded = (restore == NULL) && fuse && vm_init_decoded(&vm, mem, bytes, image.decoded);
+    if (!decoded && !vm_init(&vm, (restore != NULL) ? ckpt.mem : mem, bytes))
+    {
+        printf("Cannot set up the VM\n");
+        return -1;
+    }
+    vm.entry = image.entry;
+    vm.data  = image.data;
+    vm.ndata = image.ndata;
+    if ((stackcells != 0) && !vm_stack_resize(&vm, stackcells))
+    {
+        printf("Cannot set up a stack of %u cells\n", stackcells);
+        return -1;
+    }
+    if ((restore != NULL) && !vm_checkpoint_restore(&ckpt, &vm))
+    {
+        printf("Cannot set up the stack of checkpoint %s\n", restore);
+        return -1;
+    }
+
+    // verified programs run on the engines without stack checks,
+    // and get the stack they need unless they recurse. Trusted
+    // ones get what the image says.
+    uint32_t need = image.stackcells;
+    if (verify)
+    {
+        vm_verify_t vr;
+        if (!vm_verify(&vm, &vr))
+            printf("Cannot verify the program, pc %u: %s\n", vr.pc, vr.msg);
+        need = vr.ok ? vr.stackcells : 0;
+        vm_verify_free(&vr);
+    }
+    else
+    {
+        vm.verified = 1;
+    }
+    if (restore == NULL)
+    {
+        // and room for the initial variables in any case
+        uint32_t datacells = 4 + (uint32_t)vm.ndata;
+        if ((need != 0) || (vm.stacksize < datacells))
+            need = (need > datacells) ? need : datacells;
+        if ((stackcells == 0) && (need != 0))
+            vm_stack_resize(&vm, need);
+        vm_reset(&vm);
+    }
+    if (!vm.verified && anytool(&tools))
+    {
+        printf("The profilers and --trace-ring have no checked engine, use --no-verify to run the program anyway\n");
+        return -1;
+    }
+
+    if (nbreaks > 0)
+    {
+        vm.breakpoints = calloc(vm.codelen+1, 1);
+        for(int i=0; i<nbreaks; i++)
         {
-            printf("Cannot read file %s\n", argv[1]);
+            if (breaks[i] <= vm.codelen)
+                vm.breakpoints[breaks[i]] = 1;
+        }
+    }
+    if (fuse && !decoded)
+    {
+        vm_fuse(vm.code, vm.codelen);
+    }
+
+    if (checkpoint)
+    {
+        if (usejit || usetjit || anytool(&tools) || (policy != 0) || !count)
+        {
+            printf("--checkpoint-at cannot be combined with the JIT, the profilers, --trace-ring, --trace, --check, --break or --no-count\n");
             return -1;
         }
+        vm.inslimit = ckptat;
+        policy |= VM_POLICY_LIMIT;
+    }
 
-        fclose(fin);
+    if (!batch && ((slice != 0) || (quota != SIZE_MAX)))
+    {
+        printf("--slice and --quota need --batch\n");
+        return -1;
     }
 
-    vm_context_t vm;
-    vm_init(&vm, mem, bytes);
+    if (batch)
+    {
+        if (usejit || usetjit || anytool(&tools) || checkpoint || (restore != NULL) ||
+            (input != NULL) || (record != NULL) || (replay != NULL) || (policy != 0))
+        {
+            printf("--batch cannot be combined with the JIT, the profilers, --trace-ring, checkpoints, --input, --record, --replay, --trace, --check or --break\n");
+            return -1;
+        }
+        if (ninputs == 0)
+        {
+            printf("--batch needs at least one input file\n");
+            return -1;
+        }
+        if (count)
+            policy |= VM_POLICY_COUNT;
+        if (tos)
+            policy |= VM_POLICY_TOS;
+        if (vm_needs_checks(&vm))
+            policy |= VM_POLICY_BOUNDS;
+
+        int failed = runbatch(&vm, policy, count, inputs, ninputs, nthreads, batchout, slice, quota);
+        free(inputs);
+        vm_free(&vm);
+        vm_image_close(&image);
+        return (failed == 0) ? 0 : -1;
+    }
+
+    if (!starttools(&tools, &vm, &image, fname, usejit || usetjit, count, &policy))
+        return -1;
+
+    // the input goes through the log, the output to the console
+    // as before. The JITs and the counting engines keep inscount
+    // up to date at each input.
+    vm_recordio_t rec;
+    FILE *recfile = NULL;
+    if ((record != NULL) && ((recfile = startrecord(&rec, &vm, record)) == NULL))
+        return -1;
+    vm_replayio_t rep;
+    if ((replay != NULL) && !startreplay(&rep, &vm, replay, count))
+        return -1;
 
-    while(1)
-    {          
-        if (vm_execute(&vm) == false)
-            break;
+    // the native code has no stack checks either
+    if ((usejit || usetjit) && !vm.verified)
+    {
+        printf("Using the checked interpreter instead of the JIT\n");
+        usejit  = false;
+        usetjit = false;
+    }
+
+    vm_jit_t jit;
+    if (usejit && !vm_jit_compile(&jit, &vm, count))
+    {
+        printf("JIT not available, using the interpreter\n");
+        usejit = false;
+    }
+
+    vm_tjit_t tjit;
+    usetjit = usetjit && !usejit;
+    if (usetjit && !vm_tjit_init(&tjit, &vm, count))
+    {
+        printf("Tracing JIT not available, using the interpreter\n");
+        usetjit = false;
+    }
+
+    if (usejit)
+    {
+        activejit = &jit;
+        vm_run_guarded(&vm, runjit);
+        vm_jit_free(&jit);
+    }
+    else if (usetjit)
+    {
+        activetjit = &tjit;
+        vm_run_guarded(&vm, runtjit);
+        vm_tjit_free(&tjit);
     }
+    else
+    {
+        if (count)
+            policy |= VM_POLICY_COUNT;
+        if (tos)
+            policy |= VM_POLICY_TOS;
+        if (vm_needs_checks(&vm) && (vm_engine(policy | VM_POLICY_BOUNDS) != NULL))
+            policy |= VM_POLICY_BOUNDS;
+        vm_run_guarded(&vm, vm_engine(policy));
+    }
+    vm_console_flush();
+
+    if (recfile != NULL)
+        endrecord(&rec, recfile, record);
+    int replayed = 0;
+    if (replay != NULL)
+        replayed = endreplay(&rep, count);
+    finishtools(&tools, &vm);
 
-    printf("Executed %lu instructions\n", vm.inscount);
+    if (vm.stop == VM_STOP_LIMIT)
+        writecheckpoint(&vm, ckptout);
+    int status = reportstop(&vm, count);
+    if (replayed != 0)
+        status = replayed;
+    vm_console_close();
+    free(vm.breakpoints);
+    free(inputs);
     vm_free(&vm);
-    free(mem);
-    return 0;
+    vm_image_close(&image);
+    if (restore != NULL)
+    {
+        vm_checkpoint_close(&ckpt);
+    }
+    return status;
 }
@@ -0,0 +1,110 @@
+/*
+
+    Read-only file images: mmap with a read() fallback,
+    and complete writes
+
+*/
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapfile.h"
+
+// read fd to the end into a growing buffer
+static bool readall(vm_mapfile_t *f, int fd, size_t cap)
+{
+    uint8_t *buf = malloc(cap);
+    size_t  len  = 0;
+    while(buf != NULL)
+    {
+        if (len == cap)
+        {
+            uint8_t *nbuf = realloc(buf, cap *= 2);
+            if (nbuf == NULL)
+                free(buf);
+            buf = nbuf;
+            continue;
+        }
+
+        ssize_t r = read(fd, buf + len, cap - len);
+        if (r > 0)
+        {
+            len += r;
+        }
+        else if (r == 0)
+        {
+            f->data = buf;
+            f->len  = len;
+            return true;
+        }
+        else if (errno != EINTR)
+        {
+            free(buf);
+            buf = NULL;
+        }
+    }
+    return false;
+}
+
+bool vm_map_open(vm_mapfile_t *f, const char *fname)
+{
+    f->data   = NULL;
+    f->len    = 0;
+    f->mapped = false;
+
+    int fd = open(fname, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    bool regular = (fstat(fd, &st) == 0) && S_ISREG(st.st_mode);
+    if (regular && (st.st_size > 0))
+    {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            f->data   = p;
+            f->len    = st.st_size;
+            f->mapped = true;
+            close(fd);
+            return true;
+        }
+    }
+
+    bool ok = readall(f, fd, (regular && (st.st_size > 0)) ? (size_t)st.st_size + 1 : 65536);
+    close(fd);
+    return ok;
+}
+
+void vm_map_close(vm_mapfile_t *f)
+{
+    if (f->mapped)
+        munmap((void*)f->data, f->len);
+    else
+        free((void*)f->data);
+    f->data   = NULL;
+    f->len    = 0;
+    f->mapped = false;
+}
+
+bool vm_writeall(int fd, const void *p, size_t len)
+{
+    const uint8_t *s = p;
+    while(len > 0)
+    {
+        ssize_t w = write(fd, s, len);
+        if (w > 0)
+        {
+            s   += w;
+            len -= w;
+        }
+        else if ((w < 0) && (errno != EINTR))
+        {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,37 @@
+/*
+
+    Read-only file images for the p-code tools
+
+    A regular file is mapped, so its pages are loaded on
+    demand and shared between processes; anything else
+    (a pipe, a file system without mmap) is read into a
+    malloc()ed buffer instead. Either way the image can
+    only be read.
+
+    vm_writeall() is the counterpart for the files the tools
+    write: checkpoints, trace dumps and batch output.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct
+{
+    const uint8_t *data;    ///< file contents, len bytes
+    size_t  len;
+    bool    mapped;         ///< data is mmap()ed, not malloc()ed
+} vm_mapfile_t;
+
+/** map or read fname, returns false if it cannot be read */
+bool vm_map_open(vm_mapfile_t *f, const char *fname);
+
+/** release the image of f */
+void vm_map_close(vm_mapfile_t *f);
+
+/** write all len bytes of p to fd, retrying short and interrupted
+    writes; returns false on an error. Async-signal-safe. */
+bool vm_writeall(int fd, const void *p, size_t len);
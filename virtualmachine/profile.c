@@ -0,0 +1,191 @@
+/*
+
+    Execution profile reports
+
+*/
+
+#include <stdlib.h>
+#include "vm.h"
+#include "profile.h"
+
+#define HOTPCS  25
+
+typedef struct
+{
+    uint16_t key;       // pc or decoded opcode
+    uint64_t count;
+} entry_t;
+
+static int bycount(const void *a, const void *b)
+{
+    const entry_t *ea = a;
+    const entry_t *eb = b;
+    if (ea->count != eb->count)
+        return (ea->count < eb->count) ? 1 : -1;
+    return (ea->key < eb->key) ? -1 : 1;
+}
+
+bool vm_profile_init(vm_context_t *c, bool cycles)
+{
+    if (c->probes == NULL)
+        return false;
+    c->probes->pccount  = calloc(c->codelen+1, sizeof(uint64_t));
+    c->probes->opcycles = cycles ? calloc(DOP_COUNT, sizeof(uint64_t)) : NULL;
+    if ((c->probes->pccount == NULL) || (cycles && (c->probes->opcycles == NULL)))
+    {
+        vm_profile_free(c);
+        return false;
+    }
+    return true;
+}
+
+void vm_profile_free(vm_context_t *c)
+{
+    free(c->probes->pccount);
+    free(c->probes->opcycles);
+    c->probes->pccount  = NULL;
+    c->probes->opcycles = NULL;
+}
+
+// the plain opcode of pc; superinstructions only
+// replace the opcode of their first pc
+static uint8_t plainop(const vm_context_t *c, uint16_t pc)
+{
+    return vm_unfused(c->code[pc].op);
+}
+
+// executions per plain opcode, sorted; returns the total
+static uint64_t opcounts(const vm_context_t *c, entry_t *ops)
+{
+    uint64_t total = 0;
+    for(uint16_t op=0; op<DOP_COUNT; op++)
+    {
+        ops[op].key   = op;
+        ops[op].count = 0;
+    }
+    for(uint16_t pc=0; pc<=c->codelen; pc++)
+    {
+        ops[plainop(c, pc)].count += c->probes->pccount[pc];
+        total += c->probes->pccount[pc];
+    }
+    qsort(ops, DOP_COUNT, sizeof(entry_t), bycount);
+    return total;
+}
+
+// pcs that were executed, sorted; returns how many
+static uint16_t pccounts(const vm_context_t *c, entry_t *pcs)
+{
+    uint16_t n = 0;
+    for(uint16_t pc=0; pc<=c->codelen; pc++)
+    {
+        if (c->probes->pccount[pc] != 0)
+        {
+            pcs[n].key   = pc;
+            pcs[n].count = c->probes->pccount[pc];
+            n++;
+        }
+    }
+    qsort(pcs, n, sizeof(entry_t), bycount);
+    return n;
+}
+
+static uint64_t cyclecounts(const vm_context_t *c, entry_t *ops)
+{
+    uint64_t total = 0;
+    for(uint16_t op=0; op<DOP_COUNT; op++)
+    {
+        ops[op].key   = op;
+        ops[op].count = c->probes->opcycles[op];
+        total += c->probes->opcycles[op];
+    }
+    qsort(ops, DOP_COUNT, sizeof(entry_t), bycount);
+    return total;
+}
+
+static double percent(uint64_t part, uint64_t total)
+{
+    return (total > 0) ? (100.0 * part) / total : 0.0;
+}
+
+void vm_profile_report(const vm_context_t *c, FILE *f)
+{
+    entry_t ops[DOP_COUNT];
+    entry_t *pcs = malloc((c->codelen+1)*sizeof(entry_t));
+    if (pcs == NULL)
+        return;
+
+    uint64_t total = opcounts(c, ops);
+
+    fprintf(f, "\nProfile: %lu instructions\n\n", total);
+    fprintf(f, "  %-10s %14s %7s\n", "opcode", "count", "%");
+    for(uint16_t i=0; (i<DOP_COUNT) && (ops[i].count > 0); i++)
+    {
+        // OPR functions are listed as OPR <function>
+        bool opr = (ops[i].key >= DOP_RET) && (ops[i].key <= DOP_ININT);
+        fprintf(f, "  %-4s%-6s %14lu %6.2f%%\n", opr ? "OPR " : "",
+            vm_dopname(ops[i].key), ops[i].count, percent(ops[i].count, total));
+    }
+
+    if (c->probes->opcycles != NULL)
+    {
+        uint64_t cycles = cyclecounts(c, ops);
+        fprintf(f, "\n  %-24s %16s %7s\n", "executed as", "host cycles", "%");
+        for(uint16_t i=0; (i<DOP_COUNT) && (ops[i].count > 0); i++)
+        {
+            fprintf(f, "  %-24s %16lu %6.2f%%\n", vm_dopname(ops[i].key),
+                ops[i].count, percent(ops[i].count, cycles));
+        }
+    }
+
+    uint16_t n = pccounts(c, pcs);
+    fprintf(f, "\n  %5s  %-8s %2s %6s %14s %7s\n", "pc", "opcode", "l", "n", "count", "%");
+    for(uint16_t i=0; (i<n) && (i<HOTPCS); i++)
+    {
+        const vm_dins_t *ins = &c->code[pcs[i].key];
+        fprintf(f, "  %5u  %-8s %2u %6d %14lu %6.2f%%\n", pcs[i].key,
+            vm_dopname(plainop(c, pcs[i].key)), ins->level, ins->n,
+            pcs[i].count, percent(pcs[i].count, total));
+    }
+    free(pcs);
+}
+
+bool vm_profile_write(const vm_context_t *c, const char *fname)
+{
+    FILE *f = fopen(fname, "wt");
+    if (f == NULL)
+        return false;
+
+    entry_t ops[DOP_COUNT];
+    entry_t *pcs = malloc((c->codelen+1)*sizeof(entry_t));
+    if (pcs == NULL)
+    {
+        fclose(f);
+        return false;
+    }
+
+    fprintf(f, "total\t%lu\n", opcounts(c, ops));
+    for(uint16_t i=0; (i<DOP_COUNT) && (ops[i].count > 0); i++)
+    {
+        fprintf(f, "op\t%s\t%lu\n", vm_dopname(ops[i].key), ops[i].count);
+    }
+
+    if (c->probes->opcycles != NULL)
+    {
+        cyclecounts(c, ops);
+        for(uint16_t i=0; (i<DOP_COUNT) && (ops[i].count > 0); i++)
+        {
+            fprintf(f, "cycles\t%s\t%lu\n", vm_dopname(ops[i].key), ops[i].count);
+        }
+    }
+
+    uint16_t n = pccounts(c, pcs);
+    for(uint16_t i=0; i<n; i++)
+    {
+        const vm_dins_t *ins = &c->code[pcs[i].key];
+        fprintf(f, "pc\t%u\t%s\t%u\t%d\t%lu\n", pcs[i].key,
+            vm_dopname(plainop(c, pcs[i].key)), ins->level, ins->n, pcs[i].count);
+    }
+
+    free(pcs);
+    return fclose(f) == 0;
+}
@@ -0,0 +1,46 @@
+/*
+
+    Execution profile of the p-code virtual machine
+
+    The VM_POLICY_PROFILE interpreter variants count the
+    executions of every pc in c->probes->pccount, and, if
+    c->probes->opcycles is set, sum the host cycles spent per
+    decoded opcode. Per opcode and per OPR function counts
+    are derived from the pc counts when reporting.
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "opcodes.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+static inline uint64_t vm_cycles(void)
+{
+    return __rdtsc();
+}
+#else
+#include <time.h>
+static inline uint64_t vm_cycles(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+#endif
+
+/** allocate the counters in c->probes, with cycle sums if cycles
+    is set; false if there is no memory or c->probes is not set */
+bool vm_profile_init(vm_context_t *c, bool cycles);
+void vm_profile_free(vm_context_t *c);
+
+/** write a sorted, human readable report */
+void vm_profile_report(const vm_context_t *c, FILE *f);
+
+/** write the profile as tab separated records:
+    total <n> / op <name> <count> / cycles <name> <cycles> /
+    pc <pc> <name> <level> <n> <count>, each sorted by count */
+bool vm_profile_write(const vm_context_t *c, const char *fname);
@@ -0,0 +1,277 @@
+/*
+
+    Time-sliced scheduler: per worker run queues with stealing
+
+    Lock order: the scheduler lock before a task's input lock.
+    A run queue lock is never held together with another lock.
+
+*/
+
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "scheduler.h"
+
+static uint64_t now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec*1000000000u + ts.tv_nsec;
+}
+
+static void push(vm_worker_t *w, vm_task_t *t)
+{
+    t->next = NULL;
+    pthread_mutex_lock(&w->lock);
+    if (w->tail != NULL)
+        w->tail->next = t;
+    else
+        w->head = t;
+    w->tail = t;
+    pthread_mutex_unlock(&w->lock);
+}
+
+static vm_task_t* pop(vm_worker_t *w)
+{
+    pthread_mutex_lock(&w->lock);
+    vm_task_t *t = w->head;
+    if (t != NULL)
+    {
+        w->head = t->next;
+        if (w->head == NULL)
+            w->tail = NULL;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return t;
+}
+
+// queue t on w and wake a sleeping worker. The count goes up
+// first, a worker that finds the queue still empty tries again.
+static void ready(vm_sched_t *s, vm_worker_t *w, vm_task_t *t)
+{
+    t->queued = now();
+    pthread_mutex_lock(&s->lock);
+    t->state = VM_TASK_READY;
+    s->queued++;
+    pthread_cond_signal(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    push(w, t);
+}
+
+// the own queue first, then the others in turn
+static vm_task_t* take(vm_sched_t *s, unsigned id)
+{
+    for(unsigned i=0; i<s->nworkers; i++)
+    {
+        vm_task_t *t = pop(&s->workers[(id + i) % s->nworkers]);
+        if (t != NULL)
+        {
+            pthread_mutex_lock(&s->lock);
+            s->queued--;
+            t->state = VM_TASK_RUNNING;
+            pthread_mutex_unlock(&s->lock);
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// can the task read what it stopped for
+static bool inputready(const vm_task_t *t)
+{
+    const vm_context_t *c = &t->ctx;
+    bool number = vm_unfused(c->code[c->pc].op) == DOP_ININT;
+    return c->host.ready(c->host.user, number);
+}
+
+static void runslice(vm_sched_t *s, vm_worker_t *w, vm_task_t *t)
+{
+    uint64_t start = now();
+    if (start - t->queued > t->maxdelay)
+        t->maxdelay = start - t->queued;
+    t->slices++;
+
+    size_t left = (t->quota > t->ctx.inscount) ? t->quota - t->ctx.inscount : 0;
+    vm_stop_t stop = vm_run(&t->ctx, (left < s->slice) ? left : s->slice);
+
+    if ((stop == VM_STOP_LIMIT) && (t->ctx.inscount < t->quota))
+    {
+        ready(s, w, t);     // slice used up
+        return;
+    }
+
+    // input may have been fed since the VM looked, see vm_sched_input()
+    bool again = false;
+    pthread_mutex_lock(&s->lock);
+    if ((stop == VM_STOP_INPUT) && inputready(t))
+    {
+        again = true;
+    }
+    else if (stop == VM_STOP_INPUT)
+    {
+        t->state = VM_TASK_WAITING;
+    }
+    else
+    {
+        t->state = VM_TASK_DONE;
+        t->stop  = stop;
+    }
+    if (!again && (--s->active == 0))
+    {
+        pthread_cond_broadcast(&s->idle);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (again)
+        ready(s, w, t);
+}
+
+static void* worker(void *arg)
+{
+    vm_worker_t *w = arg;
+    vm_sched_t *s = w->sched;
+
+    while(1)
+    {
+        pthread_mutex_lock(&s->lock);
+        while((s->queued == 0) && !s->shutdown)
+            pthread_cond_wait(&s->work, &s->lock);
+        bool shutdown = s->shutdown;
+        pthread_mutex_unlock(&s->lock);
+        if (shutdown)
+            break;
+
+        vm_task_t *t = take(s, w->id);
+        if (t != NULL)
+            runslice(s, w, t);
+    }
+    return NULL;
+}
+
+bool vm_sched_init(vm_sched_t *s, unsigned nworkers, size_t slice)
+{
+    if (nworkers == 0)
+    {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = (n > 0) ? (unsigned)n : 1;
+    }
+
+    s->workers  = calloc(nworkers, sizeof(vm_worker_t));
+    s->nworkers = 0;
+    s->slice    = (slice > 0) ? slice : 1;
+    s->active   = 0;
+    s->queued   = 0;
+    s->next     = 0;
+    s->shutdown = false;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work, NULL);
+    pthread_cond_init(&s->idle, NULL);
+    if (s->workers == NULL)
+        return false;
+
+    // tasks only go to the queues of running workers
+    for(unsigned i=0; i<nworkers; i++)
+    {
+        vm_worker_t *w = &s->workers[i];
+        w->sched = s;
+        w->id    = i;
+        w->head  = NULL;
+        w->tail  = NULL;
+        pthread_mutex_init(&w->lock, NULL);
+        if (pthread_create(&w->thread, NULL, worker, w) != 0)
+        {
+            pthread_mutex_destroy(&w->lock);
+            break;
+        }
+        s->nworkers++;
+    }
+    return s->nworkers > 0;
+}
+
+void vm_sched_free(vm_sched_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->shutdown = true;
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+
+    for(unsigned i=0; i<s->nworkers; i++)
+    {
+        pthread_join(s->workers[i].thread, NULL);
+        pthread_mutex_destroy(&s->workers[i].lock);
+    }
+    free(s->workers);
+    s->workers  = NULL;
+    s->nworkers = 0;
+    pthread_cond_destroy(&s->idle);
+    pthread_cond_destroy(&s->work);
+    pthread_mutex_destroy(&s->lock);
+}
+
+bool vm_task_init(vm_task_t *t, const vm_context_t *image, size_t quota)
+{
+    if (!vm_share(&t->ctx, image))
+    {
+        vm_free(&t->ctx);
+        return false;
+    }
+    vm_host_queue(&t->ctx.host, &t->io);
+    t->quota    = quota;
+    t->state    = VM_TASK_READY;
+    t->stop     = VM_STOP_NONE;
+    t->slices   = 0;
+    t->queued   = 0;
+    t->maxdelay = 0;
+    t->next     = NULL;
+    return true;
+}
+
+void vm_task_free(vm_task_t *t)
+{
+    vm_queueio_free(&t->io);
+    vm_free(&t->ctx);
+}
+
+// a worker for a new or woken task, round robin
+static vm_worker_t* pick(vm_sched_t *s)
+{
+    return &s->workers[s->next++ % s->nworkers];
+}
+
+void vm_sched_add(vm_sched_t *s, vm_task_t *t)
+{
+    pthread_mutex_lock(&s->lock);
+    s->active++;
+    vm_worker_t *w = pick(s);
+    pthread_mutex_unlock(&s->lock);
+    ready(s, w, t);
+}
+
+bool vm_sched_input(vm_sched_t *s, vm_task_t *t, const char *p, size_t len, bool eof)
+{
+    bool ok = vm_queueio_feed(&t->io, p, len);
+    if (eof)
+        vm_queueio_close(&t->io);
+
+    vm_worker_t *w = NULL;
+    pthread_mutex_lock(&s->lock);
+    if (t->state == VM_TASK_WAITING)
+    {
+        t->state = VM_TASK_READY;   // nobody else wakes it
+        s->active++;
+        w = pick(s);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (w != NULL)
+        ready(s, w, t);
+    return ok;
+}
+
+void vm_sched_wait(vm_sched_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    while(s->active > 0)
+        pthread_cond_wait(&s->idle, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
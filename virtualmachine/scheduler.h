@@ -0,0 +1,98 @@
+/*
+
+    Time-sliced scheduler for many p-code VM instances
+
+    Every task is a vm_context_t on the shared program with a
+    queue host (see hostio.h). Worker threads run the tasks
+    in slices of at most 'slice' instructions with vm_run(),
+    so a program that spins in a loop only delays the others
+    by one slice per turn.
+
+    Each worker has its own run queue. A task that used up
+    its slice goes to the back of the queue of the worker
+    that ran it; a worker whose queue is empty steals the
+    oldest task of another. A task that stops to wait for
+    input is parked until vm_sched_input() feeds it, a task
+    over its instruction quota is finished.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "vm.h"
+#include "hostio.h"
+
+#define VM_SLICE_DEFAULT    100000  ///< instructions per time slice
+
+typedef enum
+{
+    VM_TASK_READY = 0,      ///< in a run queue
+    VM_TASK_RUNNING,
+    VM_TASK_WAITING,        ///< for input, see vm_sched_input()
+    VM_TASK_DONE            ///< see stop
+} vm_taskstate_t;
+
+typedef struct vm_task_s
+{
+    vm_context_t ctx;
+    vm_queueio_t io;
+    size_t   quota;         ///< instructions it may execute, SIZE_MAX: no limit
+    uint8_t  state;         ///< vm_taskstate_t
+    uint8_t  stop;          ///< vm_stop_t once done, VM_STOP_LIMIT: over quota
+    uint64_t slices;        ///< time slices it ran
+    uint64_t queued;        ///< when it became ready, ns
+    uint64_t maxdelay;      ///< longest time from ready to running, ns
+    void     *user;
+    struct vm_task_s *next; ///< run queue link
+} vm_task_t;
+
+struct vm_sched_s;
+
+typedef struct
+{
+    struct vm_sched_s *sched;
+    unsigned  id;
+    pthread_t thread;
+    pthread_mutex_t lock;   ///< the run queue
+    vm_task_t *head;        ///< oldest, taken by the worker and thieves
+    vm_task_t *tail;
+} vm_worker_t;
+
+typedef struct vm_sched_s
+{
+    vm_worker_t *workers;
+    unsigned nworkers;
+    size_t   slice;         ///< instructions per time slice
+    pthread_mutex_t lock;   ///< everything below
+    pthread_cond_t  work;   ///< tasks were queued, or shutdown
+    pthread_cond_t  idle;   ///< no task is ready or running
+    size_t   active;        ///< tasks ready or running
+    size_t   queued;        ///< tasks in the run queues or about to be
+    unsigned next;          ///< queue of the next new or woken task
+    bool     shutdown;
+} vm_sched_t;
+
+/** start nworkers threads (0: one per online CPU) that run slices
+    of 'slice' instructions. Returns false if nothing started. */
+bool vm_sched_init(vm_sched_t *s, unsigned nworkers, size_t slice);
+
+/** wait for the workers to stop; the tasks are not touched */
+void vm_sched_free(vm_sched_t *s);
+
+/** set up a task on the program of image (see vm_share())
+    with empty input. image must outlive the task. Returns false,
+    and the task is not set up, if there is no memory for its stack. */
+bool vm_task_init(vm_task_t *t, const vm_context_t *image, size_t quota);
+void vm_task_free(vm_task_t *t);
+
+/** queue a task that was set up with vm_task_init() */
+void vm_sched_add(vm_sched_t *s, vm_task_t *t);
+
+/** feed input to a task, close its input if eof is set, and
+    wake it if it waits. Any thread, while the task is not done. */
+bool vm_sched_input(vm_sched_t *s, vm_task_t *t, const char *p, size_t len, bool eof);
+
+/** wait until every task is done or waiting for input */
+void vm_sched_wait(vm_sched_t *s);
@@ -0,0 +1,202 @@
+/*
+
+    Data stack of the p-code virtual machine
+
+    The stack is reserved with mmap() as
+
+        [guard page][stacksize cells, read/write][no access ...]
+
+    with the no access part reaching past the highest cell
+    any instruction can address: indices are 16 bit, and
+    LODX/STOX add a 16 bit index to a 16 bit address. The
+    read/write part is only backed by memory once touched.
+    Any access outside it faults, and vm_run_guarded() turns
+    the fault of its VM into VM_STOP_OVERFLOW, so the
+    interpreters need no checks for it.
+
+    Where mmap() is not available the stack is a calloc()ed
+    block of the full reservation, which cannot be overrun
+    either, but overflows go unnoticed.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "vm.h"
+
+#define RESERVE_CELLS   (2*VM_STACKMAX + 4)
+
+typedef struct
+{
+    const uint8_t *lo;          ///< reserved range of the running VM
+    const uint8_t *hi;
+    sigjmp_buf     env;
+} guard_t;
+
+static _Thread_local guard_t *guard = NULL;
+
+static pthread_mutex_t  installlock = PTHREAD_MUTEX_INITIALIZER;
+static struct sigaction oldsegv;
+static struct sigaction oldbus;
+
+static size_t pagesize(void)
+{
+    long p = sysconf(_SC_PAGESIZE);
+    return (p > 0) ? (size_t)p : 4096;
+}
+
+static size_t roundup(size_t n, size_t to)
+{
+    return (n + to - 1) / to * to;
+}
+
+bool vm_stack_resize(vm_context_t *c, uint32_t cells)
+{
+    if ((cells < 4) || (cells > VM_STACKMAX))
+        return false;
+
+    size_t page  = pagesize();
+    size_t used  = roundup((size_t)cells * sizeof(int16_t), page);
+    size_t total = page + roundup(RESERVE_CELLS * sizeof(int16_t), page);
+
+    int16_t *s = NULL;
+    uint8_t *map = mmap(NULL, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (map != MAP_FAILED)
+    {
+        if (mprotect(map + page, used, PROT_READ | PROT_WRITE) == 0)
+        {
+            s = (int16_t*)(map + page);
+        }
+        else
+        {
+            munmap(map, total);
+        }
+    }
+
+    bool mapped = (s != NULL);
+    if (!mapped)
+    {
+        s = calloc(RESERVE_CELLS + 1, sizeof(int16_t));
+        if (s == NULL)
+            return false;
+        s++;                            // t-1 with t == 0
+        used = (size_t)cells * sizeof(int16_t);
+    }
+
+    vm_stack_free(c);
+    c->dstack      = s;
+    c->stacksize   = used / sizeof(int16_t);
+    c->stackmapped = mapped;
+    return true;
+}
+
+void vm_stack_free(vm_context_t *c)
+{
+    if (c->dstack == NULL)
+        return;
+
+    if (c->stackmapped)
+    {
+        size_t page  = pagesize();
+        size_t total = page + roundup(RESERVE_CELLS * sizeof(int16_t), page);
+        munmap((uint8_t*)c->dstack - page, total);
+    }
+    else
+    {
+        free(c->dstack - 1);
+    }
+    c->dstack = NULL;
+    c->stacksize = 0;
+}
+
+void vm_stack_clear(vm_context_t *c)
+{
+    size_t bytes = (size_t)c->stacksize * sizeof(int16_t);
+    // dropping the pages is cheaper than writing them
+    // unless only a page or so is in use
+    if (!c->stackmapped || (bytes <= pagesize()) ||
+        (madvise(c->dstack, bytes, MADV_DONTNEED) != 0))
+    {
+        memset(c->dstack, 0, bytes);
+    }
+}
+
+static void chain(const struct sigaction *old, int sig, siginfo_t *info, void *uc)
+{
+    if (old->sa_flags & SA_SIGINFO)
+    {
+        old->sa_sigaction(sig, info, uc);
+    }
+    else if ((old->sa_handler != SIG_DFL) && (old->sa_handler != SIG_IGN))
+    {
+        old->sa_handler(sig);
+    }
+    else
+    {
+        // the fault happens again on return and is fatal
+        signal(sig, SIG_DFL);
+    }
+}
+
+static void onfault(int sig, siginfo_t *info, void *uc)
+{
+    const uint8_t *addr = info->si_addr;
+    if ((guard != NULL) && (addr >= guard->lo) && (addr < guard->hi))
+    {
+        siglongjmp(guard->env, 1);
+    }
+    chain((sig == SIGBUS) ? &oldbus : &oldsegv, sig, info, uc);
+}
+
+static void install(void)
+{
+    pthread_mutex_lock(&installlock);
+
+    struct sigaction cur;
+    sigaction(SIGSEGV, NULL, &cur);
+    if (!(cur.sa_flags & SA_SIGINFO) || (cur.sa_sigaction != onfault))
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = onfault;
+        sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGSEGV, &sa, &oldsegv);
+        sigaction(SIGBUS, &sa, &oldbus);
+    }
+
+    pthread_mutex_unlock(&installlock);
+}
+
+void vm_run_guarded(vm_context_t *c, vm_engine_t engine)
+{
+    if (!c->stackmapped)
+    {
+        engine(c);
+        return;
+    }
+
+    size_t page = pagesize();
+    guard_t g;
+    g.lo = (const uint8_t*)c->dstack - page;
+    g.hi = (const uint8_t*)c->dstack + roundup(RESERVE_CELLS * sizeof(int16_t), page);
+
+    install();
+    guard_t *outer = guard;
+    if (sigsetjmp(g.env, 1) == 0)
+    {
+        guard = &g;
+        engine(c);
+    }
+    else
+    {
+        // pc, t and b were in the interpreter's registers
+        c->stop = VM_STOP_OVERFLOW;
+    }
+    guard = outer;
+}
@@ -0,0 +1,114 @@
+/*
+
+    Label table written by the assembler
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "symfile.h"
+
+void vm_sym_init(vm_symtab_t *tab)
+{
+    tab->syms  = NULL;
+    tab->count = 0;
+}
+
+// add the label of one "<address> <name>" line, false when full
+static bool addline(vm_symtab_t *tab, const char *line)
+{
+    unsigned address;
+    char name[256];
+    if (sscanf(line, "%u %255s", &address, name) != 2)
+        return true;
+    if (tab->count == UINT16_MAX)
+        return false;
+
+    // grows by doubling, the capacity is the next power of two
+    uint16_t n = tab->count;
+    if ((n >= 64) ? ((n & (n-1)) == 0) : (n == 0))
+    {
+        uint32_t cap = (n == 0) ? 64 : 2*(uint32_t)n;
+        vm_sym_t *syms = realloc(tab->syms, cap*sizeof(vm_sym_t));
+        if (syms == NULL)
+            return false;
+        tab->syms = syms;
+    }
+    tab->syms[n].address = address;
+    tab->syms[n].name    = strdup(name);
+    tab->count++;
+    return true;
+}
+
+bool vm_sym_load(vm_symtab_t *tab, const char *fname)
+{
+    FILE *f = fopen(fname, "rt");
+    if (f == NULL)
+        return false;
+
+    char line[300];
+    while((fgets(line, sizeof(line), f) != NULL) && addline(tab, line))
+        ;
+
+    fclose(f);
+    return true;
+}
+
+void vm_sym_parse(vm_symtab_t *tab, const char *text, size_t len)
+{
+    char line[300];
+    size_t i = 0;
+    while(i < len)
+    {
+        size_t n = 0;
+        while((i < len) && (text[i] != '\n'))
+        {
+            if (n+1 < sizeof(line))
+                line[n++] = text[i];
+            i++;
+        }
+        i++;
+        line[n] = 0;
+        if (!addline(tab, line))
+            break;
+    }
+}
+
+void vm_sym_free(vm_symtab_t *tab)
+{
+    for(uint16_t i=0; i<tab->count; i++)
+    {
+        free(tab->syms[i].name);
+    }
+    free(tab->syms);
+    vm_sym_init(tab);
+}
+
+// L<digits>, as generated by the compiler
+static bool generated(const char *name)
+{
+    if ((name[0] != 'L') || (name[1] == 0))
+        return false;
+    for(const char *p = name+1; *p != 0; p++)
+    {
+        if ((*p < '0') || (*p > '9'))
+            return false;
+    }
+    return true;
+}
+
+const char* vm_sym_name(const vm_symtab_t *tab, uint16_t address)
+{
+    const char *best = NULL;
+    for(uint16_t i=0; i<tab->count; i++)
+    {
+        if (tab->syms[i].address != address)
+            continue;
+        if (!generated(tab->syms[i].name))
+            return tab->syms[i].name;
+        if (best == NULL)
+            best = tab->syms[i].name;
+    }
+    return best;
+}
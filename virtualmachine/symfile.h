@@ -0,0 +1,40 @@
+/*
+
+    Label table written by the assembler (code.sym)
+
+    One label per line: <address> <name>. Several labels
+    can share an address; the compiler marks procedure
+    entries with @proc_<name> next to its generated @L<n>.
+
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct
+{
+    uint16_t address;
+    char     *name;
+} vm_sym_t;
+
+typedef struct
+{
+    vm_sym_t *syms;
+    uint16_t count;
+} vm_symtab_t;
+
+void vm_sym_init(vm_symtab_t *tab);
+
+/** load a label table, returns false if the file cannot be read */
+bool vm_sym_load(vm_symtab_t *tab, const char *fname);
+
+/** load the same from len bytes of text, e.g. an image section */
+void vm_sym_parse(vm_symtab_t *tab, const char *text, size_t len);
+void vm_sym_free(vm_symtab_t *tab);
+
+/** the most descriptive label at address, i.e. one that is not
+    a generated L<n> label if there is one, or NULL */
+const char* vm_sym_name(const vm_symtab_t *tab, uint16_t address);
@@ -0,0 +1,261 @@
+/*
+
+    HD6309 cost model and target cycle reports
+
+    The numbers are native mode cycle counts of the handler
+    sequences below, which is how the target VM is laid out:
+    Y points at the packed instruction, U is the data stack
+    pointer with the top of stack at ,U, the frame base is
+    kept in the direct page variable 'vbase'.
+
+    dispatch (20)   LDA ,Y+  TFR A,B  ANDA #$0F  LSLA
+                    LDX #optab  JMP [A,X]
+    operand  (12)   LDD ,Y++  EXG A,B       (the image is little-endian)
+    base()   (11)   LDX vbase  LSRB x4  BEQ
+    level    (9)    LDX ,X  DECB  BNE        (per level walked)
+    OPR      (20)   LDB 1,Y  LEAY 2,Y  LSLB  LDX #oprtab  JMP [B,X]
+
+    The OPR functions include the second dispatch. Costs that
+    depend on the data are charged a typical case: JPC the
+    mean of the taken and not-taken paths, the shifts four bit
+    positions, OUTINT and ININT three digits, and I/O without
+    waiting for the terminal.
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "target.h"
+
+#define HOTPCS  25
+
+const vm_target_t vm_target_hd6309 =
+{
+    .clock    = 3000000,
+    .dispatch = 20,
+    .level    = 9,
+    .op =
+    {
+        [DOP_LIT]     = 21,     // operand, PSHU D, BRA next
+        [DOP_LOD]     = 40,     // operand, base(), LSLD, LDD D,X, PSHU D
+        [DOP_STO]     = 42,     // operand, base(), LSLD, LEAX D,X, PULU D, STD ,X
+        [DOP_CAL]     = 64,     // operand, base(), push link, vbase and Y, new vbase, Y from pc
+        [DOP_INT]     = 25,     // operand, LSLD, NEGD, LEAU D,U
+        [DOP_JMP]     = 30,     // operand, pc*3 + code -> Y
+        [DOP_JPC]     = 28,     // PULU D, BNE, then JMP or LEAY 2,Y
+        [DOP_LODX]    = 55,     // LOD with the index popped and added
+        [DOP_STOX]    = 60,
+        [DOP_HALT]    = 8,
+        [DOP_RET]     = 52,     // U from vbase, pull vbase and Y
+        [DOP_NEG]     = 32,     // LDD ,U  NEGD  STD ,U
+        [DOP_ADD]     = 37,     // PULU D  ADDD ,U  STD ,U
+        [DOP_SUB]     = 39,     // PULU D  NEGD  ADDD ,U  STD ,U
+        [DOP_MUL]     = 62,     // PULU D  MULD ,U  STW ,U
+        [DOP_DIV]     = 82,     // zero check, SEXW, DIVQ
+        [DOP_ODD]     = 34,
+        [DOP_NOP]     = 20,
+        [DOP_EQ]      = 45,     // PULU D  CMPD ,U  CLRD  Bcc  INCB  STD ,U
+        [DOP_NEQ]     = 45,
+        [DOP_LESS]    = 45,
+        [DOP_LEQ]     = 45,
+        [DOP_GREATER] = 45,
+        [DOP_GEQ]     = 45,
+        [DOP_SHR]     = 54,     // PULU D, then LSRD DECB BNE per bit
+        [DOP_SHL]     = 54,
+        [DOP_SAR]     = 54,
+        [DOP_OUTCHAR] = 70,     // PULU D, JSR to the character output
+        [DOP_OUTINT]  = 380,    // DIVD #10 per digit, then the characters
+        [DOP_INCHAR]  = 70,
+        [DOP_ININT]   = 300,
+        [DOP_BAD]     = 0,
+    }
+};
+
+// does the target walk static links for op
+static bool walkslevels(uint8_t op)
+{
+    switch(op)
+    {
+    case DOP_LOD:
+    case DOP_STO:
+    case DOP_LODX:
+    case DOP_STOX:
+    case DOP_CAL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+uint32_t vm_target_cost(const vm_target_t *m, const vm_dins_t *ins)
+{
+    uint8_t op = vm_unfused(ins->op);
+    uint32_t cost = m->dispatch + m->op[op];
+    if (walkslevels(op))
+        cost += (uint32_t)m->level * ins->level;
+    return cost;
+}
+
+static bool setentry(vm_target_t *m, const char *name, unsigned long v)
+{
+    if (strcmp(name, "clock") == 0)
+    {
+        m->clock = v;
+        return true;
+    }
+    if (v > UINT16_MAX)
+        return false;
+    if (strcmp(name, "dispatch") == 0)
+    {
+        m->dispatch = v;
+        return true;
+    }
+    if (strcmp(name, "level") == 0)
+    {
+        m->level = v;
+        return true;
+    }
+    for(uint8_t op=0; op<DOP_FUSED; op++)
+    {
+        if (strcmp(name, vm_dopname(op)) == 0)
+        {
+            m->op[op] = v;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool vm_target_load(vm_target_t *m, const char *fname)
+{
+    FILE *f = fopen(fname, "rt");
+    if (f == NULL)
+        return false;
+
+    char line[256];
+    bool ok = true;
+    while(ok && (fgets(line, sizeof(line), f) != NULL))
+    {
+        char *hash = strchr(line, '#');
+        if (hash != NULL)
+            *hash = 0;
+
+        char name[32];
+        unsigned long v;
+        char extra;
+        int fields = sscanf(line, "%31s %lu %c", name, &v, &extra);
+        if (fields == EOF)
+            continue;       // blank line or comment
+        ok = (fields == 2) && setentry(m, name, v);
+    }
+
+    fclose(f);
+    return ok;
+}
+
+bool vm_target_init(vm_context_t *c, const vm_target_t *m)
+{
+    if (c->probes == NULL)
+        return false;
+    c->probes->tcost   = malloc((c->codelen+1)*sizeof(uint32_t));
+    c->probes->tcycles = 0;
+    if (c->probes->tcost == NULL)
+        return false;
+
+    for(uint32_t pc=0; pc<=c->codelen; pc++)
+    {
+        c->probes->tcost[pc] = vm_target_cost(m, &c->code[pc]);
+    }
+    return true;
+}
+
+void vm_target_free(vm_context_t *c)
+{
+    free(c->probes->tcost);
+    c->probes->tcost = NULL;
+}
+
+/*
+    reports
+*/
+
+typedef struct
+{
+    uint16_t key;       // pc or plain opcode
+    uint64_t count;
+    uint64_t cycles;
+} entry_t;
+
+static int bycycles(const void *a, const void *b)
+{
+    const entry_t *ea = a;
+    const entry_t *eb = b;
+    if (ea->cycles != eb->cycles)
+        return (ea->cycles < eb->cycles) ? 1 : -1;
+    return (ea->key < eb->key) ? -1 : 1;
+}
+
+static double percent(uint64_t part, uint64_t total)
+{
+    return (total > 0) ? (100.0 * part) / total : 0.0;
+}
+
+void vm_target_report(const vm_context_t *c, const vm_target_t *m, FILE *f)
+{
+    entry_t ops[DOP_FUSED];
+    entry_t *pcs = malloc((c->codelen+1)*sizeof(entry_t));
+    if (pcs == NULL)
+        return;
+
+    for(uint16_t op=0; op<DOP_FUSED; op++)
+    {
+        ops[op].key    = op;
+        ops[op].count  = 0;
+        ops[op].cycles = 0;
+    }
+
+    uint64_t total = 0;
+    uint32_t n = 0;
+    for(uint32_t pc=0; pc<=c->codelen; pc++)
+    {
+        uint64_t count = c->probes->pccount[pc];
+        if (count == 0)
+            continue;
+
+        uint64_t cycles = count * c->probes->tcost[pc];
+        entry_t *op = &ops[vm_unfused(c->code[pc].op)];
+        op->count  += count;
+        op->cycles += cycles;
+        pcs[n].key    = pc;
+        pcs[n].count  = count;
+        pcs[n].cycles = cycles;
+        n++;
+        total += cycles;
+    }
+    qsort(ops, DOP_FUSED, sizeof(entry_t), bycycles);
+    qsort(pcs, n, sizeof(entry_t), bycycles);
+
+    fprintf(f, "\nEstimated target cycles: %lu", total);
+    if (m->clock > 0)
+        fprintf(f, ", %.3f s at %.3f MHz", (double)total / m->clock, m->clock / 1e6);
+    fprintf(f, "\n\n  %-10s %14s %16s %7s %8s\n", "opcode", "count", "cycles", "%", "cyc/ins");
+    for(uint16_t i=0; (i<DOP_FUSED) && (ops[i].count > 0); i++)
+    {
+        bool opr = (ops[i].key >= DOP_RET) && (ops[i].key <= DOP_ININT);
+        fprintf(f, "  %-4s%-6s %14lu %16lu %6.2f%% %8.1f\n", opr ? "OPR " : "",
+            vm_dopname(ops[i].key), ops[i].count, ops[i].cycles,
+            percent(ops[i].cycles, total), (double)ops[i].cycles / ops[i].count);
+    }
+
+    fprintf(f, "\n  %5s  %-8s %2s %6s %14s %16s %7s\n", "pc", "opcode", "l", "n",
+        "count", "cycles", "%");
+    for(uint32_t i=0; (i<n) && (i<HOTPCS); i++)
+    {
+        const vm_dins_t *ins = &c->code[pcs[i].key];
+        fprintf(f, "  %5u  %-8s %2u %6d %14lu %16lu %6.2f%%\n", pcs[i].key,
+            vm_dopname(vm_unfused(ins->op)), ins->level, ins->n,
+            pcs[i].count, pcs[i].cycles, percent(pcs[i].cycles, total));
+    }
+    free(pcs);
+}
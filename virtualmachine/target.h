@@ -0,0 +1,57 @@
+/*
+
+    Target cost model of the p-code virtual machine
+
+    Estimated cycles of the hand-written VM on the HD6309 for
+    every plain opcode and OPR function, plus a cost per static
+    level that base() walks for LOD/STO/LODX/STOX/CAL. The
+    host VM resolves levels through a display, the target VM
+    follows the static links, so the level term only exists
+    in the model.
+
+    The target VM is not part of this repository. The table
+    follows the instruction sequences sketched in target.c;
+    vm_target_load() replaces entries with measured numbers.
+
+    vm_target_init() turns the model into a cost per pc in
+    c->probes->tcost. The VM_POLICY_TARGET interpreter variants add
+    the cost of every executed pc to c->probes->tcycles, which the
+    call-graph profiler charges to the procedures; per pc
+    totals follow from the execution profile.
+
+*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stdbool.h>
+#include "opcodes.h"
+
+typedef struct
+{
+    uint32_t clock;             ///< target clock in Hz, for the run time estimate
+    uint16_t dispatch;          ///< fetch and decode, paid by every instruction
+    uint16_t level;             ///< per static level walked by base()
+    uint16_t op[DOP_FUSED];     ///< per plain opcode, without dispatch and levels
+} vm_target_t;
+
+/** the HD6309 VM in native mode */
+extern const vm_target_t vm_target_hd6309;
+
+/** read "<name> <cycles>" lines over m: name is an opcode as
+    vm_dopname() shows it, "dispatch", "level" or "clock".
+    '#' starts a comment. Returns false if the file cannot be
+    read or has a line it does not understand. */
+bool vm_target_load(vm_target_t *m, const char *fname);
+
+/** estimated cycles of one execution of ins */
+uint32_t vm_target_cost(const vm_target_t *m, const vm_dins_t *ins);
+
+/** fill c->probes->tcost from m and clear c->probes->tcycles.
+    The code must not be fused: a superinstruction would skip
+    the costs of the pcs it covers. */
+bool vm_target_init(vm_context_t *c, const vm_target_t *m);
+void vm_target_free(vm_context_t *c);
+
+/** per opcode and per pc report; needs the c->probes->pccount profile */
+void vm_target_report(const vm_context_t *c, const vm_target_t *m, FILE *f);
@@ -0,0 +1,95 @@
+/*
+
+    Instruction trace ring buffer: allocation and dumps
+
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "vm.h"
+#include "tracebuf.h"
+#include "mapfile.h"
+
+static const int fatalsignals[] = { SIGINT, SIGTERM, SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+#define NSIGNALS    (sizeof(fatalsignals) / sizeof(fatalsignals[0]))
+
+// what the signal handler dumps
+static const vm_ring_t *caught = NULL;
+static const char      *caughtname = NULL;
+
+bool vm_ring_init(vm_ring_t *r, uint32_t size)
+{
+    uint32_t n = 1;
+    while((n < size) && (n < (1u << 31)))
+        n <<= 1;
+
+    r->rec  = malloc((size_t)n * sizeof(vm_ringrec_t));
+    r->mask = n - 1;
+    atomic_init(&r->head, 0);
+    return r->rec != NULL;
+}
+
+void vm_ring_free(vm_ring_t *r)
+{
+    free(r->rec);
+    r->rec = NULL;
+}
+
+bool vm_ring_dump(const vm_ring_t *r, const char *fname, uint8_t stop, uint8_t signal)
+{
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    uint64_t size = (uint64_t)r->mask + 1;
+    uint32_t count = (head < size) ? (uint32_t)head : (uint32_t)size;
+
+    vm_ringheader_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, VM_RING_MAGIC, 4);
+    h.version = VM_RING_VERSION;
+    h.recsize = sizeof(vm_ringrec_t);
+    h.stop    = stop;
+    h.signal  = signal;
+    h.count   = count;
+    h.total   = head;
+
+    int fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    // oldest first: from head to the end of the buffer, then the start
+    uint32_t first = (uint32_t)((head - count) & r->mask);
+    uint32_t upper = (first + count > size) ? (uint32_t)(size - first) : count;
+    bool ok = vm_writeall(fd, &h, sizeof(h)) &&
+              vm_writeall(fd, r->rec + first, (size_t)upper * sizeof(vm_ringrec_t)) &&
+              vm_writeall(fd, r->rec, (size_t)(count - upper) * sizeof(vm_ringrec_t));
+    close(fd);
+    return ok;
+}
+
+static void onsignal(int sig)
+{
+    if (caught != NULL)
+    {
+        vm_ring_dump(caught, caughtname, VM_STOP_NONE, (uint8_t)sig);
+        caught = NULL;
+    }
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+void vm_ring_catch(const vm_ring_t *r, const char *fname)
+{
+    caught     = r;
+    caughtname = fname;
+    for(size_t i=0; i<NSIGNALS; i++)
+        signal(fatalsignals[i], onsignal);
+}
+
+void vm_ring_release(void)
+{
+    for(size_t i=0; i<NSIGNALS; i++)
+        signal(fatalsignals[i], SIG_DFL);
+    caught = NULL;
+}
@@ -0,0 +1,72 @@
+/*
+
+    Instruction trace ring buffer of the p-code virtual machine
+
+    The VM_POLICY_RING interpreter variants store a record
+    of every executed instruction in c->probes->ring, overwriting
+    the oldest once the buffer is full. There is a single
+    writer, the interpreter; 'head' is published after the
+    record is written, so a signal handler (or a reader
+    after the VM stopped) sees complete records only.
+
+    vm_ring_dump() writes the last records, oldest first,
+    behind a vm_ringheader_t. The records are in host byte
+    order, the header tells their size. See ptrview for an
+    analyzer.
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "opcodes.h"
+
+#define VM_RING_MAGIC       "PTRB"
+#define VM_RING_VERSION     1
+#define VM_RING_DEFSIZE     (1u << 20)
+
+/** one executed instruction, state before it was executed */
+typedef struct
+{
+    uint16_t pc;
+    uint16_t t;
+    uint16_t b;
+    int16_t  tos;       ///< dstack[t], 0 if the stack is empty
+    uint8_t  op;        ///< decoded opcode, fused on the first pc of a superinstruction
+    uint8_t  level;
+} vm_ringrec_t;
+
+/** header of a trace dump */
+typedef struct
+{
+    char     magic[4];  ///< VM_RING_MAGIC
+    uint16_t version;   ///< VM_RING_VERSION
+    uint16_t recsize;   ///< sizeof(vm_ringrec_t)
+    uint8_t  stop;      ///< vm_stop_t when the dump was written
+    uint8_t  signal;    ///< signal that caused the dump, or 0
+    uint16_t reserved;
+    uint32_t count;     ///< records in the dump
+    uint64_t total;     ///< records written since the start
+} vm_ringheader_t;
+
+typedef struct vm_ring_s
+{
+    vm_ringrec_t *rec;
+    uint32_t mask;              ///< number of records - 1
+    _Atomic uint64_t head;      ///< records written since the start
+} vm_ring_t;
+
+/** allocate a ring of 'size' records, rounded up to a power of two */
+bool vm_ring_init(vm_ring_t *r, uint32_t size);
+void vm_ring_free(vm_ring_t *r);
+
+/** write the ring to fname. Only uses async-signal-safe calls. */
+bool vm_ring_dump(const vm_ring_t *r, const char *fname, uint8_t stop, uint8_t signal);
+
+/** dump r to fname when a fatal signal or SIGINT/SIGTERM arrives,
+    then die of the signal. Both must stay valid. */
+void vm_ring_catch(const vm_ring_t *r, const char *fname);
+
+/** stop catching signals */
+void vm_ring_release(void);
@@ -0,0 +1,268 @@
+/*
+
+    Tracing JIT for hot loops of the p-code virtual machine
+
+    Cold code runs on the threaded interpreter with
+    VM_POLICY_HOT, which counts taken backward JMPs and JPCs
+    towards their target, the loop head, and stops once a
+    head is hot. Only then are the instructions executed from
+    the head until the jump back to it single-stepped with
+    vm_execute(), recorded and compiled to a native loop.
+    Each JPC in the trace becomes a guard that leaves the
+    trace, with the pc of the path that was not recorded,
+    when the branch goes the other way. The interpreter then
+    stops at the head on every jump back to it, to enter the
+    trace again.
+
+    Loops that call procedures, return, or contain another
+    loop are not traced.
+
+*/
+
+#include <stdlib.h>
+#include "tracejit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include "vm.h"
+#include "x64emit.h"
+
+bool vm_tjit_init(vm_tjit_t *tj, vm_context_t *c, bool count)
+{
+    tj->hot       = malloc((c->codelen+1) * sizeof(uint16_t));
+    tj->traces    = calloc(c->codelen+1, sizeof(void*));
+    tj->sizes     = calloc(c->codelen+1, sizeof(size_t));
+    tj->probes    = c->probes;
+    tj->count     = count;
+    tj->reclen    = 0;
+    tj->ntraces   = 0;
+    tj->nentries  = 0;
+    if ((tj->hot == NULL) || (tj->traces == NULL) || (tj->sizes == NULL) || (tj->probes == NULL))
+    {
+        vm_tjit_free(tj);
+        return false;
+    }
+    for(uint32_t pc=0; pc<=c->codelen; pc++)
+    {
+        tj->hot[pc] = TJIT_HOT;
+    }
+    tj->probes->hot = tj->hot;
+    return true;
+}
+
+void vm_tjit_free(vm_tjit_t *tj)
+{
+    for(uint32_t pc=0; (tj->traces != NULL) && (tj->ntraces > 0); pc++)
+    {
+        if (tj->traces[pc] != NULL)
+        {
+            x64_release(tj->traces[pc], tj->sizes[pc]);
+            tj->ntraces--;
+        }
+    }
+    if (tj->probes != NULL)
+    {
+        tj->probes->hot = NULL;
+    }
+    free(tj->hot);
+    free(tj->traces);
+    free(tj->sizes);
+    tj->hot    = NULL;
+    tj->traces = NULL;
+    tj->sizes  = NULL;
+}
+
+typedef struct
+{
+    size_t      at;     // rel32 of the guard, then of the jump to the epilogue
+    uint16_t    pc;     // pc to continue at in the interpreter
+} exit_t;
+
+static void compile(vm_tjit_t *tj, const vm_context_t *c)
+{
+    x64_buf_t x;
+    exit_t    exits[TJIT_MAXTRACE];
+    uint16_t  nexits = 0;
+
+    x64_init(&x);
+    x64_prologue(&x, NULL);
+
+    size_t loop = x.len;
+    for(uint16_t i=0; i<tj->reclen; i++)
+    {
+        const vm_dins_t *ins = &c->code[tj->rec[i].pc];
+
+        if (tj->count)
+        {
+            x64_rm_reg(&x, false, true, 0xFF, 0, X64_R14);     // inc r14
+        }
+
+        if (x64_straight(&x, ins))
+            continue;
+
+        switch(vm_unfused(ins->op))
+        {
+        case DOP_JMP:
+            // the trace is linear, only the last JMP closes the loop
+            if (i == tj->reclen-1)
+            {
+                x64_flush(&x);
+                x64_patch(&x, x64_jump(&x, -1), loop);
+            }
+            break;
+        case DOP_JPC:
+            x64_tos(&x);
+            x.tos = false;
+            x64_rm_reg(&x, false, true, 0xFF, 1, X64_R12);     // dec r12
+            x64_rm_reg(&x, true, false, 0x85, X64_RCX, X64_RCX);   // test cx, cx
+            if (tj->rec[i].taken)
+            {
+                exits[nexits].pc = tj->rec[i].pc + 1;
+                exits[nexits++].at = x64_jump(&x, X64_CC_NE);
+            }
+            else
+            {
+                exits[nexits].pc = ins->a;
+                exits[nexits++].at = x64_jump(&x, X64_CC_E);
+            }
+            // a taken JPC back to the head closes the loop too
+            if (i == tj->reclen-1)
+            {
+                x64_patch(&x, x64_jump(&x, -1), loop);
+            }
+            break;
+        default:
+            // not recorded, see vm_tjit_run()
+            break;
+        }
+    }
+
+    // guard exits
+    for(uint16_t i=0; i<nexits; i++)
+    {
+        x64_patch(&x, exits[i].at, x.len);
+        x64_emit8(&x, 0xB8);                                    // mov eax, pc
+        x64_emit32(&x, exits[i].pc);
+        exits[i].at = x64_jump(&x, -1);
+    }
+
+    // back to the interpreter, still running
+    size_t epilogue = x.len;
+    x64_rm_reg(&x, false, false, 0x31, X64_RDX, X64_RDX);     // xor edx, edx
+    x64_epilogue(&x, tj->count);
+
+    for(uint16_t i=0; i<nexits; i++)
+    {
+        x64_patch(&x, exits[i].at, epilogue);
+    }
+
+    void *code = x64_finalize(&x);
+    if (code != NULL)
+    {
+        tj->traces[tj->head] = code;
+        tj->sizes[tj->head]  = x.len;
+        tj->ntraces++;
+    }
+    x64_free(&x);
+}
+
+/*
+    single-step the loop at head, which got hot, and compile it
+    once execution jumps back to head. Returns false when the
+    VM stopped.
+*/
+static bool record(vm_tjit_t *tj, vm_context_t *c, uint16_t head)
+{
+    tj->head   = head;
+    tj->reclen = 0;
+    while(1)
+    {
+        uint16_t pc = c->pc;
+        uint8_t  op = vm_unfused(c->code[pc].op);
+
+        if ((op == DOP_CAL) || (op == DOP_RET) || (op == DOP_INT) ||
+            (op == DOP_HALT) || (op == DOP_BAD) || (tj->reclen == TJIT_MAXTRACE))
+        {
+            return true;
+        }
+        tj->rec[tj->reclen].pc    = pc;
+        tj->rec[tj->reclen].taken = false;
+        tj->reclen++;
+
+        if (!vm_execute(c))
+            return false;
+
+        if (op == DOP_JPC)
+        {
+            tj->rec[tj->reclen-1].taken = (c->pc != pc+1);
+        }
+        if (((op == DOP_JMP) || (op == DOP_JPC)) && (c->pc <= pc))
+        {
+            // back at the head, or into some other loop
+            if (c->pc == head)
+            {
+                compile(tj, c);
+            }
+            return true;
+        }
+    }
+}
+
+void vm_tjit_run(vm_tjit_t *tj, vm_context_t *c)
+{
+    unsigned policy = VM_POLICY_HOT | VM_POLICY_TOS;
+    if (tj->count)
+        policy |= VM_POLICY_COUNT;
+    if (vm_needs_checks(c))
+        policy |= VM_POLICY_BOUNDS;
+    vm_engine_t cold = vm_engine(policy);
+
+    while(1)
+    {
+        cold(c);
+        if (c->stop != VM_STOP_HOT)
+            break;
+
+        uint16_t head = c->pc;
+        c->stop = VM_STOP_NONE;
+        if ((tj->traces[head] == NULL) && !record(tj, c, head))
+            break;
+
+        if (tj->traces[head] != NULL)
+        {
+            // stop at the next jump back to head to enter the trace again
+            tj->hot[head] = 1;
+            if (c->pc == head)
+            {
+                tj->nentries++;
+                ((void (*)(vm_context_t*)) tj->traces[head])(c);
+            }
+        }
+        else
+        {
+            // not traceable, never stop at head again
+            tj->hot[head] = 0;
+        }
+    }
+}
+
+#else
+
+bool vm_tjit_init(vm_tjit_t *tj, vm_context_t *c, bool count)
+{
+    tj->probes = NULL;
+    tj->hot    = NULL;
+    tj->traces = NULL;
+    tj->sizes  = NULL;
+    return false;
+}
+
+void vm_tjit_run(vm_tjit_t *tj, vm_context_t *c)
+{
+}
+
+void vm_tjit_free(vm_tjit_t *tj)
+{
+}
+
+#endif
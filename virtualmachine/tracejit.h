@@ -0,0 +1,45 @@
+/*
+
+    Tracing JIT for hot loops of the p-code virtual machine
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include "opcodes.h"
+
+#define TJIT_HOT        50      ///< backward jumps before a loop is traced
+#define TJIT_MAXTRACE   512     ///< max number of instructions in a trace
+
+typedef struct
+{
+    uint16_t    pc;             ///< recorded instruction
+    bool        taken;          ///< JPC: branch was taken while recording
+} tjit_rec_t;
+
+typedef struct
+{
+    uint16_t    *hot;           ///< per loop head: backward jumps until hot, see VM_POLICY_HOT
+    struct vm_probes_s *probes; ///< c->probes, holds hot while the tracing JIT is set up
+    void        **traces;       ///< per loop head: compiled trace or NULL
+    size_t      *sizes;         ///< per loop head: size of the trace code
+    bool        count;          ///< traces update c->inscount
+
+    uint16_t    head;           ///< loop head being recorded
+    uint16_t    reclen;         ///< number of recorded instructions
+    tjit_rec_t  rec[TJIT_MAXTRACE];
+
+    uint32_t    ntraces;        ///< number of compiled traces
+    uint32_t    nentries;       ///< number of times a trace was entered
+} vm_tjit_t;
+
+/** returns false if native traces are not available on this host;
+    c->probes must be set, see vm_probes_t */
+bool vm_tjit_init(vm_tjit_t *tj, vm_context_t *c, bool count);
+
+/** interpret the program until it stops, running hot loops as
+    native traces. Runs on c as an engine of vm_run_guarded(). */
+void vm_tjit_run(vm_tjit_t *tj, vm_context_t *c);
+
+void vm_tjit_free(vm_tjit_t *tj);
@@ -0,0 +1,343 @@
+/*
+
+    Load-time verifier: one pass over the control flow of
+    each procedure, an abstract stack depth per pc
+
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "vm.h"
+#include "verify.h"
+
+#define NOPROC  0xFFFF
+
+typedef struct
+{
+    uint16_t callee;
+    uint16_t depth;     // stack depth of the caller at the CAL
+} callsite_t;
+
+enum { UNSEEN, ONPATH, BOUNDED, RECURSES };
+
+typedef struct
+{
+    vm_verify_t *r;
+    const uint8_t *mem;
+    uint16_t   count;   // instructions
+    vm_dins_t  *code;   // plain decoded program
+    int32_t    *depth;  // cells above b-1 before pc, -1: not reached yet
+    uint16_t   *owner;  // procedure pc belongs to
+    uint16_t   *procat; // procedure entered at pc, or NOPROC
+    uint16_t   *work;   // pcs still to look at
+    uint32_t   nwork;
+    callsite_t *calls;  // grouped by caller, procedures are walked in turn
+    uint32_t   ncalls;
+    uint32_t   *firstcall; // of each procedure
+    uint8_t    *state;  // of each procedure while bounding the stack
+} verifier_t;
+
+static bool fail(verifier_t *v, uint16_t pc, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(v->r->msg, sizeof(v->r->msg), fmt, args);
+    va_end(args);
+    v->r->ok = false;
+    v->r->pc = pc;
+    return false;
+}
+
+// the packed instruction, before the decoder clamped anything
+static bool checkraw(verifier_t *v, uint16_t pc)
+{
+    if (pc == v->count)
+        return fail(v, pc, "the program runs off its end");
+
+    const uint8_t *src = v->mem + pc*sizeof(instruction_t);
+    uint8_t  opcode = src[0] & 0xF;
+    uint16_t imm16  = src[1] | (src[2] << 8);
+    if (opcode > VM_HALT)
+        return fail(v, pc, "illegal opcode %u", opcode);
+    if ((opcode == VM_OPR) && (imm16 > OPR_ININT))
+        return fail(v, pc, "illegal OPR function %u", imm16);
+    if (((opcode == VM_JMP) || (opcode == VM_JPC) || (opcode == VM_CAL)) && (imm16 >= v->count))
+        return fail(v, pc, "target %u is outside the program", imm16);
+    return true;
+}
+
+static uint16_t ancestor(const verifier_t *v, uint16_t p, uint8_t levels)
+{
+    while(levels-- > 0)
+        p = v->r->procs[p].parent;
+    return p;
+}
+
+// pc continues procedure p with the given stack depth
+static bool reach(verifier_t *v, uint16_t p, uint16_t pc, int32_t depth, uint16_t from)
+{
+    if (v->depth[pc] < 0)
+    {
+        v->depth[pc] = depth;
+        v->owner[pc] = p;
+        v->work[v->nwork++] = pc;
+        return true;
+    }
+    if (v->owner[pc] != p)
+        return fail(v, from, "reaches pc %u of the procedure at %u", pc,
+            v->r->procs[v->owner[pc]].entry);
+    if (v->depth[pc] != depth)
+        return fail(v, from, "reaches pc %u with %d stack cells, another path with %d", pc,
+            depth, v->depth[pc]);
+    return true;
+}
+
+// LOD/STO/LODX/STOX: the level selects an allocated frame,
+// the offset is inside it and at least 'lowest'
+static bool variable(verifier_t *v, uint16_t p, uint16_t pc, const vm_dins_t *ins, int16_t lowest)
+{
+    const vm_procinfo_t *proc = &v->r->procs[p];
+    if (ins->level > proc->depth)
+        return fail(v, pc, "level %u from static depth %u", ins->level, proc->depth);
+
+    uint16_t frame = v->r->procs[ancestor(v, p, ins->level)].frame;
+    if (frame == 0)
+        return fail(v, pc, "addresses a frame before its INT");
+    if ((ins->n < lowest) || (ins->n >= frame))
+        return fail(v, pc, "offset %d is outside %u..%u", ins->n, lowest, frame-1);
+    return true;
+}
+
+static bool call(verifier_t *v, uint16_t p, uint16_t pc, const vm_dins_t *ins)
+{
+    vm_verify_t *r = v->r;
+    if (ins->level > r->procs[p].depth)
+        return fail(v, pc, "level %u from static depth %u", ins->level, r->procs[p].depth);
+
+    uint16_t parent = ancestor(v, p, ins->level);
+    uint16_t q = v->procat[ins->a];
+    if (q == NOPROC)
+    {
+        q = r->nprocs++;
+        vm_procinfo_t *callee = &r->procs[q];
+        callee->entry    = ins->a;
+        callee->parent   = parent;
+        callee->depth    = r->procs[parent].depth + 1;
+        callee->frame    = 0;
+        callee->maxstack = 0;
+        callee->need     = 0;
+        v->procat[ins->a] = q;
+    }
+    else if (r->procs[q].parent != parent)
+    {
+        return fail(v, pc, "calls the procedure at %u with another static parent", ins->a);
+    }
+
+    v->calls[v->ncalls].callee = q;
+    v->calls[v->ncalls].depth  = v->depth[pc];
+    v->ncalls++;
+    return true;
+}
+
+static bool walk(verifier_t *v, uint16_t p)
+{
+    vm_procinfo_t *proc = &v->r->procs[p];
+    v->firstcall[p] = v->ncalls;
+    if (!reach(v, p, proc->entry, 0, proc->entry))
+        return false;
+
+    while(v->nwork > 0)
+    {
+        uint16_t pc = v->work[--v->nwork];
+        if (!checkraw(v, pc))
+            return false;
+
+        const vm_dins_t *ins = &v->code[pc];
+        int32_t depth = v->depth[pc];
+        int32_t in  = vm_effect[ins->op].in;
+        int32_t out = vm_effect[ins->op].out;
+        bool    next = true;
+        bool    ok = true;
+
+        // pops never reach into the frame
+        if (depth - in < (int32_t)proc->frame)
+            return fail(v, pc, "pops %d cells with %d on the operand stack", in,
+                depth - (int32_t)proc->frame);
+
+        switch(ins->op)
+        {
+        case DOP_LOD:
+            ok = variable(v, p, pc, ins, 0);
+            break;
+        case DOP_STO:
+        case DOP_LODX:
+        case DOP_STOX:
+            ok = variable(v, p, pc, ins, 3);    // not the frame header
+            break;
+        case DOP_CAL:
+            ok  = call(v, p, pc, ins);
+            out = 0;    // the callee's frame starts above, RET drops it
+            break;
+        case DOP_INT:
+            if ((depth == 0) && (proc->frame == 0))
+            {
+                if (ins->n < 3)
+                    return fail(v, pc, "INT %d leaves no room for the frame header", ins->n);
+                proc->frame = ins->n;
+            }
+            else if (depth + ins->n < proc->frame)
+            {
+                return fail(v, pc, "INT %d releases cells of the frame", ins->n);
+            }
+            out = ins->n;
+            break;
+        case DOP_JMP:
+            next = false;
+            ok   = reach(v, p, ins->a, depth, pc);
+            break;
+        case DOP_JPC:
+            ok = reach(v, p, ins->a, depth - 1, pc);
+            break;
+        case DOP_RET:
+        case DOP_HALT:
+            next = false;
+            break;
+        case DOP_BAD:
+            return fail(v, pc, "illegal instruction");
+        default:
+            break;
+        }
+        if (!ok)
+            return false;
+
+        depth += out - in;
+        if (depth > proc->maxstack)
+            proc->maxstack = (depth < UINT16_MAX) ? depth : UINT16_MAX;
+        if (next && !reach(v, p, pc+1, depth, pc))
+            return false;
+    }
+    return true;
+}
+
+// need of procedure p, false if it can reach a call cycle
+static bool bound(verifier_t *v, uint16_t p)
+{
+    vm_procinfo_t *proc = &v->r->procs[p];
+    if (v->state[p] == ONPATH)
+        v->r->recursive = proc->entry;
+    if (v->state[p] != UNSEEN)
+        return v->state[p] == BOUNDED;
+
+    v->state[p] = ONPATH;
+    uint32_t end = (p+1 < v->r->nprocs) ? v->firstcall[p+1] : v->ncalls;
+    uint32_t need = proc->maxstack;
+    bool bounded = true;
+    for(uint32_t i=v->firstcall[p]; i<end; i++)
+    {
+        const callsite_t *site = &v->calls[i];
+        if (bound(v, site->callee))
+        {
+            // CAL writes the 3 cells of the frame header even if the
+            // callee does not reserve them with INT
+            uint32_t callee = v->r->procs[site->callee].need;
+            callee = site->depth + ((callee > 3) ? callee : 3);
+            if (callee > need)
+                need = callee;
+        }
+        else
+        {
+            bounded = false;
+        }
+    }
+    proc->need  = bounded ? need : 0;
+    v->state[p] = bounded ? BOUNDED : RECURSES;
+    return bounded;
+}
+
+bool vm_verify_image(const uint8_t *mem, uint16_t count, uint16_t entry, vm_verify_t *r)
+{
+    verifier_t v;
+    v.r      = r;
+    v.mem    = mem;
+    v.count  = count;
+    v.code   = malloc((count+1)*sizeof(vm_dins_t));
+    v.depth  = malloc((count+1)*sizeof(int32_t));
+    v.owner  = malloc((count+1)*sizeof(uint16_t));
+    v.procat = malloc((count+1)*sizeof(uint16_t));
+    v.work   = malloc((count+1)*sizeof(uint16_t));
+    v.nwork  = 0;
+    v.calls  = malloc((count+1)*sizeof(callsite_t));
+    v.ncalls = 0;
+    v.firstcall = malloc((count+1)*sizeof(uint32_t));
+    v.state  = calloc(count+1, 1);
+
+    r->ok     = false;
+    r->pc     = 0;
+    r->msg[0] = 0;
+    r->procs  = malloc((count+1)*sizeof(vm_procinfo_t));
+    r->nprocs = 0;
+    r->stackcells = 0;
+    r->recursive  = 0;
+
+    if ((v.code == NULL) || (v.depth == NULL) || (v.owner == NULL) ||
+        (v.procat == NULL) || (v.work == NULL) || (v.calls == NULL) ||
+        (v.firstcall == NULL) || (v.state == NULL) || (r->procs == NULL))
+    {
+        fail(&v, 0, "out of memory");
+    }
+    else if (entry > count)
+    {
+        fail(&v, entry, "the entry is outside the program");
+    }
+    else
+    {
+        vm_decode(v.code, mem, count);
+        for(uint32_t pc=0; pc<=count; pc++)
+        {
+            v.depth[pc]  = -1;
+            v.procat[pc] = NOPROC;
+        }
+
+        // the program, then the procedures in the order they are found
+        r->ok = true;
+        r->procs[0].entry    = entry;
+        r->procs[0].parent   = 0;
+        r->procs[0].depth    = 0;
+        r->procs[0].frame    = 0;
+        r->procs[0].maxstack = 0;
+        r->procs[0].need     = 0;
+        r->nprocs = 1;
+        v.procat[entry] = 0;
+        for(uint16_t p=0; (p<r->nprocs) && walk(&v, p); p++)
+            ;
+
+        // cells 0..need of the program, t starts at 0
+        if (r->ok && bound(&v, 0))
+            r->stackcells = r->procs[0].need + 1;
+    }
+
+    free(v.state);
+    free(v.firstcall);
+    free(v.calls);
+    free(v.work);
+    free(v.procat);
+    free(v.owner);
+    free(v.depth);
+    free(v.code);
+    return r->ok;
+}
+
+bool vm_verify(vm_context_t *c, vm_verify_t *r)
+{
+    c->verified = vm_verify_image(c->mem, c->codelen, c->entry, r);
+    return c->verified;
+}
+
+void vm_verify_free(vm_verify_t *r)
+{
+    free(r->procs);
+    r->procs  = NULL;
+    r->nprocs = 0;
+}
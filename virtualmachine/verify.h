@@ -0,0 +1,69 @@
+/*
+
+    Load-time verifier of p-code programs
+
+    Follows the control flow of every procedure, starting
+    with the program at its entry and adding the target of every
+    CAL it finds. It checks that
+
+    * reachable instructions have a valid opcode and OPR
+      function, and do not run off the end of the program
+    * JMP, JPC and CAL targets are inside the program
+    * every procedure is called at one static depth, with
+      one static parent, and levels do not reach past the
+      program's frame
+    * LOD/STO/LODX/STOX address the frame of the procedure
+      the level selects: below the size its INT allocates,
+      and stores stay off the frame header
+    * the operand stack has the same depth on every path to
+      an instruction and is never popped into the frame
+
+    A verified program only leaves its frames through the
+    data dependent index of LODX/STOX or by recursing deeper
+    than the stack; the guard pages of a mapped stack turn
+    the latter into VM_STOP_OVERFLOW. Such programs run on
+    the engines without stack checks, see vm_needs_checks().
+
+    The verifier also bounds the data stack: the cells each
+    procedure uses for its frame and operands, and with the
+    procedures it calls. Unless the call graph has a cycle,
+    the bound of the program is all the stack it can use
+    (pdisasm --stack reports it, vm sizes the stack by it).
+
+*/
+
+#pragma once
+
+#include <stdbool.h>
+#include "opcodes.h"
+
+/** what the verifier found out about a procedure */
+typedef struct
+{
+    uint16_t entry;     ///< pc of the first instruction
+    uint16_t parent;    ///< index of the static parent, the program is its own
+    uint8_t  depth;     ///< static nesting depth, 0 for the program
+    uint16_t frame;     ///< cells allocated by its INT, header included
+    uint16_t maxstack;  ///< most cells above the frame base, frame included
+    uint32_t need;      ///< maxstack including the procedures it calls, 0 if it can recurse
+} vm_procinfo_t;
+
+typedef struct
+{
+    bool     ok;
+    uint16_t pc;        ///< offending instruction if not ok
+    char     msg[96];   ///< what is wrong with it
+    vm_procinfo_t *procs;   ///< in the order they were found
+    uint16_t nprocs;
+    uint32_t stackcells;    ///< data stack cells the program needs, 0 if it can recurse
+    uint16_t recursive;     ///< entry of a procedure on a call cycle if stackcells is 0
+} vm_verify_t;
+
+/** verify the count instructions at mem, run from entry, and describe
+    the result in r, which holds the procedures even if it fails.
+    Returns r->ok. */
+bool vm_verify_image(const uint8_t *mem, uint16_t count, uint16_t entry, vm_verify_t *r);
+
+/** verify the program of c and set c->verified accordingly */
+bool vm_verify(vm_context_t *c, vm_verify_t *r);
+void vm_verify_free(vm_verify_t *r);
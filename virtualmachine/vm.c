@@ -3,24 +3,133 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "vm.h"
+#include "profile.h"
+#include "callgraph.h"
+#include "tracebuf.h"
 
-void vm_init(vm_context_t *c, uint8_t *memptr, uint16_t memsize)
+// false if there is no memory for the stack, c->dstack is NULL then
+static bool setup(vm_context_t *c, uint32_t cells)
 {
-    c->dstack  = calloc(16384, sizeof(uint16_t));
-    c->mem     = memptr;
-    c->memsize = memsize;
+    c->dstack  = NULL;
+    c->stacksize = 0;
+    c->code    = NULL;
+    c->sharedcode = 0;
+    c->verified   = 0;
+    c->entry    = 0;
+    c->data     = NULL;
+    c->ndata    = 0;
+    c->breakpoints = NULL;
+    c->probes   = NULL;
+    vm_host_stdio(&c->host);
+    return vm_stack_resize(c, cells);
+}
+
+bool vm_init(vm_context_t *c, uint8_t *memptr, uint16_t memsize)
+{
+    if (!setup(c, VM_STACKSIZE))
+        return false;
+    vm_load(c, memptr, memsize);
+    vm_reset(c);
+    return true;
+}
+
+bool vm_share(vm_context_t *c, const vm_context_t *image)
+{
+    if (!setup(c, image->stacksize))
+        return false;
+    c->mem      = image->mem;
+    c->memsize  = image->memsize;
+    c->code     = image->code;
+    c->codelen  = image->codelen;
+    c->maxlevel = image->maxlevel;
+    c->verified = image->verified;
+    c->entry    = image->entry;
+    c->data     = image->data;
+    c->ndata    = image->ndata;
+    c->sharedcode = 1;
+    vm_reset(c);
+    return true;
+}
+
+void vm_reset(vm_context_t *c)
+{
+    vm_stack_clear(c);
     c->t  = 0;
     c->b  = 1;
-    c->pc = 0;
+    c->pc = c->entry;
     c->dstack[1] = 0;   // DL, base address
     c->dstack[2] = 0;   // old base
     c->dstack[3] = 0;   // return address
+    if ((c->data != NULL) && (4 + (uint32_t)c->ndata <= c->stacksize))
+        memcpy(&c->dstack[4], c->data, c->ndata*sizeof(int16_t));
     c->inscount = 0;
+    c->inslimit = SIZE_MAX;
+    c->stop = VM_STOP_NONE;
+}
+
+static void scanlevels(vm_context_t *c)
+{
+    c->maxlevel = 0;
+    for(uint16_t pc=0; pc<c->codelen; pc++)
+    {
+        switch(vm_unfused(c->code[pc].op))
+        {
+        case DOP_LOD:
+        case DOP_STO:
+        case DOP_LODX:
+        case DOP_STOX:
+        case DOP_CAL:
+            if (c->code[pc].level > c->maxlevel)
+                c->maxlevel = c->code[pc].level;
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+void vm_load(vm_context_t *c, uint8_t *memptr, uint16_t memsize)
+{
+    uint16_t count = memsize / sizeof(instruction_t);
+
+    if (!c->sharedcode)
+        free(c->code);
+    c->sharedcode = 0;
+    c->verified   = 0;
+    c->entry   = 0;
+    c->mem     = memptr;
+    c->memsize = memsize;
+    c->codelen = count;
+    c->code    = malloc((count+1)*sizeof(vm_dins_t));
+    vm_decode(c->code, memptr, count);
+    scanlevels(c);
+}
+
+bool vm_init_decoded(vm_context_t *c, uint8_t *memptr, uint16_t memsize, const vm_dins_t *code)
+{
+    uint16_t count = memsize / sizeof(instruction_t);
+    if ((code == NULL) || !vm_decode_check(code, memptr, count) ||
+        !setup(c, VM_STACKSIZE))
+    {
+        return false;
+    }
+
+    c->mem     = memptr;
+    c->memsize = memsize;
+    c->codelen = count;
+    c->code    = (vm_dins_t*)code;
+    c->sharedcode = 1;      // the image owns it
+    scanlevels(c);
+    vm_reset(c);
+    return true;
 }
 
 void vm_free(vm_context_t *c)
 {
-    free(c->dstack);
+    vm_stack_free(c);
+    if (!c->sharedcode)
+        free(c->code);
+    c->code = NULL;
 }
 
 uint16_t base(vm_context_t *c, uint16_t l)
@@ -34,198 +143,210 @@ uint16_t base(vm_context_t *c, uint16_t l)
     return b1;
 }
 
-int16_t readInt()
+void vm_push(vm_context_t *c, uint16_t v)
 {
-    int v;
-    printf("> ");
-    scanf("%d", &v);
-    return v;
+    c->t++;
+    c->dstack[c->t] = v;
 }
 
-void writeInt(int16_t v)
-{
-    printf("%d", v);
-    fflush(stdout);
-}
+/*
+    The interpreters, generated from vmcore.h. VM_POLICY
+    of the vm_run_pN variants is N, see the VM_POLICY_xxx bits.
+*/
+
+// single step for the debugger and the tracing JIT
+#define VM_RUN_NAME vm_execute
+#define VM_POLICY   (VM_POLICY_STEP | VM_POLICY_COUNT | VM_POLICY_BOUNDS)
+#include "vmcore.h"
+
+#define VM_POLICY 0
+#include "vmcore.h"
+#define VM_POLICY 1
+#include "vmcore.h"
+#define VM_POLICY 2
+#include "vmcore.h"
+#define VM_POLICY 3
+#include "vmcore.h"
+#define VM_POLICY 4
+#include "vmcore.h"
+#define VM_POLICY 5
+#include "vmcore.h"
+#define VM_POLICY 6
+#include "vmcore.h"
+#define VM_POLICY 7
+#include "vmcore.h"
+#define VM_POLICY 8
+#include "vmcore.h"
+#define VM_POLICY 9
+#include "vmcore.h"
+#define VM_POLICY 10
+#include "vmcore.h"
+#define VM_POLICY 11
+#include "vmcore.h"
+#define VM_POLICY 12
+#include "vmcore.h"
+#define VM_POLICY 13
+#include "vmcore.h"
+#define VM_POLICY 14
+#include "vmcore.h"
+#define VM_POLICY 15
+#include "vmcore.h"
+#define VM_POLICY 16
+#include "vmcore.h"
+#define VM_POLICY 17
+#include "vmcore.h"
+#define VM_POLICY 18
+#include "vmcore.h"
+#define VM_POLICY 19
+#include "vmcore.h"
+#define VM_POLICY 20
+#include "vmcore.h"
+#define VM_POLICY 21
+#include "vmcore.h"
+#define VM_POLICY 22
+#include "vmcore.h"
+#define VM_POLICY 23
+#include "vmcore.h"
+#define VM_POLICY 24
+#include "vmcore.h"
+#define VM_POLICY 25
+#include "vmcore.h"
+#define VM_POLICY 26
+#include "vmcore.h"
+#define VM_POLICY 27
+#include "vmcore.h"
+#define VM_POLICY 28
+#include "vmcore.h"
+#define VM_POLICY 29
+#include "vmcore.h"
+#define VM_POLICY 30
+#include "vmcore.h"
+#define VM_POLICY 31
+#include "vmcore.h"
+
+// execution profile, see profile.c
+#define VM_POLICY 32
+#include "vmcore.h"
+#define VM_POLICY 33
+#include "vmcore.h"
+#define VM_POLICY 48
+#include "vmcore.h"
+#define VM_POLICY 49
+#include "vmcore.h"
+
+// call-graph profile, see callgraph.c
+#define VM_POLICY 65
+#include "vmcore.h"
+#define VM_POLICY 81
+#include "vmcore.h"
+
+// instruction trace ring, see tracebuf.c
+#define VM_POLICY 128
+#include "vmcore.h"
+#define VM_POLICY 129
+#include "vmcore.h"
+#define VM_POLICY 144
+#include "vmcore.h"
+#define VM_POLICY 145
+#include "vmcore.h"
 
-int16_t readChar()
+// instruction budget, see vm --checkpoint-at
+#define VM_POLICY 257
+#include "vmcore.h"
+#define VM_POLICY 273
+#include "vmcore.h"
+// the same, checked, for programs vm_verify() did not pass
+#define VM_POLICY 261
+#include "vmcore.h"
+#define VM_POLICY 277
+#include "vmcore.h"
+
+// target cycle estimate, see target.c
+#define VM_POLICY 609
+#include "vmcore.h"
+#define VM_POLICY 625
+#include "vmcore.h"
+
+// hot loop heads, see tracejit.c
+#define VM_POLICY 2064
+#include "vmcore.h"
+#define VM_POLICY 2065
+#include "vmcore.h"
+#define VM_POLICY 2068
+#include "vmcore.h"
+#define VM_POLICY 2069
+#include "vmcore.h"
+
+static const vm_engine_t engines[32] =
 {
-    char v;
-    scanf("%c", &v);
-    return v;
-}
+    vm_run_p0,  vm_run_p1,  vm_run_p2,  vm_run_p3,
+    vm_run_p4,  vm_run_p5,  vm_run_p6,  vm_run_p7,
+    vm_run_p8,  vm_run_p9,  vm_run_p10, vm_run_p11,
+    vm_run_p12, vm_run_p13, vm_run_p14, vm_run_p15,
+    vm_run_p16, vm_run_p17, vm_run_p18, vm_run_p19,
+    vm_run_p20, vm_run_p21, vm_run_p22, vm_run_p23,
+    vm_run_p24, vm_run_p25, vm_run_p26, vm_run_p27,
+    vm_run_p28, vm_run_p29, vm_run_p30, vm_run_p31
+};
 
-void writeChar(int16_t v)
+vm_engine_t vm_engine(unsigned policy)
 {
-    printf("%c", (char)v);
-    fflush(stdout);
+    switch(policy)
+    {
+    case 32:
+        return vm_run_p32;
+    case 33:
+        return vm_run_p33;
+    case 48:
+        return vm_run_p48;
+    case 49:
+        return vm_run_p49;
+    case 65:
+        return vm_run_p65;
+    case 81:
+        return vm_run_p81;
+    case 128:
+        return vm_run_p128;
+    case 129:
+        return vm_run_p129;
+    case 144:
+        return vm_run_p144;
+    case 145:
+        return vm_run_p145;
+    case 257:
+        return vm_run_p257;
+    case 273:
+        return vm_run_p273;
+    case 261:
+        return vm_run_p261;
+    case 277:
+        return vm_run_p277;
+    case 609:
+        return vm_run_p609;
+    case 625:
+        return vm_run_p625;
+    case 2064:
+        return vm_run_p2064;
+    case 2065:
+        return vm_run_p2065;
+    case 2068:
+        return vm_run_p2068;
+    case 2069:
+        return vm_run_p2069;
+    default:
+        return (policy < 32) ? engines[policy] : NULL;
+    }
 }
 
-void vm_push(vm_context_t *c, uint16_t v)
+vm_stop_t vm_run(vm_context_t *c, size_t budget)
 {
-    c->t++;
-    c->dstack[c->t] = v;
+    c->inslimit = (budget < SIZE_MAX - c->inscount) ? c->inscount + budget : SIZE_MAX;
+    // VM_POLICY_LIMIT | VM_POLICY_COUNT | VM_POLICY_TOS, and BOUNDS unless verified
+    vm_run_guarded(c, vm_needs_checks(c) ? vm_run_p277 : vm_run_p273);
+    return c->stop;
 }
 
-bool vm_execute(vm_context_t *c)
+bool vm_needs_checks(const vm_context_t *c)
 {
-    instruction_t *ins = (instruction_t *)(c->mem + c->pc*sizeof(instruction_t));
-    uint16_t level = 0;
-    uint16_t imm16 = ins->opt16;
-    uint16_t idx   = 0; // index for array operations
-
-    c->pc++;
-    c->inscount++;
-    switch(ins->opcode & 0xF)
-    {
-    case VM_LIT:    // load literal constant 0,n
-        c->t++;
-        c->dstack[c->t] = imm16;
-        break;
-    case VM_OPR:    // arithmetic or logical operation 0,n
-        switch(imm16)
-        {
-        case OPR_RET:   // return from procedure
-            c->t  = c->b-1;
-            c->pc = c->dstack[c->t+3];
-            c->b  = c->dstack[c->t+2];
-            break;
-        case OPR_NEG:
-            c->dstack[c->t] = -c->dstack[c->t];
-            break;
-        case OPR_ADD:
-            c->t--;
-            c->dstack[c->t] += c->dstack[c->t+1];
-            break;
-        case OPR_SUB:
-            c->t--;
-            c->dstack[c->t] -= c->dstack[c->t+1];
-            break;
-        case OPR_MUL:
-            c->t--;
-            c->dstack[c->t] *= c->dstack[c->t+1];
-            break;
-        case OPR_DIV:
-            c->t--;
-            c->dstack[c->t] /= c->dstack[c->t+1];
-            break;
-        case OPR_ODD:
-            c->dstack[c->t] = c->dstack[c->t] & 1;
-            break;
-        case OPR_EQ:
-            c->t--;
-            c->dstack[c->t] = (c->dstack[c->t] == c->dstack[c->t+1]) ? 1 : 0;
-            break;
-        case OPR_NEQ:
-            c->t--;
-            c->dstack[c->t] = (c->dstack[c->t] != c->dstack[c->t+1]) ? 1 : 0;
-            break;
-        case OPR_LESS:
-            c->t--;        
-            c->dstack[c->t] = (c->dstack[c->t] < c->dstack[c->t+1]) ? 1 : 0;
-            break;            
-        case OPR_LEQ:
-            c->t--;
-            c->dstack[c->t] = (c->dstack[c->t] <= c->dstack[c->t+1]) ? 1 : 0;
-            break;            
-        case OPR_GREATER:
-            c->t--;
-            c->dstack[c->t] = (c->dstack[c->t] > c->dstack[c->t+1]) ? 1 : 0;
-            break;            
-        case OPR_GEQ:
-            c->t--;
-            c->dstack[c->t] = (c->dstack[c->t] >= c->dstack[c->t+1]) ? 1 : 0;
-            break;
-        case OPR_OUTCHAR:
-            writeChar(c->dstack[c->t]);
-            c->t--;
-            break;                 
-        case OPR_OUTINT:
-            writeInt(c->dstack[c->t]);
-            c->t--;
-            break;                           
-        case OPR_INCHAR:
-            c->t++;
-            c->dstack[c->t] = readChar();
-            break;
-        case OPR_ININT:
-            c->t++;
-            c->dstack[c->t] = readInt();
-            break; 
-        case OPR_SHR:
-            c->dstack[c->t] = ((uint16_t)c->dstack[c->t]) >> 1;
-            break;
-        case OPR_SAR:
-            c->dstack[c->t] >>= 1;
-            break;
-        case OPR_SHL:
-            c->dstack[c->t] <<= 1;
-            break;
-        default:
-            //error
-            break;
-        }
-        break;
-    case VM_LOD:    // load variable l,d
-        level = (ins->opcode >> 4); // level
-        //printf("Level B = %d\n", base(c,level));
-        c->t++;
-        c->dstack[c->t] = c->dstack[(uint16_t)(base(c,level) + (int16_t)imm16)];
-        //if (level != 0)
-        //{
-        //    printf("Loading from dstack address %d\n", (uint16_t)(base(c,level) + (int16_t)imm16));
-        //}
-        break;
-    case VM_STO:    // load indexed variable l,d
-        level = (ins->opcode >> 4); // level
-        //printf("0x%04X\t Level B = %d -> ofs = %d\n", c->pc, base(c,level), imm16);
-        c->dstack[(uint16_t)(base(c,level) + (int16_t)imm16)] = c->dstack[c->t];
-        c->t--;
-        //if (level != 0)
-        //{
-        //    printf("Storing to dstack address %d\n", (uint16_t)(base(c,level) + (int16_t)imm16));
-        //}        
-        break;
-    case VM_LODX:
-        idx = c->dstack[c->t];  // get index / offset
-        level = (ins->opcode >> 4); // level
-        c->dstack[c->t] = c->dstack[(uint16_t)(base(c,level) + (int16_t)imm16) + idx];
-        break;
-    case VM_STOX:
-        idx = c->dstack[c->t-1];  // get index / offset
-        level = (ins->opcode >> 4); // level
-        c->dstack[(uint16_t)(base(c,level) + (int16_t)imm16) + idx] = c->dstack[c->t];
-        c->t-=2;
-        break;
-    case VM_CAL:    // call procedure or function v,a
-    {
-        level = (ins->opcode >> 4); // level
-        uint16_t prevbp = base(c,level);
-        c->dstack[c->t+1] = prevbp;
-        c->dstack[c->t+2] = c->b;
-        c->dstack[c->t+3] = c->pc;
-        c->b=c->t+1;
-        c->pc=imm16;
-    }
-        break;
-    case VM_INT:    // increment stack pointer 0,n
-        c->t += (int16_t)imm16;
-        break;
-    case VM_JMP:    // unconditional jump 0,a
-        c->pc = imm16;
-        break;
-    case VM_JPC:    // conditional jump 0,a
-        if (c->dstack[c->t] == 0)
-        {
-            c->pc = imm16;
-        }
-        c->t--;
-        break;
-    case VM_HALT:
-        return false;
-    default:
-        // error!
-        return false;
-    }
-    return true;
+    return !c->verified || !c->stackmapped;
 }
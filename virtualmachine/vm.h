@@ -3,8 +3,172 @@
 #include <stdbool.h>
 #include "opcodes.h"
 
-void vm_init(vm_context_t *c, uint8_t *memptr, uint16_t memsize);
+#define VM_STACKSIZE    16384   ///< default data stack cells
+#define VM_STACKMAX     65536   ///< t and b are 16 bit
+
+struct vm_callgraph_s;
+struct vm_ring_s;
+
+/** state of the profilers and tracers, which vm_context_t.probes
+    points to. The interpreter variants that need a part of it
+    (VM_POLICY_PROFILE, _TARGET, _CALLS, _RING) use it; whoever runs
+    them sets it up, zeroed, before vm_profile_init() and the like. */
+typedef struct vm_probes_s
+{
+    uint64_t *pccount;  ///< codelen+1 execution counts for VM_POLICY_PROFILE
+    uint64_t *opcycles; ///< DOP_COUNT host cycle sums for VM_POLICY_PROFILE, or NULL
+    uint32_t *tcost;    ///< codelen+1 target cycles per pc for VM_POLICY_TARGET
+    uint64_t tcycles;   ///< target cycles of the executed instructions
+    struct vm_callgraph_s *calls;   ///< call-graph profile for VM_POLICY_CALLS
+    struct vm_ring_s *ring;         ///< instruction trace for VM_POLICY_RING
+    uint16_t *hot;      ///< codelen+1 loop head countdowns for VM_POLICY_HOT, 0: never stop
+} vm_probes_t;
+
+/** set up c with a stack of VM_STACKSIZE cells and the stdio host,
+    and load the program. Returns false if there is no memory for
+    the stack; c is then only good for vm_free(). */
+bool vm_init(vm_context_t *c, uint8_t *memptr, uint16_t memsize);
 void vm_free(vm_context_t *c);
+
+/** set up c to run the program of image, which is not copied:
+    the decoded code is shared read-only and must outlive c.
+    c gets its own stack of the same size and the stdio host.
+    Returns false, as vm_init(), if there is no memory for it. */
+bool vm_share(vm_context_t *c, const vm_context_t *image);
+
+/** restart the program with a cleared stack, as after vm_init() */
+void vm_reset(vm_context_t *c);
+
+/** replace the stack of c with a cleared one of at least 'cells'
+    cells (4..VM_STACKMAX), rounded up to whole pages. vm_init()
+    sets up VM_STACKSIZE cells. Returns false if there is no memory. */
+bool vm_stack_resize(vm_context_t *c, uint32_t cells);
+void vm_stack_free(vm_context_t *c);
+
+/** zero the whole stack */
+void vm_stack_clear(vm_context_t *c);
+
+/** (re)load a packed program image and decode it */
+void vm_load(vm_context_t *c, uint8_t *memptr, uint16_t memsize);
+
+/** decode count packed instructions into dst, which must hold count+1 entries */
+void vm_decode(vm_dins_t *dst, const uint8_t *mem, uint16_t count);
+
+/** is code (count+1 entries) what vm_decode() and vm_fuse() make of mem? */
+bool vm_decode_check(const vm_dins_t *code, const uint8_t *mem, uint16_t count);
+
+/** as vm_init(), but use the decoded and fused program in code
+    (e.g. the section of a mapped image, see image.h) in place if
+    vm_decode_check() accepts it. Returns false if it does not, or
+    if there is no memory for the stack; c is then not set up, and
+    vm_init() and vm_fuse() do it the usual way. */
+bool vm_init_decoded(vm_context_t *c, uint8_t *memptr, uint16_t memsize, const vm_dins_t *code);
+
+/** rewrite common instruction sequences into superinstructions */
+void vm_fuse(vm_dins_t *code, uint16_t count);
+
+/** the plain opcode a superinstruction starts with */
+uint8_t vm_unfused(uint8_t op);
+
+/** host interface on stdin/stdout, set up by vm_init();
+    see hostio.h for memory and file descriptor hosts */
+void vm_host_stdio(vm_host_t *h);
+
+/** parse an integer like scanf("%d"), returns the position after it,
+    or p with *v = 0 if there is none */
+const char* vm_parseint(const char *p, const char *end, int16_t *v);
+
+/** write v in decimal so that it ends at end (needs 6 chars), returns the start */
+char* vm_formatint(char *end, int16_t v);
+
+/** when buffered console output is written to stdout */
+typedef enum
+{
+    VM_FLUSH_INTERACTIVE,   ///< on newline and before input
+    VM_FLUSH_BLOCK,         ///< in fixed size blocks
+    VM_FLUSH_EXIT           ///< when the buffer is full and at exit
+} vm_flush_t;
+
+void vm_console_policy(vm_flush_t p);
+void vm_console_flush();
+
+/** take ININT/INCHAR input from a file instead of the console */
+bool vm_console_input(const char *fname);
+void vm_console_close();
+
+/** name of a decoded opcode */
+const char* vm_dopname(uint8_t op);
+
+/** stack effect of a decoded opcode: the VM needs t >= in,
+    and the instruction writes at most out cells above t-in */
+typedef struct
+{
+    uint8_t in;
+    uint8_t out;
+} vm_effect_t;
+
+extern const vm_effect_t vm_effect[DOP_COUNT];
+
+/** why the VM stopped, in vm_context_t.stop */
+typedef enum
+{
+    VM_STOP_NONE = 0,       ///< still running (vm_execute)
+    VM_STOP_HALT,           ///< HALT instruction
+    VM_STOP_BAD,            ///< illegal instruction or end of program
+    VM_STOP_BOUNDS,         ///< stack access out of bounds, pc is the instruction
+    VM_STOP_BREAK,          ///< breakpoint at pc, not yet executed
+    VM_STOP_LIMIT,          ///< inscount reached inslimit, pc is the next instruction
+    VM_STOP_OVERFLOW,       ///< access outside the stack, see vm_run_guarded(); pc, t and b are stale
+    VM_STOP_INPUT,          ///< input not ready (vm_host_t.ready), pc is the ININT/INCHAR
+    VM_STOP_HOT             ///< loop head at pc got hot (VM_POLICY_HOT), not yet executed
+} vm_stop_t;
+
+/** compile-time policies of the interpreter variants */
+#define VM_POLICY_COUNT     1   ///< count instructions in inscount
+#define VM_POLICY_TRACE     2   ///< print each instruction to stderr
+#define VM_POLICY_BOUNDS    4   ///< check stack accesses
+#define VM_POLICY_BREAK     8   ///< stop at breakpoints
+#define VM_POLICY_TOS       16  ///< keep the top of stack in a register
+#define VM_POLICY_PROFILE   32  ///< execution profile, see profile.h
+#define VM_POLICY_CALLS     64  ///< call-graph profile, see callgraph.h
+#define VM_POLICY_RING      128 ///< instruction trace ring, see tracebuf.h
+#define VM_POLICY_LIMIT     256 ///< stop when inscount reaches inslimit
+#define VM_POLICY_TARGET    512 ///< sum target cycles in tcycles, see target.h
+#define VM_POLICY_STEP      1024 ///< vm_execute() only
+#define VM_POLICY_HOT       2048 ///< stop at hot loop heads, see tracejit.h
+
+typedef void (*vm_engine_t)(vm_context_t *c);
+
+/** the interpreter variant that has exactly the given policies.
+    VM_POLICY_PROFILE and VM_POLICY_CALLS only combine with
+    TOS and need COUNT, VM_POLICY_RING combines with TOS and COUNT,
+    VM_POLICY_LIMIT with TOS and BOUNDS and needs COUNT, VM_POLICY_TARGET
+    comes with PROFILE, CALLS and COUNT and combines with TOS,
+    VM_POLICY_HOT comes with TOS and combines with COUNT and BOUNDS;
+    returns NULL for combinations that are not built. */
+vm_engine_t vm_engine(unsigned policy);
+
 void vm_push(vm_context_t *c, uint16_t v);
+
+/** execute one instruction with counting and bounds checks,
+    returns false when the VM stopped (see c->stop) */
 bool vm_execute(vm_context_t *c);
 
+/** run engine on c. An access outside the stack stops c with
+    VM_STOP_OVERFLOW, caught by the guard pages at no cost per
+    instruction. Safe to use from several threads at once. */
+void vm_run_guarded(vm_context_t *c, vm_engine_t engine);
+
+/** run at most budget instructions (SIZE_MAX: no limit), counting
+    them, with threaded dispatch where the compiler supports it.
+    Returns why the VM stopped; after VM_STOP_LIMIT (budget used
+    up) or VM_STOP_INPUT (see vm_host_t.ready) the next call
+    resumes the program. Guarded as vm_run_guarded(), and with
+    stack checks if vm_needs_checks(). */
+vm_stop_t vm_run(vm_context_t *c, size_t budget);
+
+/** must c run on an engine with VM_POLICY_BOUNDS? Only programs
+    that passed vm_verify() (see verify.h) on a stack with guard
+    pages can do without. */
+bool vm_needs_checks(const vm_context_t *c);
+
@@ -0,0 +1,755 @@
+/*
+
+    Interpreter core of the p-code virtual machine
+
+    Not a normal header: vm.c includes this file once per
+    interpreter variant. VM_POLICY selects the variant as a
+    set of VM_POLICY_xxx bits (see vm.h):
+
+    VM_POLICY_COUNT     count executed instructions
+    VM_POLICY_TRACE     print every instruction to stderr
+    VM_POLICY_BOUNDS    check stack accesses, stop with VM_STOP_BOUNDS
+    VM_POLICY_BREAK     stop with VM_STOP_BREAK at c->breakpoints
+    VM_POLICY_TOS       keep the top of stack in a local
+    VM_POLICY_PROFILE   count executions per pc in c->probes->pccount,
+                        and host cycles per opcode in c->probes->opcycles
+    VM_POLICY_CALLS     report CAL and RET to the c->probes->calls profiler
+    VM_POLICY_RING      record every instruction in the c->probes->ring buffer
+    VM_POLICY_LIMIT     stop with VM_STOP_LIMIT once c->inslimit
+                        instructions are counted, and with
+                        VM_STOP_INPUT before input that is not
+                        ready (c->host.ready)
+    VM_POLICY_TARGET    sum c->probes->tcost[pc] of every instruction in
+                        c->probes->tcycles, current at every CALLS event
+    VM_POLICY_STEP      execute one instruction (vm_execute)
+    VM_POLICY_HOT       count down c->probes->hot[head] on every taken
+                        backward jump to head, stop with VM_STOP_HOT
+                        before head when it reaches 0
+
+    The function is named VM_RUN_NAME if that is defined,
+    otherwise it is the static vm_run_p<VM_POLICY> and
+    VM_POLICY must be a plain number. Policies that are not selected
+    generate no code at all.
+
+    Without VM_POLICY_STEP the program runs until it stops.
+    The fetch and dispatch happen inline on the decoded
+    program, with pc, t and b held in locals. With GCC/Clang
+    the handlers are chained through a label table (direct
+    threading), other compilers get the equivalent switch
+    loop.
+
+    Variables are addressed through a display: disp[l] is the
+    frame base of static level l, i.e. base(c,l). It is rebuilt
+    from the static links on CAL and RET only, so LOD/STO and
+    friends don't walk the chain. The frame layout on dstack
+    is unchanged.
+
+    With VM_POLICY_TOS, dstack[t] lives in 'tos' and the cell
+    in memory is stale. Binary operators then read one cell
+    instead of reading two and writing one. The cell is
+    spilled before anything that addresses dstack directly
+    (CAL, INT, LODX/STOX, the superinstructions) and at exit.
+
+    VM_POLICY_STEP and VM_POLICY_BREAK dispatch on the plain
+    opcode of superinstructions (vm_unfused()), so every
+    instruction of a fused sequence is stepped or checked
+    for a breakpoint on its own. VM_POLICY_RING records a
+    superinstruction once, so it is meant for unfused code.
+
+*/
+
+#if defined(__GNUC__) && !defined(VM_NO_COMPUTED_GOTO)
+#define VM_THREADED
+#endif
+
+#define VM_CAT_(a, b)   a##b
+#define VM_CAT(a, b)    VM_CAT_(a, b)
+
+#ifndef VM_RUN_NAME
+#define VM_RUN_NAME     VM_CAT(vm_run_p, VM_POLICY)
+#define VM_RUN_STATIC   static
+#else
+#define VM_RUN_STATIC
+#endif
+
+#if VM_POLICY & VM_POLICY_TOS
+    #define TOP         tos
+    #define RHS         tos
+    #define SPILL()     s[t] = tos
+    #define FILL()      tos = s[t]
+    #define PUSH(v)     do { s[t] = tos; t++; tos = (v); } while(0)
+    #define DROP()      do { t--; tos = s[t]; } while(0)
+#else
+    #define TOP         s[t]
+    #define RHS         s[t+1]
+    #define SPILL()
+    #define FILL()
+    #define PUSH(v)     do { t++; s[t] = (v); } while(0)
+    #define DROP()      t--
+#endif
+
+#if VM_POLICY & VM_POLICY_COUNT
+    #define COUNT(k)    n += (k)
+    // the host may read the instruction count (vm --record)
+    #define SYNCCOUNT() c->inscount = n
+#else
+    #define COUNT(k)
+    #define SYNCCOUNT()
+#endif
+
+#if VM_POLICY & VM_POLICY_PROFILE
+    // a superinstruction also counts the instructions it covers
+    #define PROFILE(op) \
+        pcc[pc]++; \
+        if (cyc != NULL) \
+        { \
+            uint64_t now = vm_cycles(); \
+            cyc[lastop] += now - last; \
+            last   = now; \
+            lastop = op; \
+        }
+    #define COVER(k) \
+        for(uint16_t j=1; j<=(k); j++) \
+            pcc[(ins - code) + j]++
+#else
+    #define PROFILE(op)
+    #define COVER(k)
+#endif
+
+#if VM_POLICY & VM_POLICY_TARGET
+    #define TARGET()    tc += tcost[pc]
+    #define SYNCTARGET() c->probes->tcycles = tc
+#else
+    #define TARGET()
+    #define SYNCTARGET()
+#endif
+
+#if VM_POLICY & VM_POLICY_CALLS
+    // the profiler reads c->probes->tcycles
+    #define CALLENTER(proc) SYNCTARGET(); vm_calls_enter(c->probes->calls, proc, n)
+    #define CALLLEAVE()     SYNCTARGET(); vm_calls_leave(c->probes->calls, n)
+#else
+    #define CALLENTER(proc)
+    #define CALLLEAVE()
+#endif
+
+#if VM_POLICY & VM_POLICY_BOUNDS
+    #define CHECK(a)    if ((uint32_t)(a) >= ssize) goto fault
+    // stack effect of the instruction about to be executed
+    #define CHECKEFFECT(op) \
+        if ((t < vm_effect[op].in) || \
+            ((uint32_t)t + vm_effect[op].out >= ssize + vm_effect[op].in)) \
+            goto fault
+#else
+    #define CHECK(a)
+    #define CHECKEFFECT(op)
+#endif
+
+#if VM_POLICY & VM_POLICY_TRACE
+    #define TRACE(op) \
+        fprintf(stderr, "%5u  %-24s %2u %6d   t=%u b=%u top=%d\n", \
+            pc, vm_dopname(op), ins->level, ins->n, t, b, \
+            ((t > 0) && (t < ssize)) ? TOP : 0)
+#else
+    #define TRACE(op)
+#endif
+
+#if VM_POLICY & VM_POLICY_RING
+    #define RINGTOS (((t > 0) && (t < ssize)) ? TOP : 0)
+    // the record is complete before head moves past it
+    #define RINGREC(at, dop, rt, rtos, rlevel) \
+        do { \
+            vm_ringrec_t *r = &ring[rhead & rmask]; \
+            r->pc    = (at); \
+            r->t     = (rt); \
+            r->b     = b; \
+            r->tos   = (rtos); \
+            r->op    = (dop); \
+            r->level = (rlevel); \
+            rhead++; \
+            atomic_store_explicit(&rg->head, rhead, memory_order_release); \
+        } while(0)
+    // a superinstruction is recorded with its own opcode,
+    // the instructions it covers with RECORDAT()
+    #define RECORD(op) \
+        RINGREC(pc, op, t, RINGTOS, ins->level)
+    // the k-th instruction of a superinstruction, dt cells above
+    // t with rtos on top, as the plain sequence would have it
+    #define RECORDAT(k, dop, dt, rtos) \
+        RINGREC((uint16_t)((ins - code) + (k)), dop, (uint16_t)(t + (dt)), (int16_t)(rtos), ins[k].level)
+#else
+    #define RECORD(op)
+    #define RECORDAT(k, dop, dt, rtos)
+#endif
+
+#if VM_POLICY & VM_POLICY_BREAK
+    // the first instruction is not checked, so the VM
+    // can be resumed at a breakpoint.
+    #define CHECKBREAK() \
+        if (armed && (bp != NULL) && bp[pc]) { stop = VM_STOP_BREAK; goto done; } \
+        armed = true
+#else
+    #define CHECKBREAK()
+#endif
+
+#if VM_POLICY & VM_POLICY_LIMIT
+    // a superinstruction completes, so the count can pass the limit
+    #define CHECKLIMIT() \
+        if (n >= limit) { stop = VM_STOP_LIMIT; goto done; }
+    // the input instruction is not counted and runs again on resume
+    #define WAITINPUT(number) \
+        if ((c->host.ready != NULL) && !c->host.ready(c->host.user, number)) \
+        { \
+            stop = VM_STOP_INPUT; \
+            pc = ins - code; \
+            n--; \
+            goto done; \
+        }
+#else
+    #define CHECKLIMIT()
+    #define WAITINPUT(number)
+#endif
+
+#if VM_POLICY & VM_POLICY_HOT
+    // pc is the jump target, ins the jump; counters at 0 stay there
+    #define BACKEDGE() \
+        if ((pc <= (uint16_t)(ins - code)) && (hot[pc] != 0) && (--hot[pc] == 0)) \
+        { \
+            stop = VM_STOP_HOT; \
+            goto done; \
+        }
+#else
+    #define BACKEDGE()
+#endif
+
+#if VM_POLICY & (VM_POLICY_STEP | VM_POLICY_BREAK)
+    #define OPCODE(ins) vm_unfused((ins)->op)
+#else
+    #define OPCODE(ins) (ins)->op
+#endif
+
+// fetch the instruction at pc, pc then points past it
+#define FETCH() \
+    CHECKLIMIT(); \
+    CHECKBREAK(); \
+    ins = &code[pc]; \
+    op  = OPCODE(ins); \
+    TRACE(op); \
+    RECORD(op); \
+    CHECKEFFECT(op); \
+    PROFILE(op); \
+    TARGET(); \
+    pc++; \
+    COUNT(1)
+
+#if VM_POLICY & VM_POLICY_STEP
+VM_RUN_STATIC bool VM_RUN_NAME(vm_context_t *c)
+#else
+VM_RUN_STATIC void VM_RUN_NAME(vm_context_t *c)
+#endif
+{
+    const vm_dins_t *code = c->code;
+    int16_t  *s  = c->dstack;
+    uint16_t pc  = c->pc;
+    uint16_t t   = c->t;
+    uint16_t b   = c->b;
+    size_t   n   = c->inscount;
+    const vm_dins_t *ins = &code[pc];
+    uint8_t  op;
+    uint8_t  stop = VM_STOP_NONE;
+    uint16_t idx;
+    uint16_t adr;
+    int16_t  v;
+    uint16_t disp[16];
+    uint8_t  nlevels = c->maxlevel + 1;
+#if VM_POLICY & VM_POLICY_TOS
+    int16_t  tos;
+#endif
+#if VM_POLICY & (VM_POLICY_BOUNDS | VM_POLICY_TRACE | VM_POLICY_RING)
+    uint32_t ssize = c->stacksize;
+#endif
+#if VM_POLICY & VM_POLICY_PROFILE
+    uint64_t *pcc = c->probes->pccount;
+    uint64_t *cyc = c->probes->opcycles;
+    uint64_t last = (cyc != NULL) ? vm_cycles() : 0;
+    uint8_t  lastop = c->code[pc].op;
+#endif
+#if VM_POLICY & VM_POLICY_RING
+    vm_ring_t    *rg    = c->probes->ring;
+    vm_ringrec_t *ring  = rg->rec;
+    uint32_t     rmask  = rg->mask;
+    uint64_t     rhead  = atomic_load_explicit(&rg->head, memory_order_relaxed);
+#endif
+#if VM_POLICY & VM_POLICY_LIMIT
+    size_t   limit = c->inslimit;
+#endif
+#if VM_POLICY & VM_POLICY_TARGET
+    const uint32_t *tcost = c->probes->tcost;
+    uint64_t tc = c->probes->tcycles;
+#endif
+#if VM_POLICY & VM_POLICY_HOT
+    uint16_t *hot = c->probes->hot;
+#endif
+#if VM_POLICY & VM_POLICY_BREAK
+    const uint8_t *bp = c->breakpoints;
+    bool     armed = false;
+#endif
+
+    // the display of the frame at base
+    #define SYNC_DISPLAY(base) \
+        do { \
+            disp[0] = (base); \
+            for(uint8_t l=1; l<nlevels; l++) \
+            { \
+                CHECK(disp[l-1]); \
+                disp[l] = s[disp[l-1]]; \
+            } \
+        } while(0)
+
+    SYNC_DISPLAY(b);
+    FILL();
+#if VM_POLICY & VM_POLICY_CALLS
+    vm_calls_resume(c->probes->calls, n);
+#endif
+
+#ifdef VM_THREADED
+    static void * const optable[DOP_COUNT] =
+    {
+        &&L_DOP_LIT, &&L_DOP_LOD, &&L_DOP_STO, &&L_DOP_CAL,
+        &&L_DOP_INT, &&L_DOP_JMP, &&L_DOP_JPC, &&L_DOP_LODX,
+        &&L_DOP_STOX, &&L_DOP_HALT, &&L_DOP_RET, &&L_DOP_NEG,
+        &&L_DOP_ADD, &&L_DOP_SUB, &&L_DOP_MUL, &&L_DOP_DIV,
+        &&L_DOP_ODD, &&L_DOP_NOP, &&L_DOP_EQ, &&L_DOP_NEQ,
+        &&L_DOP_LESS, &&L_DOP_LEQ, &&L_DOP_GREATER, &&L_DOP_GEQ,
+        &&L_DOP_SHR, &&L_DOP_SHL, &&L_DOP_SAR, &&L_DOP_OUTCHAR,
+        &&L_DOP_OUTINT, &&L_DOP_INCHAR, &&L_DOP_ININT, &&L_DOP_BAD,
+        &&L_DOP_LOD_LIT_ADD_STO, &&L_DOP_LIT_OUTCHAR_LIT_OUTCHAR,
+        &&L_DOP_LIT_STO, &&L_DOP_LOD_STO,
+        &&L_DOP_LOD_ADD, &&L_DOP_LOD_SUB, &&L_DOP_LOD_MUL, &&L_DOP_LOD_DIV,
+        &&L_DOP_LOD_LOD_ADD, &&L_DOP_LOD_LOD_SUB,
+        &&L_DOP_LOD_LOD_MUL, &&L_DOP_LOD_LOD_DIV,
+        &&L_DOP_LOD_EQ_JPC, &&L_DOP_LOD_NEQ_JPC,
+        &&L_DOP_LOD_LESS_JPC, &&L_DOP_LOD_LEQ_JPC,
+        &&L_DOP_LOD_GREATER_JPC, &&L_DOP_LOD_GEQ_JPC,
+        &&L_DOP_LOD_LOD_EQ_JPC, &&L_DOP_LOD_LOD_NEQ_JPC,
+        &&L_DOP_LOD_LOD_LESS_JPC, &&L_DOP_LOD_LOD_LEQ_JPC,
+        &&L_DOP_LOD_LOD_GREATER_JPC, &&L_DOP_LOD_LOD_GEQ_JPC,
+        &&L_DOP_LOD_LIT_EQ_JPC, &&L_DOP_LOD_LIT_NEQ_JPC,
+        &&L_DOP_LOD_LIT_LESS_JPC, &&L_DOP_LOD_LIT_LEQ_JPC,
+        &&L_DOP_LOD_LIT_GREATER_JPC, &&L_DOP_LOD_LIT_GEQ_JPC
+    };
+
+    #define DISPATCH()  do { FETCH(); goto *optable[op]; } while(0)
+    #define CASE(x)     L_##x:
+    #define LOOP_BEGIN() DISPATCH();
+    #define LOOP_END()
+#else
+    #define DISPATCH()  continue
+    #define CASE(x)     case x:
+    #define LOOP_BEGIN() while(1) { FETCH(); switch(op) {
+    #define LOOP_END()  } }
+#endif
+
+#if VM_POLICY & VM_POLICY_STEP
+    #define NEXT()      goto done
+#else
+    #define NEXT()      DISPATCH()
+#endif
+
+    // binary operator: t-1 op t -> t-1
+    #define BINOP(op) \
+        t--; \
+        TOP = s[t] op RHS; \
+        NEXT();
+
+    #define CMPOP(op) \
+        t--; \
+        TOP = (s[t] op RHS) ? 1 : 0; \
+        NEXT();
+
+    LOOP_BEGIN()
+
+    CASE(DOP_LIT)
+        PUSH(ins->n);
+        NEXT();
+
+    CASE(DOP_RET)
+        // return address and old base; a fault leaves t, b and pc
+        // as they were, the display is set up again on resume
+        CHECK(b+2);
+        adr = s[b+2];
+        idx = s[b+1];
+#if VM_POLICY & VM_POLICY_BOUNDS
+        if (adr > c->codelen)
+            goto fault;
+#else
+        // STOX can overwrite the return address even in verified
+        // programs; the DOP_BAD sentinel stops the VM instead
+        if (adr > c->codelen)
+            adr = c->codelen;
+#endif
+        SYNC_DISPLAY(idx);
+        CALLLEAVE();
+        t  = b-1;
+        b  = idx;
+        pc = adr;
+        FILL();
+        NEXT();
+
+    CASE(DOP_NEG)
+        TOP = -TOP;
+        NEXT();
+
+    CASE(DOP_ADD)
+        BINOP(+)
+
+    CASE(DOP_SUB)
+        BINOP(-)
+
+    CASE(DOP_MUL)
+        BINOP(*)
+
+    CASE(DOP_DIV)
+        BINOP(/)
+
+    CASE(DOP_ODD)
+        TOP = TOP & 1;
+        NEXT();
+
+    CASE(DOP_NOP)
+        NEXT();
+
+    CASE(DOP_EQ)
+        CMPOP(==)
+
+    CASE(DOP_NEQ)
+        CMPOP(!=)
+
+    CASE(DOP_LESS)
+        CMPOP(<)
+
+    CASE(DOP_LEQ)
+        CMPOP(<=)
+
+    CASE(DOP_GREATER)
+        CMPOP(>)
+
+    CASE(DOP_GEQ)
+        CMPOP(>=)
+
+    CASE(DOP_SHR)
+        TOP = ((uint16_t)TOP) >> 1;
+        NEXT();
+
+    CASE(DOP_SHL)
+        TOP <<= 1;
+        NEXT();
+
+    CASE(DOP_SAR)
+        TOP >>= 1;
+        NEXT();
+
+    CASE(DOP_OUTCHAR)
+        c->host.writeChar(c->host.user, TOP);
+        DROP();
+        NEXT();
+
+    CASE(DOP_OUTINT)
+        c->host.writeInt(c->host.user, TOP);
+        DROP();
+        NEXT();
+
+    CASE(DOP_INCHAR)
+        WAITINPUT(false);
+        SYNCCOUNT();
+        PUSH(c->host.readChar(c->host.user));
+        NEXT();
+
+    CASE(DOP_ININT)
+        WAITINPUT(true);
+        SYNCCOUNT();
+        PUSH(c->host.readInt(c->host.user));
+        NEXT();
+
+    CASE(DOP_LOD)
+        adr = disp[ins->level] + ins->n;
+        CHECK(adr);
+        PUSH(s[adr]);
+        NEXT();
+
+    CASE(DOP_STO)
+        adr = disp[ins->level] + ins->n;
+        CHECK(adr);
+        s[adr] = TOP;
+        DROP();
+        NEXT();
+
+    CASE(DOP_LODX)
+        idx = TOP;
+        SPILL();
+        adr = disp[ins->level] + ins->n;
+        CHECK(adr + idx);
+        TOP = s[adr + idx];
+        NEXT();
+
+    CASE(DOP_STOX)
+        idx = s[t-1];
+        adr = disp[ins->level] + ins->n;
+        CHECK(adr + idx);
+        s[adr + idx] = TOP;
+        t -= 2;
+        FILL();
+        NEXT();
+
+    CASE(DOP_CAL)
+        SPILL();
+        s[t+1] = disp[ins->level];
+        s[t+2] = b;
+        s[t+3] = pc;
+        b  = t+1;
+        pc = ins->a;
+        CALLENTER(pc);
+        SYNC_DISPLAY(b);
+        NEXT();
+
+    CASE(DOP_INT)
+        SPILL();
+        t += ins->n;
+        CHECK(t);
+        FILL();
+        NEXT();
+
+    CASE(DOP_JMP)
+        pc = ins->a;
+        BACKEDGE();
+        NEXT();
+
+    CASE(DOP_JPC)
+        v = TOP;
+        DROP();
+        if (v == 0)
+        {
+            pc = ins->a;
+            BACKEDGE();
+        }
+        NEXT();
+
+    /*
+        Superinstructions. ins[k] is the k-th instruction of
+        the fused sequence, pc already points past ins[0].
+        Unlike the plain sequence, the scratch cells above
+        the top of stack are not written. A variable can be
+        the cell at t, so the cached top of stack is spilled
+        first and reloaded after a variable is written.
+        Only the first instruction is traced, the ring records
+        each one with the state the plain sequence would have.
+    */
+
+    #define VAR(k)      s[(uint16_t)(disp[ins[k].level] + ins[k].n)]
+    #define CHECKVAR(k) CHECK((uint16_t)(disp[ins[k].level] + ins[k].n))
+    #define SKIP(k)     pc += (k); COUNT(k); COVER(k)
+
+    CASE(DOP_LOD_LIT_ADD_STO)
+        CHECKVAR(0);
+        CHECKVAR(3);
+        SPILL();
+        RECORDAT(1, DOP_LIT, 1, VAR(0));
+        RECORDAT(2, DOP_ADD, 2, ins[1].n);
+        RECORDAT(3, DOP_STO, 1, VAR(0) + ins[1].n);
+        VAR(3) = VAR(0) + ins[1].n;
+        FILL();
+        SKIP(3);
+        NEXT();
+
+    CASE(DOP_LIT_OUTCHAR_LIT_OUTCHAR)
+        RECORDAT(1, DOP_OUTCHAR, 1, ins[0].n);
+        RECORDAT(2, DOP_LIT, 0, RINGTOS);
+        RECORDAT(3, DOP_OUTCHAR, 1, ins[2].n);
+        c->host.writeChar(c->host.user, ins[0].n);
+        c->host.writeChar(c->host.user, ins[2].n);
+        SKIP(3);
+        NEXT();
+
+    CASE(DOP_LIT_STO)
+        CHECKVAR(1);
+        SPILL();
+        RECORDAT(1, DOP_STO, 1, ins[0].n);
+        VAR(1) = ins[0].n;
+        FILL();
+        SKIP(1);
+        NEXT();
+
+    CASE(DOP_LOD_STO)
+        CHECKVAR(0);
+        CHECKVAR(1);
+        SPILL();
+        RECORDAT(1, DOP_STO, 1, VAR(0));
+        VAR(1) = VAR(0);
+        FILL();
+        SKIP(1);
+        NEXT();
+
+    #define FUSED_ARITH(name, op) \
+    CASE(DOP_LOD_##name) \
+        CHECKVAR(0); \
+        SPILL(); \
+        RECORDAT(1, DOP_##name, 1, VAR(0)); \
+        TOP = TOP op VAR(0); \
+        SKIP(1); \
+        NEXT(); \
+    CASE(DOP_LOD_LOD_##name) \
+        CHECKVAR(0); \
+        CHECKVAR(1); \
+        SPILL(); \
+        RECORDAT(1, DOP_LOD, 1, VAR(0)); \
+        RECORDAT(2, DOP_##name, 2, VAR(1)); \
+        v = VAR(0) op VAR(1); \
+        PUSH(v); \
+        SKIP(2); \
+        NEXT();
+
+    FUSED_ARITH(ADD, +)
+    FUSED_ARITH(SUB, -)
+    FUSED_ARITH(MUL, *)
+    FUSED_ARITH(DIV, /)
+
+    #define FUSED_CMP(name, op) \
+    CASE(DOP_LOD_##name##_JPC) \
+        CHECKVAR(0); \
+        SPILL(); \
+        v = TOP; \
+        RECORDAT(1, DOP_##name, 1, VAR(0)); \
+        RECORDAT(2, DOP_JPC, 0, v op VAR(0)); \
+        DROP(); \
+        COUNT(2); \
+        COVER(2); \
+        pc = (v op VAR(0)) ? pc+2 : ins[2].a; \
+        BACKEDGE(); \
+        NEXT(); \
+    CASE(DOP_LOD_LOD_##name##_JPC) \
+        CHECKVAR(0); \
+        CHECKVAR(1); \
+        SPILL(); \
+        COUNT(3); \
+        COVER(3); \
+        RECORDAT(1, DOP_LOD, 1, VAR(0)); \
+        RECORDAT(2, DOP_##name, 2, VAR(1)); \
+        RECORDAT(3, DOP_JPC, 1, VAR(0) op VAR(1)); \
+        pc = (VAR(0) op VAR(1)) ? pc+3 : ins[3].a; \
+        BACKEDGE(); \
+        NEXT(); \
+    CASE(DOP_LOD_LIT_##name##_JPC) \
+        CHECKVAR(0); \
+        SPILL(); \
+        COUNT(3); \
+        COVER(3); \
+        RECORDAT(1, DOP_LIT, 1, VAR(0)); \
+        RECORDAT(2, DOP_##name, 2, ins[1].n); \
+        RECORDAT(3, DOP_JPC, 1, VAR(0) op ins[1].n); \
+        pc = (VAR(0) op ins[1].n) ? pc+3 : ins[3].a; \
+        BACKEDGE(); \
+        NEXT();
+
+    FUSED_CMP(EQ, ==)
+    FUSED_CMP(NEQ, !=)
+    FUSED_CMP(LESS, <)
+    FUSED_CMP(LEQ, <=)
+    FUSED_CMP(GREATER, >)
+    FUSED_CMP(GEQ, >=)
+
+    CASE(DOP_HALT)
+        stop = VM_STOP_HALT;
+        goto done;
+
+    CASE(DOP_BAD)
+        stop = VM_STOP_BAD;
+        goto done;
+
+#ifndef VM_THREADED
+    default:
+        stop = VM_STOP_BAD;
+        goto done;
+#endif
+
+    LOOP_END()
+
+#if VM_POLICY & VM_POLICY_BOUNDS
+fault:
+    // report the faulting instruction, not yet completed
+    stop = VM_STOP_BOUNDS;
+    pc = ins - code;
+    if (t >= ssize)
+        goto writeback;     // nowhere to spill to
+    goto done;
+#endif
+
+done:
+    SPILL();
+#if VM_POLICY & VM_POLICY_BOUNDS
+writeback:
+#endif
+#if VM_POLICY & VM_POLICY_PROFILE
+    if (cyc != NULL)
+    {
+        cyc[lastop] += vm_cycles() - last;
+    }
+#endif
+    SYNCTARGET();
+#if VM_POLICY & VM_POLICY_CALLS
+    vm_calls_pause(c->probes->calls, n);
+#endif
+    c->pc = pc;
+    c->t  = t;
+    c->b  = b;
+    c->inscount = n;
+    c->stop = stop;
+
+#if VM_POLICY & VM_POLICY_STEP
+    return stop == VM_STOP_NONE;
+#endif
+
+    #undef DISPATCH
+    #undef NEXT
+    #undef CASE
+    #undef LOOP_BEGIN
+    #undef LOOP_END
+    #undef BINOP
+    #undef CMPOP
+    #undef VAR
+    #undef CHECKVAR
+    #undef SKIP
+    #undef FUSED_ARITH
+    #undef FUSED_CMP
+    #undef SYNC_DISPLAY
+}
+
+#undef TOP
+#undef RHS
+#undef SPILL
+#undef FILL
+#undef PUSH
+#undef DROP
+#undef COUNT
+#undef SYNCCOUNT
+#undef CHECK
+#undef CHECKEFFECT
+#undef TRACE
+#undef RECORD
+#undef RECORDAT
+#undef RINGREC
+#undef RINGTOS
+#undef PROFILE
+#undef TARGET
+#undef SYNCTARGET
+#undef CALLENTER
+#undef CALLLEAVE
+#undef COVER
+#undef CHECKBREAK
+#undef CHECKLIMIT
+#undef WAITINPUT
+#undef BACKEDGE
+#undef OPCODE
+#undef FETCH
+#undef VM_RUN_NAME
+#undef VM_RUN_STATIC
+#undef VM_POLICY
@@ -0,0 +1,470 @@
+/*
+
+    x86-64 code emitter for the p-code JIT
+
+*/
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "vm.h"
+#include "x64emit.h"
+
+// dstack cell t+k: [rbx + r12*2 + 2k]
+#define CELL(k)     X64_RBX, X64_R12, 2, 2*(k)
+
+void x64_init(x64_buf_t *x)
+{
+    x->cap = 4096;
+    x->len = 0;
+    x->tos = false;
+    x->buf = malloc(x->cap);
+    x->failed = (x->buf == NULL);
+    if (x->failed)
+        x->cap = 0;
+}
+
+void x64_free(x64_buf_t *x)
+{
+    free(x->buf);
+    x->buf = NULL;
+}
+
+void x64_emit8(x64_buf_t *x, uint8_t v)
+{
+    if (x->failed)
+        return;
+    if (x->len == x->cap)
+    {
+        uint8_t *buf = realloc(x->buf, 2*x->cap);
+        if (buf == NULL)
+        {
+            x->failed = true;
+            return;
+        }
+        x->buf = buf;
+        x->cap *= 2;
+    }
+    x->buf[x->len++] = v;
+}
+
+void x64_emit32(x64_buf_t *x, uint32_t v)
+{
+    for(int i=0; i<4; i++)
+    {
+        x64_emit8(x, v & 0xFF);
+        v >>= 8;
+    }
+}
+
+void x64_emit64(x64_buf_t *x, uint64_t v)
+{
+    x64_emit32(x, v & 0xFFFFFFFF);
+    x64_emit32(x, v >> 32);
+}
+
+static void emit_prefix(x64_buf_t *x, bool p16, bool w, int reg, int index, int base)
+{
+    if (p16)
+        x64_emit8(x, 0x66);
+
+    uint8_t rex = 0x40;
+    if (w)
+        rex |= 0x08;
+    if (reg & 8)
+        rex |= 0x04;
+    if ((index != X64_NOINDEX) && (index & 8))
+        rex |= 0x02;
+    if (base & 8)
+        rex |= 0x01;
+
+    if (rex != 0x40)
+        x64_emit8(x, rex);
+}
+
+static void emit_opcode(x64_buf_t *x, uint16_t op)
+{
+    if (op > 0xFF)
+        x64_emit8(x, op >> 8);
+    x64_emit8(x, op & 0xFF);
+}
+
+void x64_rm_mem(x64_buf_t *x, bool p16, bool w, uint16_t op, int reg,
+    int base, int index, int scale, int32_t disp)
+{
+    emit_prefix(x, p16, w, reg, index, base);
+    emit_opcode(x, op);
+
+    // always use a displacement, which avoids the
+    // rbp/r13 special case of mod = 00.
+    bool    disp8 = (disp >= -128) && (disp <= 127);
+    uint8_t mod   = disp8 ? 0x40 : 0x80;
+
+    if (index != X64_NOINDEX)
+    {
+        uint8_t ss = (scale == 8) ? 3 : (scale == 4) ? 2 : (scale == 2) ? 1 : 0;
+        x64_emit8(x, mod | ((reg & 7) << 3) | 4);
+        x64_emit8(x, (ss << 6) | ((index & 7) << 3) | (base & 7));
+    }
+    else if ((base & 7) == 4)
+    {
+        // rsp/r12 as base needs a SIB byte
+        x64_emit8(x, mod | ((reg & 7) << 3) | 4);
+        x64_emit8(x, 0x24);
+    }
+    else
+    {
+        x64_emit8(x, mod | ((reg & 7) << 3) | (base & 7));
+    }
+
+    if (disp8)
+        x64_emit8(x, (uint8_t)disp);
+    else
+        x64_emit32(x, (uint32_t)disp);
+}
+
+void x64_rm_reg(x64_buf_t *x, bool p16, bool w, uint16_t op, int reg, int rm)
+{
+    emit_prefix(x, p16, w, reg, X64_NOINDEX, rm);
+    emit_opcode(x, op);
+    x64_emit8(x, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+size_t x64_jump(x64_buf_t *x, int cc)
+{
+    if (cc < 0)
+    {
+        x64_emit8(x, 0xE9);
+    }
+    else
+    {
+        x64_emit8(x, 0x0F);
+        x64_emit8(x, 0x80 | cc);
+    }
+    size_t at = x->len;
+    x64_emit32(x, 0);
+    return at;
+}
+
+void x64_patch(x64_buf_t *x, size_t at, size_t target)
+{
+    if (x->failed)
+        return;
+    int32_t rel = (int32_t)(target - (at + 4));
+    memcpy(&x->buf[at], &rel, 4);
+}
+
+static void emit_push(x64_buf_t *x, int reg)
+{
+    if (reg & 8)
+        x64_emit8(x, 0x41);
+    x64_emit8(x, 0x50 | (reg & 7));
+}
+
+static void emit_pop(x64_buf_t *x, int reg)
+{
+    if (reg & 8)
+        x64_emit8(x, 0x41);
+    x64_emit8(x, 0x58 | (reg & 7));
+}
+
+static void emit_movimm64(x64_buf_t *x, int reg, uint64_t v)
+{
+    x64_emit8(x, 0x48 | ((reg & 8) ? 1 : 0));
+    x64_emit8(x, 0xB8 | (reg & 7));
+    x64_emit64(x, v);
+}
+
+// call one of the vm_context_t.host functions, with rdi = host.user;
+// the other argument, if any, must already be in esi.
+static void emit_hostcall(x64_buf_t *x, size_t fn)
+{
+    x64_rm_mem(x, false, true, 0x8B, X64_RDI, X64_R15, X64_NOINDEX, 1,
+        offsetof(vm_context_t, host.user));                // mov rdi, [r15+user]
+    x64_rm_mem(x, false, false, 0xFF, 2, X64_R15, X64_NOINDEX, 1,
+        offsetof(vm_context_t, host) + fn);                // call [r15+fn]
+}
+
+static const int savedregs[] = {X64_RBX, X64_RBP, X64_R12, X64_R13, X64_R14, X64_R15};
+
+void x64_prologue(x64_buf_t *x, void **table)
+{
+    for(int i=0; i<6; i++)
+        emit_push(x, savedregs[i]);
+
+    // keep rsp 16-byte aligned for the helper calls
+    x64_rm_reg(x, false, true, 0x83, 5, X64_RSP);      // sub rsp, 8
+    x64_emit8(x, 8);
+
+    x64_rm_reg(x, false, true, 0x89, X64_RDI, X64_R15);    // mov r15, rdi
+    x64_rm_mem(x, false, true, 0x8B, X64_RBX, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, dstack));
+    x64_rm_mem(x, false, false, 0x0FB7, X64_R12, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, t));
+    x64_rm_mem(x, false, false, 0x0FB7, X64_R13, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, b));
+    x64_rm_mem(x, false, true, 0x8B, X64_R14, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, inscount));
+    emit_movimm64(x, X64_RBP, (uint64_t)(uintptr_t)table);
+}
+
+void x64_epilogue(x64_buf_t *x, bool count)
+{
+    x64_rm_mem(x, true, false, 0x89, X64_RAX, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, pc));
+    x64_rm_mem(x, true, false, 0x89, X64_R12, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, t));
+    x64_rm_mem(x, true, false, 0x89, X64_R13, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, b));
+    x64_rm_mem(x, false, false, 0x88, X64_RDX, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, stop)); // mov [stop], dl
+    if (count)
+    {
+        x64_rm_mem(x, false, true, 0x89, X64_R14, X64_R15, X64_NOINDEX, 1, offsetof(vm_context_t, inscount));
+    }
+
+    x64_rm_reg(x, false, true, 0x83, 0, X64_RSP);      // add rsp, 8
+    x64_emit8(x, 8);
+
+    for(int i=5; i>=0; i--)
+        emit_pop(x, savedregs[i]);
+
+    x64_emit8(x, 0xC3);
+}
+
+void x64_base(x64_buf_t *x, uint8_t level)
+{
+    x64_rm_reg(x, false, false, 0x89, X64_R13, X64_RAX);   // mov eax, r13d
+    for(uint8_t l=0; l<level; l++)
+    {
+        // movzx eax, word [rbx + rax*2]
+        x64_rm_mem(x, false, false, 0x0FB7, X64_RAX, X64_RBX, X64_RAX, 2, 0);
+    }
+}
+
+// eax = (uint16_t)(base(level) + n)
+static void emit_varadr(x64_buf_t *x, const vm_dins_t *ins)
+{
+    if (ins->level == 0)
+    {
+        x64_rm_mem(x, false, false, 0x8D, X64_RAX, X64_R13, X64_NOINDEX, 1, ins->n);   // lea eax, [r13+n]
+    }
+    else
+    {
+        x64_base(x, ins->level);
+        x64_rm_reg(x, false, false, 0x81, 0, X64_RAX);     // add eax, n
+        x64_emit32(x, (uint32_t)(int32_t)ins->n);
+    }
+    x64_rm_reg(x, false, false, 0x0FB7, X64_RAX, X64_RAX); // movzx eax, ax
+}
+
+static void emit_inc_t(x64_buf_t *x)
+{
+    x64_rm_reg(x, false, true, 0xFF, 0, X64_R12);
+}
+
+static void emit_dec_t(x64_buf_t *x)
+{
+    x64_rm_reg(x, false, true, 0xFF, 1, X64_R12);
+}
+
+void x64_flush(x64_buf_t *x)
+{
+    if (x->tos)
+    {
+        x64_rm_mem(x, true, false, 0x89, X64_RCX, CELL(0));    // mov [t], cx
+        x->tos = false;
+    }
+}
+
+void x64_tos(x64_buf_t *x)
+{
+    if (!x->tos)
+    {
+        x64_rm_mem(x, false, false, 0x0FB7, X64_RCX, CELL(0)); // movzx ecx, word [t]
+        x->tos = true;
+    }
+}
+
+static void emit_cmp(x64_buf_t *x, uint8_t cc)
+{
+    x64_tos(x);
+    emit_dec_t(x);
+    x64_rm_mem(x, true, false, 0x39, X64_RCX, CELL(0));        // cmp [t], cx
+    x64_rm_reg(x, false, false, 0x0F90 | cc, 0, X64_RCX);      // setcc cl
+    x64_rm_reg(x, false, false, 0x0FB6, X64_RCX, X64_RCX);     // movzx ecx, cl
+}
+
+static void emit_muldiv(x64_buf_t *x, bool div)
+{
+    x64_tos(x);
+    emit_dec_t(x);
+    x64_rm_mem(x, false, false, 0x0FBF, X64_RAX, CELL(0));     // movsx eax, word [t]
+    x64_rm_reg(x, false, false, 0x0FBF, X64_RCX, X64_RCX);     // movsx ecx, cx
+    if (div)
+    {
+        x64_emit8(x, 0x99);                                     // cdq
+        x64_rm_reg(x, false, false, 0xF7, 7, X64_RCX);         // idiv ecx
+        x64_rm_reg(x, false, false, 0x89, X64_RAX, X64_RCX);   // mov ecx, eax
+    }
+    else
+    {
+        x64_rm_reg(x, false, false, 0x0FAF, X64_RCX, X64_RAX); // imul ecx, eax
+    }
+}
+
+bool x64_straight(x64_buf_t *x, const vm_dins_t *ins)
+{
+    uint8_t op = vm_unfused(ins->op);
+    switch(op)
+    {
+    case DOP_LIT:
+        x64_flush(x);
+        emit_inc_t(x);
+        x64_emit8(x, 0xB9);                                     // mov ecx, n
+        x64_emit32(x, ins->a);
+        x->tos = true;
+        break;
+    case DOP_LOD:
+        x64_flush(x);
+        emit_varadr(x, ins);
+        emit_inc_t(x);
+        x64_rm_mem(x, false, false, 0x0FB7, X64_RCX, X64_RBX, X64_RAX, 2, 0);
+        x->tos = true;
+        break;
+    case DOP_STO:
+        x64_tos(x);
+        emit_varadr(x, ins);
+        x64_rm_mem(x, true, false, 0x89, X64_RCX, X64_RBX, X64_RAX, 2, 0);
+        emit_dec_t(x);
+        x->tos = false;
+        break;
+    case DOP_LODX:
+        x64_tos(x);
+        emit_varadr(x, ins);
+        x64_rm_reg(x, false, false, 0x0FB7, X64_RCX, X64_RCX);     // movzx ecx, cx
+        x64_rm_reg(x, false, false, 0x01, X64_RCX, X64_RAX);       // add eax, ecx
+        x64_rm_mem(x, false, false, 0x0FB7, X64_RCX, X64_RBX, X64_RAX, 2, 0);
+        break;
+    case DOP_STOX:
+        x64_tos(x);
+        emit_varadr(x, ins);
+        x64_rm_mem(x, false, false, 0x0FB7, X64_RDX, CELL(-1));    // movzx edx, word [t-1]
+        x64_rm_reg(x, false, false, 0x01, X64_RDX, X64_RAX);       // add eax, edx
+        x64_rm_mem(x, true, false, 0x89, X64_RCX, X64_RBX, X64_RAX, 2, 0);
+        x64_rm_reg(x, false, true, 0x83, 5, X64_R12);              // sub r12, 2
+        x64_emit8(x, 2);
+        x->tos = false;
+        break;
+    case DOP_INT:
+        x64_flush(x);
+        x64_rm_reg(x, false, true, 0x81, 0, X64_R12);              // add r12, n
+        x64_emit32(x, (uint32_t)(int32_t)ins->n);
+        break;
+    case DOP_NEG:
+        x64_tos(x);
+        x64_rm_reg(x, true, false, 0xF7, 3, X64_RCX);              // neg cx
+        break;
+    case DOP_ODD:
+        x64_tos(x);
+        x64_rm_reg(x, false, false, 0x83, 4, X64_RCX);             // and ecx, 1
+        x64_emit8(x, 1);
+        break;
+    case DOP_SHR:
+        x64_tos(x);
+        x64_rm_reg(x, true, false, 0xD1, 5, X64_RCX);
+        break;
+    case DOP_SHL:
+        x64_tos(x);
+        x64_rm_reg(x, true, false, 0xD1, 4, X64_RCX);
+        break;
+    case DOP_SAR:
+        x64_tos(x);
+        x64_rm_reg(x, true, false, 0xD1, 7, X64_RCX);
+        break;
+    case DOP_ADD:
+        x64_tos(x);
+        emit_dec_t(x);
+        x64_rm_mem(x, true, false, 0x03, X64_RCX, CELL(0));        // add cx, [t]
+        break;
+    case DOP_SUB:
+        x64_tos(x);
+        emit_dec_t(x);
+        x64_rm_mem(x, false, false, 0x0FB7, X64_RAX, CELL(0));     // movzx eax, word [t]
+        x64_rm_reg(x, false, false, 0x29, X64_RCX, X64_RAX);       // sub eax, ecx
+        x64_rm_reg(x, false, false, 0x89, X64_RAX, X64_RCX);       // mov ecx, eax
+        break;
+    case DOP_MUL:
+        emit_muldiv(x, false);
+        break;
+    case DOP_DIV:
+        emit_muldiv(x, true);
+        break;
+    case DOP_EQ:
+        emit_cmp(x, X64_CC_E);
+        break;
+    case DOP_NEQ:
+        emit_cmp(x, X64_CC_NE);
+        break;
+    case DOP_LESS:
+        emit_cmp(x, X64_CC_L);
+        break;
+    case DOP_LEQ:
+        emit_cmp(x, X64_CC_LE);
+        break;
+    case DOP_GREATER:
+        emit_cmp(x, X64_CC_G);
+        break;
+    case DOP_GEQ:
+        emit_cmp(x, X64_CC_GE);
+        break;
+    case DOP_OUTCHAR:
+    case DOP_OUTINT:
+        x64_tos(x);
+        x64_rm_reg(x, false, false, 0x0FBF, X64_RSI, X64_RCX);     // movsx esi, cx
+        emit_dec_t(x);
+        x->tos = false;
+        emit_hostcall(x, (op == DOP_OUTCHAR) ? offsetof(vm_host_t, writeChar)
+                                             : offsetof(vm_host_t, writeInt));
+        break;
+    case DOP_INCHAR:
+    case DOP_ININT:
+        x64_flush(x);
+        // the host may read the instruction count (vm --record)
+        x64_rm_mem(x, false, true, 0x89, X64_R14, X64_R15, X64_NOINDEX, 1,
+            offsetof(vm_context_t, inscount));                 // mov [r15+inscount], r14
+        emit_hostcall(x, (op == DOP_INCHAR) ? offsetof(vm_host_t, readChar)
+                                            : offsetof(vm_host_t, readInt));
+        emit_inc_t(x);
+        x64_rm_reg(x, false, false, 0x89, X64_RAX, X64_RCX);       // mov ecx, eax
+        x->tos = true;
+        break;
+    case DOP_NOP:
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+void* x64_finalize(x64_buf_t *x)
+{
+    if (x->failed)
+        return NULL;
+
+    void *code = mmap(NULL, x->len, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (code == MAP_FAILED)
+        return NULL;
+
+    memcpy(code, x->buf, x->len);
+    if (mprotect(code, x->len, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(code, x->len);
+        return NULL;
+    }
+    return code;
+}
+
+void x64_release(void *code, size_t size)
+{
+    munmap(code, size);
+}
+
+#endif
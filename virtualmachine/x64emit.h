@@ -0,0 +1,96 @@
+/*
+
+    x86-64 code emitter for the p-code JIT
+
+    Register assignment of the generated code:
+        rbx  dstack base
+        r12  t
+        r13  b
+        r14  instruction count
+        r15  vm_context_t *
+        rbp  pc -> native address table
+        ecx  top of stack, while x64_buf_t.tos is set
+
+    all of them are callee-saved, so the console
+    helpers can be called without spilling.
+
+*/
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "opcodes.h"
+
+enum
+{
+    X64_RAX = 0, X64_RCX, X64_RDX, X64_RBX,
+    X64_RSP, X64_RBP, X64_RSI, X64_RDI,
+    X64_R8, X64_R9, X64_R10, X64_R11,
+    X64_R12, X64_R13, X64_R14, X64_R15
+};
+
+#define X64_NOINDEX (-1)
+
+// condition codes for jcc/setcc
+#define X64_CC_E    0x4
+#define X64_CC_NE   0x5
+#define X64_CC_A    0x7
+#define X64_CC_L    0xC
+#define X64_CC_GE   0xD
+#define X64_CC_LE   0xE
+#define X64_CC_G    0xF
+
+/** growable buffer for generated code */
+typedef struct
+{
+    uint8_t *buf;
+    size_t  len;
+    size_t  cap;
+    bool    tos;    ///< top of stack is held in cx, dstack[t] is stale
+    bool    failed; ///< out of memory, the code is incomplete
+} x64_buf_t;
+
+void x64_init(x64_buf_t *x);
+void x64_free(x64_buf_t *x);
+
+void x64_emit8(x64_buf_t *x, uint8_t v);
+void x64_emit32(x64_buf_t *x, uint32_t v);
+void x64_emit64(x64_buf_t *x, uint64_t v);
+
+/** op reg, [base + index*scale + disp] */
+void x64_rm_mem(x64_buf_t *x, bool p16, bool w, uint16_t op, int reg,
+    int base, int index, int scale, int32_t disp);
+
+/** op reg, rm (register direct) */
+void x64_rm_reg(x64_buf_t *x, bool p16, bool w, uint16_t op, int reg, int rm);
+
+/** jmp rel32 or jcc rel32 (cc < 0 for jmp), returns the offset of rel32 */
+size_t x64_jump(x64_buf_t *x, int cc);
+
+/** point the rel32 at offset 'at' to code offset 'target' */
+void x64_patch(x64_buf_t *x, size_t at, size_t target);
+
+/** save callee-saved registers and load the VM registers from the context in rdi */
+void x64_prologue(x64_buf_t *x, void **table);
+
+/** store the VM registers, with eax holding the pc and edx the
+    vm_stop_t, and return */
+void x64_epilogue(x64_buf_t *x, bool count);
+
+/** eax = base(level), the frame address of a static level */
+void x64_base(x64_buf_t *x, uint8_t level);
+
+/** write a cached top of stack back to dstack[t] */
+void x64_flush(x64_buf_t *x);
+
+/** make sure the top of stack is in cx */
+void x64_tos(x64_buf_t *x);
+
+/** emit an instruction that does not change the control flow;
+    returns false for jumps, calls, returns and HALT */
+bool x64_straight(x64_buf_t *x, const vm_dins_t *ins);
+
+/** copy the code into executable memory, returns NULL on failure,
+    also if the buffer ran out of memory while emitting */
+void* x64_finalize(x64_buf_t *x);
+void  x64_release(void *code, size_t size);
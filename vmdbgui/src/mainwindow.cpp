@@ -14,6 +14,11 @@
 #include "common.h"
 #include "mainwindow.h"
 
+extern "C"
+{
+    #include "imagefile.h"
+}
+
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent)
 {
@@ -132,33 +137,22 @@ void MainWindow::OnFileOpen()
 
         qDebug() << "Loading " << SelectedFile;
 
-        FILE *fin = fopen(SelectedFile.toUtf8().data(), "rb");
-        if (fin == nullptr)
+        // a program image or a raw code file, see image.h
+        vm_image_t image;
+        if (!vm_image_open(&image, SelectedFile.toUtf8().data()))
         {
             qDebug() << "Error loading file " << SelectedFile;
             return;
         }
 
-        fseek(fin,0,SEEK_END);
-        size_t bytes = ftell(fin);
-        rewind(fin);
-
-        std::unique_ptr<uint8_t> data(new uint8_t[bytes]);
-        if (fread(data.get(), 1, bytes, fin) != bytes)
-        {
-            qDebug() << "Error loading file " << SelectedFile;
-            fclose(fin);
-            return;            
-        }
-
         m_vm.clear();
-        m_vm.load(data.get(), bytes);
+        m_vm.load(image.code, image.codebytes);
 
         m_regmodel->update();
         m_stackmodel->update();
         m_codemodel->update();
 
-        fclose(fin);
+        vm_image_close(&image);
     }
 }
 
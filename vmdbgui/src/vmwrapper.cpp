@@ -1,5 +1,6 @@
 #include <stdlib.h>
 #include <memory.h>
+#include <new>
 #include "vmwrapper.h"
 
 VMWrapper::VMWrapper()
@@ -8,6 +9,7 @@ VMWrapper::VMWrapper()
     m_context->mem = nullptr;
     m_context->memsize  = 0;
     m_context->dstack = nullptr;
+    m_context->code = nullptr;
     clear();    
 }
 
@@ -33,15 +35,17 @@ void VMWrapper::clear()
     if (m_context->dstack != nullptr)
         vm_free(m_context);
 
-    vm_init(m_context, nullptr, 0);
+    // no stack, as new without memory
+    if (!vm_init(m_context, nullptr, 0))
+        throw std::bad_alloc();
 }
 
 void VMWrapper::load(const uint8_t *code, uint16_t bytes)
 {
     clear();
-    m_context->mem = new uint8_t[bytes];
-    m_context->memsize = bytes;
-    memcpy(m_context->mem, code, bytes);
+    uint8_t *mem = new uint8_t[bytes];
+    memcpy(mem, code, bytes);
+    vm_load(m_context, mem, bytes);
     reset();
 }
 